@@ -0,0 +1,88 @@
+﻿/*
+    This file is part of
+    amnlib - A C++ library for deviantART Message Network
+    Copyright © 2013 Carl Tessier <http://drfrankenstein90.deviantart.com/>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "transportbench.h"
+
+#include <QCoreApplication>
+#include <QStringList>
+
+#include <cstdio>
+
+// transportbench [connections] [MiB per connection] [qt,epoll,uring]
+//
+// Echoes frames through each backend in turn against a loopback server and
+// prints the throughput. Exits non-zero when anything came back wrong, so it
+// doubles as a check of the backends.
+int main(int argc, char* argv[])
+{
+    QCoreApplication app (argc, argv);
+    const QStringList args = app.arguments();
+
+    const int connections = args.size() > 1 ? args.at(1).toInt() : 64;
+    const qint64 bytes = (args.size() > 2 ? args.at(2).toLongLong() : 4) * 1024 * 1024;
+    const QStringList names = (args.size() > 3 ? args.at(3) : QString("qt,epoll,uring")).split(',');
+
+    if(connections <= 0 || bytes <= 0)
+    {
+        fprintf(stderr, "usage: transportbench [connections] [MiB per connection] [qt,epoll,uring]\n");
+        return 2;
+    }
+
+    EchoServer server;
+    const quint16 port = server.listen();
+    if(!port)
+    {
+        fprintf(stderr, "Can't listen on the loopback interface.\n");
+        return 1;
+    }
+
+    bool failed = false;
+    foreach(const QString& name, names)
+    {
+        BenchRun::Backend backend;
+        if(name == "qt")
+            backend = BenchRun::qt;
+#ifdef Q_OS_LINUX
+        else if(name == "epoll")
+            backend = BenchRun::epoll;
+        else if(name == "uring")
+            backend = BenchRun::uring;
+#endif
+        else
+        {
+            fprintf(stderr, "%s: no such backend here, skipped.\n", qPrintable(name));
+            continue;
+        }
+
+        BenchRun run (backend, port, connections, bytes);
+        run.start();
+        run.wait();
+
+        const double mib = run.echoed() / (1024.0 * 1024.0);
+        const double seconds = qMax<qint64>(run.elapsed(), 1) / 1000.0;
+        printf("%-6s %5d connections %9.1f MiB %8.2f s %9.1f MiB/s%s%s\n",
+               qPrintable(name), connections, mib, seconds, mib / seconds,
+               backend == BenchRun::uring && !run.usedRing() ? "  (no ring, ran on epoll)" : "",
+               run.failed() ? "  FAILED" : "");
+
+        failed = failed || run.failed();
+    }
+
+    return failed ? 1 : 0;
+}
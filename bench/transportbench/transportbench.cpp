@@ -0,0 +1,286 @@
+﻿/*
+    This file is part of
+    amnlib - A C++ library for deviantART Message Network
+    Copyright © 2013 Carl Tessier <http://drfrankenstein90.deviantart.com/>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "transportbench.h"
+
+#ifdef Q_OS_LINUX
+#include "damnepolltransport.h"
+#endif
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QHostAddress>
+#include <QList>
+
+EchoServer::EchoServer()
+    : _port(0)
+{
+}
+
+EchoServer::~EchoServer()
+{
+    this->quit();
+    this->wait();
+}
+
+quint16 EchoServer::listen()
+{
+    this->start();
+    this->_listening.acquire();
+    return this->_port;
+}
+
+void EchoServer::run()
+{
+    QTcpServer server;
+    EchoHandler handler (&server);
+
+    this->_port = server.listen(QHostAddress::LocalHost) ? server.serverPort() : 0;
+    this->_listening.release();
+
+    if(this->_port)
+        this->exec();
+}
+
+EchoHandler::EchoHandler(QTcpServer* server)
+    : _server(server)
+{
+    connect(server, SIGNAL(newConnection()), this, SLOT(accept()));
+}
+
+void EchoHandler::accept()
+{
+    while(this->_server->hasPendingConnections())
+    {
+        QTcpSocket* socket = this->_server->nextPendingConnection();
+        connect(socket, SIGNAL(readyRead()), this, SLOT(echo()));
+        connect(socket, SIGNAL(disconnected()), socket, SLOT(deleteLater()));
+    }
+}
+
+void EchoHandler::echo()
+{
+    QTcpSocket* socket = qobject_cast<QTcpSocket*>(this->sender());
+    if(socket)
+        socket->write(socket->readAll());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+BenchClient::BenchClient(dAmnTransport* transport, const QByteArray& batch, qint64 total, QObject* parent)
+    : QObject(parent), _transport(transport), _batch(batch), _total(total),
+      _sent(0), _echoed(0), _done(false), _failed(false)
+{
+    transport->setParent(this);
+
+    connect(transport, SIGNAL(stateChanged(dAmnTransport::State)),
+            this, SLOT(stateChange(dAmnTransport::State)));
+    connect(transport, SIGNAL(readyRead()), this, SLOT(read()));
+    connect(transport, SIGNAL(error(QAbstractSocket::SocketError)),
+            this, SLOT(transportError(QAbstractSocket::SocketError)));
+}
+
+void BenchClient::start(quint16 port)
+{
+    this->_transport->connectToHost("127.0.0.1", port);
+}
+
+bool BenchClient::isDone() const
+{
+    return this->_done;
+}
+
+bool BenchClient::failed() const
+{
+    return this->_failed;
+}
+
+qint64 BenchClient::echoed() const
+{
+    return this->_echoed;
+}
+
+void BenchClient::stateChange(dAmnTransport::State state)
+{
+    if(state == dAmnTransport::connected)
+        this->sendBatch();
+    else if(state == dAmnTransport::unconnected && !this->_done)
+    {
+        qWarning("Connection closed after %lld of %lld bytes.", this->_echoed, this->_total);
+        this->finish(true);
+    }
+}
+
+// What comes back has to be the batch again, byte for byte.
+void BenchClient::read()
+{
+    const QByteArray data = this->_transport->readAll();
+    if(this->_done)
+        return;
+
+    const int size = this->_batch.size();
+    for(int done = 0; done < data.size(); )
+    {
+        const int offset = this->_echoed % size;
+        const int length = qMin(data.size() - done, size - offset);
+        if(memcmp(data.constData() + done, this->_batch.constData() + offset, length) != 0)
+        {
+            qWarning("Echo differs from what was sent after %lld bytes.", this->_echoed);
+            this->finish(true);
+            return;
+        }
+
+        done += length;
+        this->_echoed += length;
+    }
+
+    if(this->_echoed > this->_sent)
+    {
+        qWarning("Got %lld bytes back but sent %lld.", this->_echoed, this->_sent);
+        this->finish(true);
+    }
+    else if(this->_echoed == this->_sent)
+    {
+        if(this->_sent < this->_total)
+            this->sendBatch();
+        else
+            this->finish(false);
+    }
+}
+
+void BenchClient::transportError(QAbstractSocket::SocketError error)
+{
+    if(this->_done)
+        return;
+
+    qWarning("Transport error %d: %s", int(error), qPrintable(this->_transport->errorString()));
+    this->finish(true);
+}
+
+void BenchClient::sendBatch()
+{
+    this->_transport->write(this->_batch);
+    this->_sent += this->_batch.size();
+}
+
+void BenchClient::finish(bool failed)
+{
+    this->_done = true;
+    this->_failed = failed;
+    this->_transport->disconnectFromHost();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+BenchRun::BenchRun(Backend backend, quint16 port, int connections, qint64 bytes)
+    : _backend(backend), _port(port), _connections(connections), _bytes(bytes),
+      _failed(false), _usedRing(false), _echoed(0), _elapsed(0)
+{
+}
+
+bool BenchRun::failed() const
+{
+    return this->_failed;
+}
+
+bool BenchRun::usedRing() const
+{
+    return this->_usedRing;
+}
+
+qint64 BenchRun::echoed() const
+{
+    return this->_echoed;
+}
+
+qint64 BenchRun::elapsed() const
+{
+    return this->_elapsed;
+}
+
+void BenchRun::run()
+{
+#ifdef Q_OS_LINUX
+    if(this->_backend != qt)
+        dAmnEpollLoop::setDefaultRingSlots(this->_backend == uring ? qMax(this->_connections, 256) : 0);
+#endif
+
+    const QByteArray batch = frameBatch();
+    QList<BenchClient*> clients;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    for(int i = 0; i < this->_connections; i++)
+    {
+        BenchClient* client = new BenchClient(this->createTransport(), batch, this->_bytes);
+        client->start(this->_port);
+        clients.append(client);
+    }
+
+    for(;;)
+    {
+        bool done = true;
+        foreach(BenchClient* client, clients)
+            done = done && client->isDone();
+        if(done)
+            break;
+
+        QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents);
+    }
+
+    this->_elapsed = timer.elapsed();
+
+#ifdef Q_OS_LINUX
+    if(this->_backend != qt)
+        this->_usedRing = dAmnEpollLoop::instance()->usesRing();
+#endif
+
+    foreach(BenchClient* client, clients)
+    {
+        this->_failed = this->_failed || client->failed();
+        this->_echoed += client->echoed();
+    }
+
+    qDeleteAll(clients);
+}
+
+dAmnTransport* BenchRun::createTransport()
+{
+#ifdef Q_OS_LINUX
+    if(this->_backend != qt)
+        return new dAmnEpollTransport;
+#endif
+    return new dAmnQtTransport;
+}
+
+QByteArray frameBatch()
+{
+    QByteArray batch;
+    for(int i = 0; batch.size() < 65536; i++)
+    {
+        batch += "recv chat:Bench\n\nmsg main\nfrom=bencher" + QByteArray::number(i % 37) + "\n\n";
+        batch += QByteArray(40 + (i * 7919) % 400, 'a' + i % 26);
+        batch += '\0';
+    }
+    return batch;
+}
@@ -0,0 +1,136 @@
+﻿/*
+    This file is part of
+    amnlib - A C++ library for deviantART Message Network
+    Copyright © 2013 Carl Tessier <http://drfrankenstein90.deviantart.com/>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TRANSPORTBENCH_H
+#define TRANSPORTBENCH_H
+
+#include "damntransport.h"
+
+#include <QObject>
+#include <QThread>
+#include <QSemaphore>
+#include <QByteArray>
+#include <QAbstractSocket>
+
+class QTcpServer;
+
+// Echoes everything back from a thread of its own, so the transports being
+// measured don't share their event loop with it. It's the same plain
+// QTcpServer whichever backend is measured.
+class EchoServer : public QThread
+{
+    Q_OBJECT
+
+    QSemaphore _listening;
+    quint16 _port;
+
+public:
+    EchoServer();
+    ~EchoServer();
+
+    // Starts the thread; the port it listens on, or 0 if it couldn't.
+    quint16 listen();
+
+protected:
+    void run();
+};
+
+class EchoHandler : public QObject
+{
+    Q_OBJECT
+
+    QTcpServer* _server;
+
+public:
+    explicit EchoHandler(QTcpServer* server);
+
+private slots:
+    void accept();
+    void echo();
+};
+
+// One connection: writes a batch of frames, waits for all of it to come back
+// and checks it, then writes the next, until it has sent its share.
+class BenchClient : public QObject
+{
+    Q_OBJECT
+
+    dAmnTransport* _transport;
+    QByteArray _batch;
+    qint64 _total, _sent, _echoed;
+    bool _done, _failed;
+
+public:
+    BenchClient(dAmnTransport* transport, const QByteArray& batch, qint64 total, QObject* parent = 0);
+
+    void start(quint16 port);
+
+    bool isDone() const;
+    bool failed() const;
+    qint64 echoed() const;
+
+private slots:
+    void stateChange(dAmnTransport::State state);
+    void read();
+    void transportError(QAbstractSocket::SocketError error);
+
+private:
+    void sendBatch();
+    void finish(bool failed);
+};
+
+// Runs one backend's clients to completion on a thread of its own, since the
+// epoll loop is per thread and whether it has a ring is settled when the
+// thread's first transport creates it.
+class BenchRun : public QThread
+{
+    Q_OBJECT
+
+public:
+    enum Backend
+    {
+        qt, epoll, uring
+    };
+
+    BenchRun(Backend backend, quint16 port, int connections, qint64 bytes);
+
+    bool failed() const;
+    bool usedRing() const;
+    qint64 echoed() const;
+    qint64 elapsed() const;     // milliseconds
+
+protected:
+    void run();
+
+private:
+    Backend _backend;
+    quint16 _port;
+    int _connections;
+    qint64 _bytes;
+
+    bool _failed, _usedRing;
+    qint64 _echoed, _elapsed;
+
+    dAmnTransport* createTransport();
+};
+
+// About 64 KiB of recv/msg frames, the way a busy room arrives.
+QByteArray frameBatch();
+
+#endif // TRANSPORTBENCH_H
@@ -0,0 +1,20 @@
+# -------------------------------------------------
+# Loopback benchmark of mnlib's transports.
+#
+# Build mnlib first, then:
+#     qmake MNLIB_BUILD=/path/to/mnlib/build && make && ./transportbench
+# The uring run falls back to epoll, and says so, unless mnlib was built
+# with CONFIG+=liburing.
+# -------------------------------------------------
+QT += network
+QT -= gui
+CONFIG += console
+CONFIG -= app_bundle
+TARGET = transportbench
+TEMPLATE = app
+isEmpty(MNLIB_BUILD):MNLIB_BUILD = $$OUT_PWD/../..
+INCLUDEPATH += ../..
+LIBS += -L$$MNLIB_BUILD -lmnlib
+SOURCES += main.cpp \
+    transportbench.cpp
+HEADERS += transportbench.h
@@ -0,0 +1,233 @@
+﻿/*
+    This file is part of
+    amnlib - A C++ library for deviantART Message Network
+    Copyright © 2013 Carl Tessier <http://drfrankenstein90.deviantart.com/>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "damnatom.h"
+
+#include <QHash>
+#include <QVector>
+#include <QAtomicInt>
+#include <QReadWriteLock>
+
+namespace
+{
+    // The pool is split in shards by hash, each with its own lock, so threads
+    // parsing packets for different sessions seldom wait on each other. An
+    // atom's low bits say which shard holds it, the others where.
+    const int shardBits = 4;
+    const int shardCount = 1 << shardBits;
+    const int blockSize = 256;
+    const int blockCount = 2048;    // so 512k strings a shard at once
+
+    struct Slot
+    {
+        QString string;
+        QAtomicInt refs;
+        QAtomicInt pinned;          // by intern(); never released
+    };
+
+    struct Shard
+    {
+        QReadWriteLock lock;
+        QHash<QString, quint32> ids;
+        // Slots never move once allocated, so an atom reaches its own without
+        // the lock: holding it keeps the slot from being reused.
+        Slot* blocks[blockCount];
+        int size;
+        QVector<int> freed;         // slots whose last atom went away
+
+        Shard() : size(0) { memset(this->blocks, 0, sizeof(this->blocks)); }
+    };
+
+    // Never destroyed: atoms in other files' statics may outlive this one.
+    Shard* pool()
+    {
+        static Shard* shards = new Shard[shardCount];
+        return shards;
+    }
+
+    Shard& shardOf(const QString& string)
+    {
+        return pool()[qHash(string) & (shardCount - 1)];
+    }
+
+    Shard& shardOf(quint32 id)
+    {
+        return pool()[id & (shardCount - 1)];
+    }
+
+    Slot& slotOf(Shard& shard, quint32 id)
+    {
+        const int index = (id >> shardBits) - 1;
+        return shard.blocks[index / blockSize][index % blockSize];
+    }
+
+    const QString nullString;
+}
+
+dAmnAtom::dAmnAtom(const QString& string)
+    : _id(0)
+{
+    if(string.isNull())
+        return;
+
+    Shard& shard = shardOf(string);
+    {
+        QReadLocker locker (&shard.lock);
+        this->_id = shard.ids.value(string);
+        if(this->_id)
+        {   // Under the lock, so it can't be released meanwhile.
+            slotOf(shard, this->_id).refs.ref();
+            return;
+        }
+    }
+
+    QWriteLocker locker (&shard.lock);
+    this->_id = shard.ids.value(string);    // someone may have beaten us to it
+    if(this->_id)
+    {
+        slotOf(shard, this->_id).refs.ref();
+        return;
+    }
+
+    int index;
+    if(!shard.freed.isEmpty())
+    {
+        index = shard.freed.last();
+        shard.freed.removeLast();
+    }
+    else if(shard.size < blockCount * blockSize)
+    {
+        index = shard.size++;
+        if(index % blockSize == 0)
+            shard.blocks[index / blockSize] = new Slot[blockSize];
+    }
+    else
+    {
+        MNLIB_CRIT("The atom pool is full; \"%s\" stays a plain string.", qPrintable(string));
+        return;
+    }
+
+    this->_id = (quint32(index + 1) << shardBits) | quint32(&shard - pool());
+    Slot& slot = slotOf(shard, this->_id);
+    slot.string = string;
+    slot.refs.fetchAndStoreOrdered(1);
+    shard.ids.insert(string, this->_id);
+}
+
+dAmnAtom::dAmnAtom(const dAmnAtom& other)
+    : _id(other._id)
+{
+    if(this->_id)
+        slotOf(shardOf(this->_id), this->_id).refs.ref();
+}
+
+dAmnAtom::~dAmnAtom()
+{
+    this->release();
+}
+
+dAmnAtom& dAmnAtom::operator =(const dAmnAtom& rhs)
+{
+    if(rhs._id)
+        slotOf(shardOf(rhs._id), rhs._id).refs.ref();
+    this->release();
+    this->_id = rhs._id;
+    return *this;
+}
+
+void dAmnAtom::release()
+{
+    if(!this->_id)
+        return;
+
+    Shard& shard = shardOf(this->_id);
+    Slot& slot = slotOf(shard, this->_id);
+    const quint32 id = this->_id;
+    this->_id = 0;
+
+    if(slot.refs.deref())
+        return;
+
+    // Someone may have found the string between our deref and this lock, or
+    // released and reused the slot already; only the last one out frees it.
+    QWriteLocker locker (&shard.lock);
+    if(!slot.refs.testAndSetOrdered(0, 0) || shard.ids.value(slot.string) != id)
+        return;
+
+    shard.ids.remove(slot.string);
+    slot.string = QString();
+    shard.freed.append((id >> shardBits) - 1);
+}
+
+dAmnAtom dAmnAtom::find(const QString& string)
+{
+    dAmnAtom atom;
+    Shard& shard = shardOf(string);
+
+    QReadLocker locker (&shard.lock);
+    atom._id = shard.ids.value(string);
+    if(atom._id)
+        slotOf(shard, atom._id).refs.ref();
+    return atom;
+}
+
+QString dAmnAtom::intern(const QString& string)
+{
+    if(string.isEmpty())
+        return string;
+
+    dAmnAtom atom (string);
+    if(atom.isNull())
+        return string;
+
+    Slot& slot = slotOf(shardOf(atom._id), atom._id);
+    if(slot.pinned.testAndSetOrdered(0, 1))
+        slot.refs.ref();
+    return slot.string;
+}
+
+QString dAmnAtom::share(const QString& string)
+{
+    if(string.isEmpty())
+        return string;
+
+    dAmnAtom atom = find(string);
+    return atom.isNull() ? string : atom.toString();
+}
+
+int dAmnAtom::count()
+{
+    Shard* shards = pool();
+    int count = 0;
+    for(int i = 0; i < shardCount; i++)
+    {
+        QReadLocker locker (&shards[i].lock);
+        count += shards[i].size - shards[i].freed.size();
+    }
+
+    return count;
+}
+
+const QString& dAmnAtom::toString() const
+{
+    if(!this->_id)
+        return nullString;
+
+    return slotOf(shardOf(this->_id), this->_id).string;
+}
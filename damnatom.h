@@ -0,0 +1,76 @@
+﻿/*
+    This file is part of
+    amnlib - A C++ library for deviantART Message Network
+    Copyright © 2013 Carl Tessier <http://drfrankenstein90.deviantart.com/>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DAMNATOM_H
+#define DAMNATOM_H
+
+#include "mnlib_global.h"
+
+#include <QString>
+
+// An interned string: every dAmnAtom made from equal strings, in any session
+// and on any thread, holds the same number, so atoms compare and hash as
+// integers. The strings themselves live in a process-wide pool, once each.
+//
+// Atoms are counted references: a string leaves the pool with the last atom
+// holding it, and its number may then be handed to another string. So
+// usernames and room names can be atoms as long as whatever they name holds
+// one; the pool grows with what the process keeps, not with what it has seen.
+class MNLIBSHARED_EXPORT dAmnAtom
+{
+    quint32 _id;    // 0 for the null atom
+
+    void release();
+
+public:
+    dAmnAtom() : _id(0) {}
+    explicit dAmnAtom(const QString& string);
+    dAmnAtom(const dAmnAtom& other);
+    ~dAmnAtom();
+
+    dAmnAtom& operator =(const dAmnAtom& rhs);
+
+    // The atom for a string that is in the pool already, or a null one.
+    static dAmnAtom find(const QString& string);
+    // The pooled copy of a string, which stays in the pool for good. Only
+    // for the small, closed sets that keep coming back: packet commands,
+    // argument names, properties and error codes.
+    static QString intern(const QString& string);
+    // The pooled copy of a string if some atom holds it, or else the string
+    // itself; for names, so a parsed "u=" shares the allocation of the user
+    // it names without keeping a name nobody holds around.
+    static QString share(const QString& string);
+    static int count();
+
+    quint32 id() const { return this->_id; }
+    bool isNull() const { return this->_id == 0; }
+    const QString& toString() const;
+
+    bool operator ==(const dAmnAtom& rhs) const { return this->_id == rhs._id; }
+    bool operator !=(const dAmnAtom& rhs) const { return this->_id != rhs._id; }
+    bool operator <(const dAmnAtom& rhs) const { return this->_id < rhs._id; }   // not alphabetical
+};
+Q_DECLARE_TYPEINFO(dAmnAtom, Q_MOVABLE_TYPE);
+
+inline uint qHash(const dAmnAtom& atom)
+{
+    return atom.id();
+}
+
+#endif // DAMNATOM_H
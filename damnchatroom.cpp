@@ -24,16 +24,35 @@
 #include "damnrichtext.h"
 #include "damnpacket.h"
 #include "damnuser.h"
+#include "damnname.h"
+#include "damnatom.h"
+#include "damnroomhistory.h"
+#include "damnsnapshot.h"
 #include "events.h"
 
 #include <QString>
 #include <QStringList>
 #include <QHash>
-#include <QRegExp>
+#include <QVector>
+#include <QTimer>
 #include <algorithm>
 
+namespace
+{
+    inline bool userBefore(const dAmnMembership& member, quint32 userid)
+    {
+        return member.user < userid;
+    }
+
+    inline bool membershipLess(const dAmnMembership& left, const dAmnMembership& right)
+    {
+        return left.user < right.user;
+    }
+}
+
 dAmnChatroom::dAmnChatroom(dAmnSession* parent, const QString& roomstring)
-    : dAmnObject(parent)
+    : dAmnObject(parent), _history(NULL), _coalesce(-1), _coalesceTimer(NULL),
+      _tracking(fullMembers), _headcount(0), _snapshotStale(true), _membersStale(true)
 {
     if(roomstring.startsWith('#'))
     {
@@ -72,16 +91,34 @@ dAmnChatroom::dAmnChatroom(dAmnSession* parent, const QString& roomstring)
         }
     }
 
+    if(parent)
+        this->_key = parent->_roomKeys.key(this->id());
+
+    this->_name = dAmnAtom::share(this->_name);     // the key's, if it's spelled the same
     this->setObjectName(this->_name);
 }
 
 dAmnChatroom::dAmnChatroom(dAmnSession* parent, const dAmnChatroomIdentifier& id)
     : dAmnObject(parent),
-      _type(id.type), _name(id.name)
+      _type(id.type), _name(id.name), _history(NULL), _coalesce(-1), _coalesceTimer(NULL),
+      _tracking(fullMembers), _headcount(0), _snapshotStale(true), _membersStale(true)
 {
+    if(parent)
+        this->_key = parent->_roomKeys.key(id);
+
+    this->_name = dAmnAtom::share(this->_name);
     this->setObjectName(this->_name);
 }
 
+dAmnChatroom::~dAmnChatroom()
+{
+    dAmnSession* session = this->session();
+    foreach(const dAmnMembership& member, this->_members)
+        session->releaseUser(session->user(member.user));
+
+    delete this->_history;
+}
+
 dAmnChatroom::Type dAmnChatroom::type() const
 {
     return this->_type;
@@ -115,102 +152,415 @@ dAmnChatroomIdentifier dAmnChatroom::id() const
     return dAmnChatroomIdentifier(this->session(), this->_type, this->_name);
 }
 
-void dAmnChatroom::updateTopic(const QString& newtopic)
+const dAmnRoomKey& dAmnChatroom::key() const
 {
-    this->_topic = dAmnRichText(newtopic);
-    MNLIB_DEBUG("Topic updated for %s: %s", qPrintable(this->id().toIdString()), qPrintable(this->_topic.toPlain()));
+    return this->_key;
 }
-void dAmnChatroom::updateTitle(const QString& newtitle)
+
+int dAmnChatroom::memberCount() const
 {
-    this->_title = dAmnRichText(newtitle);
-    MNLIB_DEBUG("Title updated for %s: %s", qPrintable(this->id().toIdString()), qPrintable(this->_title.toPlain()));
+    return this->_tracking == fullMembers ? this->_members.size() : this->_headcount;
+}
+bool dAmnChatroom::hasMember(quint32 userid) const
+{
+    auto it = std::lower_bound(this->_members.constBegin(), this->_members.constEnd(),
+                               userid, userBefore);
+    return it != this->_members.constEnd() && it->user == userid;
 }
+bool dAmnChatroom::hasMember(const QString& name) const
+{
+    return this->hasMember(this->session()->userId(name));
+}
+QList<dAmnUser*> dAmnChatroom::members() const
+{
+    QList<dAmnUser*> users;
+    users.reserve(this->_members.size());
 
-void dAmnChatroom::addPrivclass(dAmnPrivClass* pc)
+    dAmnSession* session = this->session();
+    foreach(const dAmnMembership& member, this->_members)
+        users.append(session->user(member.user));
+
+    return users;
+}
+QList<dAmnUser*> dAmnChatroom::members(const dAmnPrivClass* pc) const
 {
-    this->_privclasses[pc->name()] = pc;
+    QList<dAmnUser*> users;
+    if(pc->chatroom() != this)
+        return users;
+
+    users.reserve(pc->userCount());
+
+    dAmnSession* session = this->session();
+    foreach(const dAmnMembership& member, this->_members)
+        if(this->_pcslots.at(member.slot) == pc)
+            users.append(session->user(member.user));
+
+    return users;
 }
-void dAmnChatroom::removePrivclass(const QString& name)
+const QVector<dAmnMembership>& dAmnChatroom::memberships() const
 {
-    dAmnPrivClass* pc = this->_privclasses.value(name);
-    delete pc;
+    return this->_members;
+}
+dAmnPrivClass* dAmnChatroom::privclassOf(quint32 userid) const
+{
+    auto it = std::lower_bound(this->_members.constBegin(), this->_members.constEnd(),
+                               userid, userBefore);
+    if(it == this->_members.constEnd() || it->user != userid)
+        return NULL;
 
-    this->_privclasses.remove(name);
+    return this->_pcslots.at(it->slot);
+}
+dAmnPrivClass* dAmnChatroom::privclassOf(const QString& name) const
+{
+    return this->privclassOf(this->session()->userId(name));
 }
+// Cheap enough to ask on every message: a binary search in the member list
+// and a bit test in the privilege table of its slot.
+bool dAmnChatroom::can(quint32 userid, dAmnPrivClass::KnownPrivs priv) const
+{
+    auto it = std::lower_bound(this->_members.constBegin(), this->_members.constEnd(),
+                               userid, userBefore);
+    if(it == this->_members.constEnd() || it->user != userid)
+        return false;
 
-void dAmnChatroom::updatePrivclasses(const QString& data)
+    return priv != dAmnPrivClass::unknown && priv != dAmnPrivClass::order
+            && (this->_slotprivs.at(it->slot) & (1 << priv));
+}
+bool dAmnChatroom::can(const QString& name, dAmnPrivClass::KnownPrivs priv) const
 {
-    this->_privclasses.clear();
+    return this->can(this->session()->userId(name), priv);
+}
+QList<dAmnUser*> dAmnChatroom::complete(const QString& prefix, int max) const
+{   // Names sharing a prefix sit next to each other in _byname, starting at
+    // the first name that doesn't sort before the prefix itself.
+    QList<dAmnUser*> matches;
+    dAmnSession* session = this->session();
 
-    QString pclasses = data;
-    QTextStream parser (&pclasses);
+    auto it = std::lower_bound(this->_byname.constBegin(), this->_byname.constEnd(), prefix,
+                               [session](quint32 userid, const QString& key)
+                               { return dAmnName::compare(session->user(userid)->name(), key) < 0; });
 
-    while(!parser.atEnd())
+    for(; it != this->_byname.constEnd() && matches.size() != max; ++it)
     {
-        bool ok;
+        dAmnUser* user = session->user(*it);
+        if(!user->name().startsWith(prefix, Qt::CaseInsensitive))
+            break;
 
-        QString line = parser.readLine();
+        matches.append(user);
+    }
 
-        QStringList split = line.split(':');
-        if(split.size() < 2)
+    return matches;
+}
+
+dAmnRoomHistory* dAmnChatroom::history() const
+{
+    return this->_history;
+}
+
+// Keeps the last maxlines messages and actions, as long as their text fits in
+// maxbytes. Either limit at 0 turns history off and drops what was kept.
+void dAmnChatroom::setHistoryLimits(int maxlines, int maxbytes)
+{
+    if(maxlines <= 0 || maxbytes <= 0)
+    {
+        delete this->_history;
+        this->_history = NULL;
+    }
+    else if(this->_history)
+        this->_history->setLimits(maxlines, maxbytes);
+    else
+        this->_history = new dAmnRoomHistory(maxlines, maxbytes);
+}
+
+int dAmnChatroom::coalescingWindow() const
+{
+    return this->_coalesce;
+}
+
+// Gathers joins, parts, kicks and privchgs over msecs and reports them in one
+// membershipChanged() diff; 0 waits for the event loop to come around, -1
+// turns it off. The per-event signals are emitted as before either way.
+void dAmnChatroom::setCoalescingWindow(int msecs)
+{
+    if(msecs < 0)
+    {
+        this->flushChanges();
+        delete this->_coalesceTimer;
+        this->_coalesceTimer = NULL;
+        this->_coalesce = -1;
+        return;
+    }
+
+    if(!this->_coalesceTimer)
+    {
+        this->_coalesceTimer = new QTimer(this);
+        this->_coalesceTimer->setSingleShot(true);
+        connect(this->_coalesceTimer, SIGNAL(timeout()), this, SLOT(flushChanges()));
+    }
+
+    this->_coalesce = msecs;
+    this->_coalesceTimer->setInterval(msecs);
+}
+
+// The room as of now, built again only after it changed, and then with the
+// member table of the last one if nobody joined, left or moved since. Call
+// this from the session's thread; other threads read dAmnSession::snapshot()
+// instead.
+std::shared_ptr<const dAmnRoomSnapshot> dAmnChatroom::snapshot() const
+{
+    if(this->_snapshotStale)
+    {
+        this->_snapshot = dAmnRoomSnapshot::capture(this, this->_membersStale ? NULL : this->_snapshot.get());
+        this->_snapshotStale = this->_membersStale = false;
+    }
+
+    return this->_snapshot;
+}
+
+dAmnChatroom::MemberTracking dAmnChatroom::memberTracking() const
+{
+    return this->_tracking;
+}
+
+// Below fullMembers the room holds no memberships, so members(), privclassOf()
+// and can() come up empty and privclasses count nobody; memberCounts still
+// keeps memberCount() right. Going back up fetches the members property again.
+void dAmnChatroom::setMemberTracking(MemberTracking level)
+{
+    if(level == this->_tracking)
+        return;
+
+    const MemberTracking old = this->_tracking;
+    this->_tracking = level;
+    this->touch();
+
+    if(dAmnSession* session = this->session())
+        session->_core.setTracking(this->_key.idString(), level == fullMembers);
+
+    if(old == fullMembers)
+        this->dropMembers();
+    else
+        this->_headcount = 0;
+
+    if(level < old && this->session()->state() == dAmnSession::online)
+        this->getRoomProperty("members");   // we know less than we now need
+}
+
+void dAmnChatroom::flushChanges()
+{
+    if(this->_coalesceTimer)
+        this->_coalesceTimer->stop();
+    if(this->_pendingOrder.isEmpty())
+        return;
+
+    dAmnMembershipDiff diff;
+    foreach(const dAmnName& key, this->_pendingOrder)
+    {
+        const PendingChange& change = this->_pending[key];
+
+        if(change.before == change.after)
+            continue;   // joined and left again, or changed back
+        else if(change.before.isEmpty())
+            diff.added.append(change.name);
+        else if(change.after.isEmpty())
+            diff.removed.append(change.name);
+        else
         {
-            MNLIB_WARN("Invalid privclass property \"%s\" ignored.",
-                       qPrintable(line));
-            continue;
+            dAmnMembershipDiff::Move move;
+            move.user = change.name;
+            move.from = change.before;
+            move.to = change.after;
+            diff.moved.append(move);
         }
+    }
+
+    this->_pending.clear();
+    this->_pendingOrder.clear();
+
+    if(!diff.isEmpty())
+        emit membershipChanged(diff);
+}
+
+void dAmnChatroom::updateTopic(const QString& newtopic)
+{
+    this->touch(false);
+    this->_topic = dAmnRichText(newtopic);
+    MNLIB_DEBUG("Topic updated for %s: %s", qPrintable(this->_key.idString()), qPrintable(this->_topic.toPlain()));
+}
+void dAmnChatroom::updateTitle(const QString& newtitle)
+{
+    this->touch(false);
+    this->_title = dAmnRichText(newtitle);
+    MNLIB_DEBUG("Title updated for %s: %s", qPrintable(this->_key.idString()), qPrintable(this->_title.toPlain()));
+}
 
-        uint idx = split[0].toUInt(&ok);
-        if(!ok)
+void dAmnChatroom::addPrivclass(dAmnPrivClass* pc)
+{
+    this->touch();
+    int slot = this->freeSlot();
+    if(slot < 0)
+    {
+        this->compactSlots();
+        slot = this->freeSlot();
+    }
+
+    if(slot < 0)
+    {
+        MNLIB_CRIT("Too many privclasses in %s. %s ignored.",
+                   qPrintable(this->_name), qPrintable(pc->name()));
+        return;
+    }
+
+    this->_pcslots[slot] = pc;
+    this->_slotprivs[slot] = pc->_privs;
+    pc->_slot = slot;
+    this->_privclasses[pc->atom()] = pc;
+}
+// Members still in the privclass have nowhere to go and leave the room;
+// their names are added to removed, if given.
+void dAmnChatroom::removePrivclass(const QString& name, QStringList* removed)
+{
+    this->touch();
+    dAmnPrivClass* pc = this->_privclasses.take(dAmnAtom::find(name));
+    if(!pc)
+        return;
+
+    if(pc->_usercount)
+        this->releaseMembers(pc, removed);
+
+    for(int slot = 0; slot < this->_pcslots.size(); ++slot)
+    {
+        if(this->_pcslots.at(slot) == pc)
         {
-            MNLIB_WARN("Could not parse privclass order: %s",
-                       qPrintable(split[0]));
-            continue;
+            this->_pcslots[slot] = NULL;
+            this->_slotprivs[slot] = 0;
+            this->_slotcounts[slot] = 0;
         }
+    }
+
+    delete pc;
+}
+
+// Brings the privclasses in line with the privclasses property, as the core
+// read it, keeping the ones that are still there along with their members.
+void dAmnChatroom::updatePrivclasses(const QList<dAmnProtocolCore::Privclass>& privclasses)
+{
+    this->touch();
+    this->flushChanges();
 
-        QString pcname = split[1];
-        if(this->_privclasses.contains(pcname))
+    dAmnMembershipDiff diff;
+    QStringList seen;
+
+    foreach(const dAmnProtocolCore::Privclass& listed, privclasses)
+    {
+        const uint idx = listed.order;
+        const QString& pcname = listed.name;
+        seen.append(pcname);
+        if(dAmnPrivClass* pc = this->_privclasses.value(dAmnAtom(pcname)))
         {
-            dAmnPrivClass* pc = this->_privclasses[pcname];
-            pc->setOrderValue(idx);
+            if(pc->orderValue() != idx)
+            {
+                pc->setOrderValue(idx);
+                diff.privclassesReordered.append(pcname);
+            }
         }
         else
         {
             this->addPrivclass(
                 new dAmnPrivClass(this, pcname, idx)
                 );
+            diff.privclassesAdded.append(pcname);
+        }
+    }
+
+    foreach(dAmnPrivClass* pc, this->_privclasses.values())
+    {
+        if(seen.contains(pc->name()))
+            continue;
+
+        // Park its members in the default privclass until the members
+        // property says where they really are.
+        dAmnPrivClass* def = pc->userCount() ? this->defaultPrivClass() : NULL;
+        if(def && def != pc)
+        {
+            dAmnSession* session = this->session();
+            foreach(const dAmnMembership& member, this->_members)
+            {
+                if(this->_pcslots.at(member.slot) != pc)
+                    continue;
+
+                dAmnMembershipDiff::Move move;
+                move.user = session->user(member.user)->name();
+                move.from = pc->name();
+                move.to = def->name();
+                diff.moved.append(move);
+            }
+
+            this->moveAll(pc, def);
         }
+
+        diff.privclassesRemoved.append(pc->name());
+        this->removePrivclass(pc->name(), &diff.removed);
     }
 
     MNLIB_DEBUG("Update: %s has %d privclasses.", qPrintable(this->name()), this->_privclasses.count());
+    if(!diff.isEmpty())
+        emit membershipChanged(diff);
 }
 
-void dAmnChatroom::processMembers(const QString& data)
+// room is what the core made of the members property, NULL if it doesn't
+// keep this room's members.
+void dAmnChatroom::processMembers(const QString& data, const dAmnProtocolCore::Room* room)
 {
-    QString members = data;
-    QTextStream reader (&members);
-    QString name, pc, props;
+    this->touch();
+    if(this->_tracking == noMembers)
+        return;
+    if(this->_tracking == memberCounts)
+    {
+        this->_headcount = countMembers(data);
+        emit membersLoaded(this->_headcount);
+        return;
+    }
 
-    while(!reader.atEnd())
+    if(!room || !room->tracking)
     {
-        QString line = reader.readLine();
+        MNLIB_WARN("Got members for %s, which the session doesn't keep.", qPrintable(this->_name));
+        return;
+    }
 
-        if(line.startsWith("member "))
-        {
-            if(!name.isEmpty())
-            {
-                this->addMember(name, pc, props);
-            }
+    this->flushChanges();
 
-            pc = props = QString();
+    dAmnMembershipDiff diff;
+    this->addMembers(*room, diff);
 
-            name = line.mid(7); // indexOf(' ') + 1
-        }
-        else if(!line.isEmpty())
-        {
-            if(line.startsWith("pc=")) pc = line.mid(3); // indexOf('=') + 1
-            else props.append(line + "\n");
-        }
+    MNLIB_DEBUG("Loaded %d members into %s: %d new, %d gone, %d moved.", room->members.size(), qPrintable(this->_name),
+                diff.added.size(), diff.removed.size(), diff.moved.size());
+    emit membersLoaded(room->members.size());
+    if(!diff.isEmpty())
+        emit membershipChanged(diff);
+}
+
+// Counts who is listed in a members property without materializing anyone;
+// users connected more than once are listed once per connection.
+int dAmnChatroom::countMembers(const QString& data)
+{
+    QVector<QStringRef> names;
+
+    int line = 0;
+    while(line < data.size())
+    {
+        int eol = data.indexOf('\n', line);
+        if(eol < 0)
+            eol = data.size();
+
+        if(eol - line > 7 && data.midRef(line, 7) == QLatin1String("member "))
+            names.append(data.midRef(line + 7, eol - line - 7));
+
+        line = eol + 1;
     }
+
+    std::sort(names.begin(), names.end());
+    return std::unique(names.begin(), names.end()) - names.begin();
 }
 
 void dAmnChatroom::part()
@@ -264,7 +614,7 @@ void dAmnChatroom::chgPrivclass(const dAmnUser &user, const QString &privclass)
 
 void dAmnChatroom::kick(const dAmnUser &user, const QString& reason)
 {
-    dAmnPacket packet (this->session(), "kick", this->id().toIdString(),
+    dAmnPacket packet (this->session(), "kick", this->_key.idString(),
                        reason);
     packet.args().insert("u", user.name());
     this->session()->send(packet);
@@ -283,14 +633,11 @@ void dAmnChatroom::unban(const dAmnUser &user)
 
 void dAmnChatroom::getRoomProperty(const QString& property)
 {
-    dAmnPacket packet (this->session(), "get", this->id().toIdString());
-    packet.args().insert("p", property);
-
-    this->session()->send(packet);
+    this->session()->getProperty(this->id(), property);
 }
 void dAmnChatroom::setRoomProperty(const QString& property, const QString& value)
 {
-    dAmnPacket packet (this->session(), "set", this->id().toIdString(), value);
+    dAmnPacket packet (this->session(), "set", this->_key.idString(), value);
     packet.args().insert("p", property);
 
     this->session()->send(packet);
@@ -302,9 +649,20 @@ void dAmnChatroom::sendAdminCommand(const QString& command)
     this->send(packet);
 }
 
+// Marks the snapshot out of date and has the session publish a new one. Pass
+// false when no membership changed, nor the set of privclasses, so the next
+// snapshot can keep the member table.
+void dAmnChatroom::touch(bool members)
+{
+    this->_snapshotStale = true;
+    this->_membersStale = this->_membersStale || members;
+    if(this->session())
+        this->session()->snapshotLater();
+}
+
 void dAmnChatroom::send(const dAmnPacket& packet)
 {
-    dAmnPacket sendpacket (this->session(), "send", this->id().toIdString(),
+    dAmnPacket sendpacket (this->session(), "send", this->_key.idString(),
                            packet.toByteArray());
 
     this->session()->send(sendpacket);
@@ -319,78 +677,401 @@ void dAmnChatroom::addMember(const QString& name,
                              const QString& gpc)
 {
     dAmnUser* user = session()->addUser(name, usericon, symbol, realname, type_name, gpc);
+    this->setMember(user, this->privclassForMember(name, dAmnAtom(pcname)));
+}
 
-    dAmnPrivClass* pc = this->_privclasses.value(pcname);
-    if (!pc)
+void dAmnChatroom::addMember(const QString& name, const QString& pcname, const dAmnProtocolCore::User& member)
+{
+    this->addMember(name, pcname, member.usericon, member.symbol,
+                    member.realname, member.type_name, member.gpc);
+}
+
+void dAmnChatroom::addMembers(const dAmnProtocolCore::Room& room, dAmnMembershipDiff& diff)
+{
+    dAmnSession* session = this->session();
+    const dAmnProtocolCore& core = session->core();
+    session->reserveUsers(room.members.size());
+
+    QVector<dAmnMembership> incoming;
+    incoming.reserve(room.members.size());
+
+    dAmnPrivClass* pc = NULL;
+
+    for(QHash<dAmnName, QString>::const_iterator it = room.members.constBegin(); it != room.members.constEnd(); ++it)
     {
-        MNLIB_WARN("Chatroom %s member %s belonging to unknown privclass %s",
-                   qPrintable(this->_name), qPrintable(user->name()), qPrintable(pcname));
-        pc = new dAmnPrivClass(this, pcname, 0);
-        this->addPrivclass(pc);
+        const dAmnProtocolCore::User* member = core.user(it.key());
+        if(!member)
+            continue;   // the core keeps everyone in its rooms
+
+        if(!pc || pc->name() != it.value())
+            pc = this->privclassForMember(member->name, dAmnAtom(it.value()));
+
+        dAmnUser* user = session->addUser(member->name, member->usericon, member->symbol,
+                                          member->realname, member->type_name, member->gpc);
+
+        dAmnMembership membership;
+        membership.user = user->id();
+        membership.slot = this->slotFor(pc);
+        incoming.append(membership);
     }
 
-    pc->addUser(user);
-    this->_membersToPc.insert(name, pc);
+    this->reconcileMembers(incoming, diff);
 }
 
-void dAmnChatroom::addMember(const QString& name, const QString& pcname, const QString& props)
+// The members property lists everyone, so it replaces what we had; diff
+// tells who actually came, went or changed privclass.
+void dAmnChatroom::reconcileMembers(QVector<dAmnMembership>& incoming, dAmnMembershipDiff& diff)
 {
-    dAmnUser* user = session()->addUser(name, props);
+    std::stable_sort(incoming.begin(), incoming.end(), membershipLess);
+
+    QVector<dAmnMembership> next;
+    next.reserve(incoming.size());
+    for(int i = 0; i < incoming.size(); ++i)
+        if(i + 1 == incoming.size() || incoming.at(i + 1).user != incoming.at(i).user)
+            next.append(incoming.at(i));    // listed twice; the last one counts.
+
+    dAmnSession* session = this->session();
+    auto cur = this->_members.constBegin(), curEnd = this->_members.constEnd();
+    auto in = next.constBegin(), inEnd = next.constEnd();
+    QVector<dAmnUser*> gone;
+
+    while(cur != curEnd || in != inEnd)
+    {
+        if(in == inEnd || (cur != curEnd && cur->user < in->user))
+        {
+            dAmnUser* user = session->user(cur->user);
+            diff.removed.append(user->name());
+            gone.append(user);
+            ++cur;
+        }
+        else if(cur == curEnd || in->user < cur->user)
+        {
+            dAmnUser* user = session->user(in->user);
+            diff.added.append(user->name());
+            session->retainUser(user);
+            ++in;
+        }
+        else
+        {
+            dAmnPrivClass* from = this->_pcslots.at(cur->slot);
+            dAmnPrivClass* to = this->_pcslots.at(in->slot);
+            if(from != to)
+            {
+                dAmnMembershipDiff::Move move;
+                move.user = session->user(in->user)->name();
+                move.from = from->name();
+                move.to = to->name();
+                diff.moved.append(move);
+            }
+            ++cur, ++in;
+        }
+    }
+
+    this->_members.swap(next);
+    this->recountMembers();
+
+    if(!diff.added.isEmpty() || !diff.removed.isEmpty())
+        this->rebuildNameIndex();
+
+    foreach(dAmnUser* user, gone)
+        session->releaseUser(user);
+}
+
+void dAmnChatroom::recountMembers()
+{
+    foreach(dAmnPrivClass* pc, this->_pcslots)
+        if(pc) pc->_usercount = 0;
+    this->_slotcounts.fill(0);
+    foreach(const dAmnMembership& member, this->_members)
+    {
+        this->_pcslots.at(member.slot)->_usercount++;
+        this->_slotcounts[member.slot]++;
+    }
+}
 
+// Erases the memberships in pc, or all of them given NULL, and lets go of
+// their users, freeing those no other room holds. The names of the members
+// erased are added to removed, if given.
+int dAmnChatroom::releaseMembers(const dAmnPrivClass* pc, QStringList* removed)
+{
+    dAmnSession* session = this->session();
+    QVector<dAmnUser*> users;
+
+    int kept = 0;
+    for(int i = 0; i < this->_members.size(); ++i)
+    {
+        const dAmnMembership member = this->_members.at(i);
+        if(!pc || this->_pcslots.at(member.slot) == pc)
+            users.append(session->user(member.user));
+        else
+            this->_members[kept++] = member;
+    }
+
+    if(users.isEmpty())
+        return 0;
+
+    this->_members.resize(kept);
+    this->recountMembers();
+    this->rebuildNameIndex();
+
+    foreach(dAmnUser* user, users)
+    {
+        if(removed)
+            removed->append(user->name());
+        session->releaseUser(user);
+    }
+
+    return users.size();
+}
+
+// Lets go of every membership, and of the users no other room holds. What
+// stays is the head count, if the room still keeps one.
+void dAmnChatroom::dropMembers()
+{
+    this->flushChanges();
+
+    this->_headcount = this->_tracking == memberCounts ? this->_members.size() : 0;
+    const int dropped = this->releaseMembers(NULL);
+    this->_members.squeeze();
+    this->_byname.squeeze();
+
+    MNLIB_DEBUG("Dropped %d members of %s.", dropped, qPrintable(this->_name));
+}
+
+dAmnPrivClass* dAmnChatroom::privclassForMember(const QString& name, const dAmnAtom& pcname)
+{
     dAmnPrivClass* pc = this->_privclasses.value(pcname);
     if(!pc)
     {
         MNLIB_WARN("Chatroom %s member %s belonging to unknown privclass %s",
-                   qPrintable(this->_name), qPrintable(user->name()), qPrintable(pcname));
-        pc = new dAmnPrivClass(this, pcname, 0);
+                   qPrintable(this->_name), qPrintable(name), qPrintable(pcname.toString()));
+        pc = new dAmnPrivClass(this, pcname.toString(), 0);
         this->addPrivclass(pc);
     }
 
-    pc->addUser(user);
-    user->chatrooms().insert(this);
-    this->_membersToPc.insert(name, pc);
+    return pc;
+}
+
+// The membership changes the session's core found a recv made, for
+// membershipChanged(); the room itself was brought along by the notify*()
+// call before.
+void dAmnChatroom::recordChanges(const QList<dAmnProtocolCore::Change>& changes)
+{
+    if(this->_tracking != fullMembers)
+        return;
+
+    foreach(const dAmnProtocolCore::Change& change, changes)
+        this->recordChange(change.user, change.before, change.after);
+}
+
+// Only the first and last privclass of each user in a window are kept, so a
+// join and part within it cancel out.
+void dAmnChatroom::recordChange(const QString& name, const QString& before, const QString& after)
+{
+    if(this->_coalesce < 0 || before == after)
+        return;
+
+    const dAmnName key (name);
+    QHash<dAmnName, PendingChange>::iterator it = this->_pending.find(key);
+    if(it == this->_pending.end())
+    {
+        PendingChange change;
+        change.name = name;
+        change.before = before;
+        it = this->_pending.insert(key, change);
+        this->_pendingOrder.append(key);
+    }
+    it->after = after;
+
+    if(!this->_coalesceTimer->isActive())
+        this->_coalesceTimer->start();
 }
 
 void dAmnChatroom::removeMember(const QString& name)
 {
-    dAmnPrivClass* pc = this->_membersToPc.value(name);
-    if(!pc)
+    const quint32 userid = session()->userId(name);
+    auto it = std::lower_bound(this->_members.begin(), this->_members.end(),
+                               userid, userBefore);
+    if(it == this->_members.end() || it->user != userid)
     {
         MNLIB_WARN("Attempt to remove unknown member %s from chatroom %s",
-                   qPrintable(name), this->_name);
+                   qPrintable(name), qPrintable(this->_name));
         return;
     }
 
-    dAmnUser* user = session()->users().value(name);
-    if(!user)
+    this->unindexName(userid);
+    this->_pcslots.at(it->slot)->_usercount--;
+    this->_slotcounts[it->slot]--;
+    this->_members.erase(it);
+    session()->releaseUser(session()->user(userid));
+}
+
+void dAmnChatroom::setMember(dAmnUser* user, dAmnPrivClass* pc)
+{
+    const int slot = this->slotFor(pc);
+
+    auto it = std::lower_bound(this->_members.begin(), this->_members.end(),
+                               user->id(), userBefore);
+    if(it != this->_members.end() && it->user == user->id())
     {
-        MNLIB_WARN("Attempt to remove unknown member %s from chatroom %s",
-                   qPrintable(name), this->_name);
-        return;
+        this->_pcslots.at(it->slot)->_usercount--;
+        this->_slotcounts[it->slot]--;
+        it->slot = slot;
     }
-    pc->removeUser(user);
-    user->chatrooms().remove(this);
-    session()->cleanupUser(name);
+    else
+    {
+        dAmnMembership membership;
+        membership.user = user->id();
+        membership.slot = slot;
+        this->_members.insert(it, membership);
+        this->indexName(user->id());
+        this->session()->retainUser(user);
+    }
+
+    this->_slotcounts[slot]++;
+    pc->_usercount++;
+}
+
+void dAmnChatroom::indexName(quint32 userid)
+{
+    dAmnSession* session = this->session();
+    const QString& name = session->user(userid)->name();
+
+    auto it = std::lower_bound(this->_byname.begin(), this->_byname.end(), name,
+                               [session](quint32 other, const QString& name)
+                               { return dAmnName::compare(session->user(other)->name(), name) < 0; });
+    this->_byname.insert(it, userid);
+}
+
+void dAmnChatroom::unindexName(quint32 userid)
+{
+    dAmnSession* session = this->session();
+    const QString& name = session->user(userid)->name();
+
+    auto it = std::lower_bound(this->_byname.begin(), this->_byname.end(), name,
+                               [session](quint32 other, const QString& name)
+                               { return dAmnName::compare(session->user(other)->name(), name) < 0; });
+    if(it != this->_byname.end() && *it == userid)
+        this->_byname.erase(it);
+}
+
+void dAmnChatroom::rebuildNameIndex()
+{
+    dAmnSession* session = this->session();
+
+    this->_byname.resize(this->_members.size());
+    for(int i = 0; i < this->_members.size(); ++i)
+        this->_byname[i] = this->_members.at(i).user;
+
+    std::sort(this->_byname.begin(), this->_byname.end(),
+              [session](quint32 left, quint32 right)
+              { return dAmnName::compare(session->user(left)->name(), session->user(right)->name()) < 0; });
+}
+
+void dAmnChatroom::updateSlotPrivs(const dAmnPrivClass* pc)
+{
+    this->touch(false);
+    for(int slot = 0; slot < this->_pcslots.size(); ++slot)
+        if(this->_pcslots.at(slot) == pc)
+            this->_slotprivs[slot] = pc->_privs;
+}
+
+// The slot new members of pc go to. A privclass whose members were all moved
+// away gave its slot up with them and gets a fresh one here.
+int dAmnChatroom::slotFor(dAmnPrivClass* pc)
+{
+    if(this->_pcslots.value(pc->_slot) == pc)
+        return pc->_slot;
+
+    int slot = this->freeSlot();
+    if(slot < 0)
+    {   // There's always room once every privclass is down to one slot.
+        this->compactSlots();
+        slot = this->freeSlot();
+    }
+
+    Q_ASSERT(slot >= 0);
+    this->_pcslots[slot] = pc;
+    this->_slotprivs[slot] = pc->_privs;
+    pc->_slot = slot;
+    return slot;
+}
+
+int dAmnChatroom::freeSlot()
+{
+    for(int slot = 0; slot < this->_pcslots.size(); ++slot)
+    {   // Empty slots that a move handed over to another privclass are free too.
+        dAmnPrivClass* pc = this->_pcslots.at(slot);
+        if(!pc || (this->_slotcounts.at(slot) == 0 && pc->_slot != slot))
+            return slot;
+    }
+
+    if(this->_pcslots.size() >= dAmnMembership::maxSlots)
+        return -1;
+
+    this->_pcslots.append(NULL);
+    this->_slotprivs.append(0);
+    this->_slotcounts.append(0);
+    return this->_pcslots.size() - 1;
 }
 
-void dAmnChatroom::moveMember(dAmnUser* user, dAmnPrivClass* src, dAmnPrivClass* dst)
+// Gives every privclass a single slot again by pointing members back at their
+// privclass' own slot. Linear, but only needed once moves have used up all
+// the slots.
+void dAmnChatroom::compactSlots()
 {
-    src->removeUser(user);
-    dst->addUser(user);
+    for(int slot = 0; slot < this->_pcslots.size(); ++slot)
+    {
+        dAmnPrivClass* pc = this->_pcslots.at(slot);
+        if(pc && this->_pcslots.value(pc->_slot) != pc)
+            pc->_slot = slot;
+    }
+
+    for(auto it = this->_members.begin(); it != this->_members.end(); ++it)
+        it->slot = this->_pcslots.at(it->slot)->_slot;
+
+    this->_slotcounts.fill(0);
+    for(int slot = 0; slot < this->_pcslots.size(); ++slot)
+    {
+        dAmnPrivClass* pc = this->_pcslots.at(slot);
+        if(pc && pc->_slot != slot)
+        {
+            this->_pcslots[slot] = NULL;
+            this->_slotprivs[slot] = 0;
+        }
+    }
 
-    this->_membersToPc.insert(user->name(), dst);
+    foreach(const dAmnMembership& member, this->_members)
+        this->_slotcounts[member.slot]++;
+}
+
+void dAmnChatroom::renamePrivclass(dAmnPrivClass* pc, const QString& name)
+{
+    this->_privclasses.remove(pc->atom());
+    pc->setName(name);
+    pc->setObjectName(name);
+    this->_privclasses.insert(pc->atom(), pc);
 }
 
+// Hands src's slots over to dst; members stay where they are.
 uint dAmnChatroom::moveAll(dAmnPrivClass* src, dAmnPrivClass* dst)
 {
-    dAmnUser* user;
-    uint count = 0;
-    foreach(user, src->users())
+    if(src == dst)
+        return src->_usercount;
+
+    for(int slot = 0; slot < this->_pcslots.size(); ++slot)
     {
-        this->moveMember(user, src, dst);
-        count++;
+        if(this->_pcslots.at(slot) == src)
+        {
+            this->_pcslots[slot] = dst;
+            this->_slotprivs[slot] = dst->_privs;
+        }
     }
 
+    uint count = src->_usercount;
+    dst->_usercount += count;
+    src->_usercount = 0;
+
     return count;
 }
 
@@ -411,23 +1092,49 @@ dAmnPrivClass* dAmnChatroom::defaultPrivClass()
 
 void dAmnChatroom::notifyMessage(const MsgEvent& event)
 {
+    if(this->_history)
+        this->_history->append(dAmnRoomHistory::message, event.userName(),
+                               event.packet().subPacket().data().toUtf8(),
+                               QDateTime::currentMSecsSinceEpoch());
+
     emit message(event);
     emit message(event.userName(), event.message());
 }
 
 void dAmnChatroom::notifyAction(const ActionEvent& event)
 {
+    if(this->_history)
+        this->_history->append(dAmnRoomHistory::action, event.userName(),
+                               event.packet().subPacket().data().toUtf8(),
+                               QDateTime::currentMSecsSinceEpoch());
+
     emit action(event);
     emit action(event.userName(), event.action());
 }
 
+// Who joined, with what, is as the session's core read it.
 void dAmnChatroom::notifyJoin(const JoinEvent& event)
 {
-    QRegExp rx ("pc=(\\w+)");
-    (void) rx.indexIn(event.properties());
-    QString pcname = rx.cap(1);
+    this->touch();
+
+    if(this->_tracking != fullMembers)
+    {
+        if(this->_tracking == memberCounts)
+            this->_headcount++;
+
+        emit joined(event);
+        emit joined(event.userName());
+        return;
+    }
 
-    this->addMember(event.userName(), pcname, event.properties());
+    const dAmnProtocolCore& core = this->session()->core();
+    const dAmnProtocolCore::Room* room = core.room(this->_key.idString());
+    const dAmnProtocolCore::User* member = core.user(event.userName());
+    if(room && member)
+        this->addMember(event.userName(), room->members.value(dAmnName(event.userName())), *member);
+    else
+        MNLIB_WARN("Join of %s in %s, which the session doesn't keep, ignored.",
+                   qPrintable(event.userName()), qPrintable(this->_name));
 
     emit joined(event);
     emit joined(event.userName());
@@ -435,22 +1142,29 @@ void dAmnChatroom::notifyJoin(const JoinEvent& event)
 
 void dAmnChatroom::notifyPart(const PartEvent& event)
 {
-    this->removeMember(event.userName());
+    this->touch();
+    if(this->_tracking != fullMembers)
+        this->_headcount = qMax(this->_headcount - 1, 0);
+    else
+        this->removeMember(event.userName());
     emit parted(event);
     emit parted(event.userName(), event.reason());
 }
 
 void dAmnChatroom::notifyPrivchg(const PrivchgEvent& event)
 {
+    this->touch();
     QString userName = event.userName();
-    dAmnPrivClass* oldpc = this->_membersToPc.value(userName);
-    dAmnUser* user = this->session()->users().value(userName);
-    oldpc->removeUser(user);
-    this->_membersToPc.remove(userName);
+    dAmnUser* user = this->session()->user(userName);
+    dAmnPrivClass* newpc = this->_privclasses.value(dAmnAtom::find(event.privClass()));
 
-    dAmnPrivClass* newpc = this->_privclasses.value(event.privClass());
-    newpc->addUser(user);
-    this->_membersToPc.insert(userName, newpc);
+    if(this->_tracking != fullMembers)
+        qt_noop();  // nobody to move
+    else if(user && newpc)
+        this->setMember(user, newpc);
+    else
+        MNLIB_WARN("Privchg of %s to %s in %s ignored.",
+                   qPrintable(userName), qPrintable(event.privClass()), qPrintable(this->_name));
 
     emit privchg(event);
     emit privchg(userName, event.adminName(), event.privClass());
@@ -458,19 +1172,24 @@ void dAmnChatroom::notifyPrivchg(const PrivchgEvent& event)
 
 void dAmnChatroom::notifyKick(const KickEvent& event)
 {
-    this->removeMember(event.userName());
+    this->touch();
+    if(this->_tracking != fullMembers)
+        this->_headcount = qMax(this->_headcount - 1, 0);
+    else
+        this->removeMember(event.userName());
     emit kicked(event);
     emit kicked(event.userName(), event.kickerName(), event.reason());
 }
 
 void dAmnChatroom::notifyPrivUpdate(const PrivUpdateEvent& event)
 {
+    this->touch();
     dAmnPrivClass* pc;
 
     switch(event.action())
     {
     case PrivUpdateEvent::update:
-        pc = this->_privclasses.value(event.privClass());
+        pc = this->_privclasses.value(dAmnAtom::find(event.privClass()));
 
         if(pc) break;
         else
@@ -480,6 +1199,7 @@ void dAmnChatroom::notifyPrivUpdate(const PrivUpdateEvent& event)
 
     case PrivUpdateEvent::create:
         pc = new dAmnPrivClass(this, event.privClass(), 0);
+        this->addPrivclass(pc);
         break;
 
 	default:
@@ -493,35 +1213,65 @@ void dAmnChatroom::notifyPrivUpdate(const PrivUpdateEvent& event)
 
 void dAmnChatroom::notifyPrivMove(const PrivMoveEvent& event)
 {
-    dAmnPrivClass* pc = this->_privclasses.value(event.oldName());
+    this->touch();
+    dAmnPrivClass* pc = this->_privclasses.value(dAmnAtom::find(event.oldName()));
+    dAmnPrivClass* dest = this->_privclasses.value(dAmnAtom::find(event.newName()));
+
+    if(!pc)
+    {
+        MNLIB_WARN("Privmove from unknown privclass %s in #%s ignored.",
+                   qPrintable(event.oldName()), qPrintable(this->_name));
+        emit privMove(event);
+        return;
+    }
 
+    uint count = 0;
     switch(event.action())
     {
     case PrivMoveEvent::rename:
-        pc->setName(event.newName());
+        if(!dest)
+        {   // Nobody changes privclass; only its name does.
+            count = pc->userCount();
+            this->renamePrivclass(pc, event.newName());
+            break;
+        }   // renamed over an existing privclass; that's a move
 
     case PrivMoveEvent::move:
-    {
-        dAmnPrivClass* dest = this->_privclasses.value(event.newName());
-        uint count = this->moveAll(pc, dest);
-        if(count != event.usersAffected())
-            MNLIB_CRIT("Users affected mismatch while moving from privclass %s to %s.", qPrintable(pc->name()), qPrintable(dest->name()));
-    }
+        if(dest)
+            count = this->moveAll(pc, dest);
+        else
+            MNLIB_WARN("Privmove to unknown privclass %s in #%s ignored.",
+                       qPrintable(event.newName()), qPrintable(this->_name));
+        break;
+
+    default:
+    case PrivMoveEvent::unknown: qt_noop();
     }
 
+    if(this->_tracking == fullMembers && count != uint(event.usersAffected()))
+        MNLIB_CRIT("Users affected mismatch while moving from privclass %s to %s: %u here, %d told.",
+                   qPrintable(event.oldName()), qPrintable(event.newName()), count, event.usersAffected());
+
     emit privMove(event);
 }
 
 void dAmnChatroom::notifyPrivRemove(const PrivRemoveEvent& event)
 {
-    dAmnPrivClass* deleted = this->_privclasses.value(event.privClass()),
+    this->touch();
+    dAmnPrivClass* deleted = this->_privclasses.value(dAmnAtom::find(event.privClass())),
                  * def = this->defaultPrivClass();
-    // TODO: Handle def not found. Really.
-    uint count = this->moveAll(deleted, def);
-    if(count != event.usersAffected())
-        MNLIB_CRIT("Users affected mismatch while deleting privclass %s.", qPrintable(deleted->name()));
 
-    deleted->deleteLater();
+    if(deleted)
+    {   // Checked before anyone moves, from the head count alone.
+        if(this->_tracking == fullMembers && deleted->userCount() != event.usersAffected())
+            MNLIB_CRIT("Users affected mismatch while deleting privclass %s: %d here, %d told.",
+                       qPrintable(deleted->name()), deleted->userCount(), event.usersAffected());
+
+        if(def && def != deleted)
+            this->moveAll(deleted, def);
+
+        this->removePrivclass(event.privClass());
+    }
 
     emit privRemove(event);
 }
@@ -538,6 +1288,25 @@ void dAmnChatroom::notifyPrivUsers(const PrivUsersEvent& event)
 
 ////////////////////////////////////////////////////////////////////////////////
 
+bool dAmnMembershipDiff::isEmpty() const
+{
+    return this->added.isEmpty() && this->removed.isEmpty() && this->moved.isEmpty()
+            && this->privclassesAdded.isEmpty() && this->privclassesRemoved.isEmpty()
+            && this->privclassesReordered.isEmpty();
+}
+
+void dAmnMembershipDiff::clear()
+{
+    this->added.clear();
+    this->removed.clear();
+    this->moved.clear();
+    this->privclassesAdded.clear();
+    this->privclassesRemoved.clear();
+    this->privclassesReordered.clear();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
 dAmnChatroomIdentifier::dAmnChatroomIdentifier(dAmnSession* parent, const QString& roomstring)
     : _session(parent)
 {
@@ -608,7 +1377,7 @@ QString dAmnChatroomIdentifier::toIdString() const
     case dAmnChatroom::chat:    return QString("chat:").append(this->name);
     case dAmnChatroom::pchat:
         const QString& username = _session->userName();
-        if(this->name < username)
+        if(dAmnName::compare(this->name, username) < 0)
         {
             return QString("pchat:%1:%2").arg(this->name, username);
         }
@@ -24,33 +24,85 @@
 #include "damnobject.h"
 #include "evtfwd.h"
 #include "damnrichtext.h"
+#include "damnprivclass.h"
+#include "damnroomkey.h"
+#include "damnname.h"
+#include "damnprotocolcore.h"
 
 #include <QString>
+#include <QStringList>
 #include <QDateTime>
 #include <QHash>
+#include <QVector>
+#include <QList>
+#include <memory>
 
 template <typename T> class QList;
 class QByteArray;
+class QTimer;
 
 class dAmnChatroom;
 struct dAmnChatroomIdentifier;
 class dAmnSession;
-class dAmnPrivClass;
 class dAmnUser;
 class dAmnPacket;
+class dAmnRoomHistory;
+struct dAmnRoomSnapshot;
+
+// One member of a chatroom: a session user id tagged with a slot that maps to
+// its privclass in that chatroom. Chatrooms keep these sorted by user id.
+struct dAmnMembership
+{
+    static const quint32 maxUserId = 0xFFFFFF;
+    static const int maxSlots = 0x100;
+
+    quint32 user : 24;
+    quint32 slot : 8;
+};
+Q_DECLARE_TYPEINFO(dAmnMembership, Q_PRIMITIVE_TYPE);
+
+// What changed in a chatroom's member and privclass lists. Users and
+// privclasses are named rather than pointed to, since those that left may
+// already be gone.
+struct MNLIBSHARED_EXPORT dAmnMembershipDiff
+{
+    struct Move
+    {
+        QString user, from, to;
+    };
+
+    QStringList added, removed;
+    QList<Move> moved;
+
+    QStringList privclassesAdded, privclassesRemoved, privclassesReordered;
+
+    bool isEmpty() const;
+    void clear();
+};
 
 class MNLIBSHARED_EXPORT dAmnChatroom : public dAmnObject
 {
     Q_OBJECT
 
+    friend class dAmnPrivClass;
+    friend struct dAmnRoomSnapshot;
+
 public:
     enum Type
     {
         chat, pchat
     };
 
+    // How much of the member list a room keeps, most first. Rooms only watched or logged
+    // can do with a head count, or nothing at all.
+    enum MemberTracking
+    {
+        fullMembers, memberCounts, noMembers
+    };
+
     dAmnChatroom(dAmnSession* parent, const QString& roomstring);
     dAmnChatroom(dAmnSession* parent, const dAmnChatroomIdentifier& id);
+    ~dAmnChatroom();
 
     Type type() const;
     const QString& name() const;
@@ -60,16 +112,41 @@ public:
     const QDateTime& topicDate() const;
     QList<dAmnPrivClass*> privclasses() const;
     dAmnChatroomIdentifier id() const;
+    const dAmnRoomKey& key() const;
+
+    int memberCount() const;
+    bool hasMember(quint32 userid) const;
+    bool hasMember(const QString& name) const;
+    QList<dAmnUser*> members() const;
+    QList<dAmnUser*> members(const dAmnPrivClass* pc) const;
+    const QVector<dAmnMembership>& memberships() const;
+    dAmnPrivClass* privclassOf(quint32 userid) const;
+    dAmnPrivClass* privclassOf(const QString& name) const;
+    bool can(quint32 userid, dAmnPrivClass::KnownPrivs priv) const;
+    bool can(const QString& name, dAmnPrivClass::KnownPrivs priv) const;
+    QList<dAmnUser*> complete(const QString& prefix, int max = -1) const;
+
+    dAmnRoomHistory* history() const;
+    void setHistoryLimits(int maxlines, int maxbytes);
+
+    int coalescingWindow() const;
+    void setCoalescingWindow(int msecs);
+
+    MemberTracking memberTracking() const;
+    void setMemberTracking(MemberTracking level);
+
+    std::shared_ptr<const dAmnRoomSnapshot> snapshot() const;
 
     void updateTopic(const QString& newtopic);
     void updateTitle(const QString& newtitle);
 
     void addPrivclass(dAmnPrivClass* pc);
-    void removePrivclass(const QString& name);
+    void removePrivclass(const QString& name, QStringList* removed = NULL);
 
-    void updatePrivclasses(const QString& data);
+    void updatePrivclasses(const QList<dAmnProtocolCore::Privclass>& privclasses);
 
-    void processMembers(const QString& data);
+    void processMembers(const QString& data, const dAmnProtocolCore::Room* room);
+    void recordChanges(const QList<dAmnProtocolCore::Change>& changes);
 
     void part();
 
@@ -129,21 +206,72 @@ signals:
     void gotKicked(const KickedEvent& event);
     void gotKicked(const QString& by, const QString& reason);
 
+    void membersLoaded(int count);
+    void membershipChanged(const dAmnMembershipDiff& diff);
+
+private slots:
+    void flushChanges();
+
 private:
+    struct PendingChange
+    {
+        QString name, before, after;  // privclass names; empty when not a member
+    };
+
     Type _type;
     QString _name;
+    dAmnRoomKey _key;           // null without a session
     dAmnRichText _title, _topic;
     QDateTime _titledate, _topicdate;
-    QHash<QString, dAmnPrivClass*> _privclasses;
-    QHash<QString, dAmnPrivClass*> _membersToPc;
+    QHash<dAmnAtom, dAmnPrivClass*> _privclasses;
+    // Members point at slots and slots at privclasses. Moving everyone from
+    // one privclass to another hands its slots over instead of touching each
+    // member, so a privclass may own several slots.
+    QVector<dAmnPrivClass*> _pcslots;
+    QVector<quint16> _slotprivs;    // dAmnPrivClass::privs() of each slot's privclass
+    QVector<int> _slotcounts;       // members in each slot
+    QVector<dAmnMembership> _members;
+    QVector<quint32> _byname;   // member ids sorted case-insensitively by name, for completion
+    dAmnRoomHistory* _history;  // NULL unless enabled with setHistoryLimits()
+
+    int _coalesce;              // -1 unless enabled with setCoalescingWindow()
+    QTimer* _coalesceTimer;
+    QHash<dAmnName, PendingChange> _pending;
+    QList<dAmnName> _pendingOrder;
+
+    MemberTracking _tracking;
+    int _headcount;             // memberCount() unless tracking fullMembers
+
+    mutable std::shared_ptr<const dAmnRoomSnapshot> _snapshot;  // the last one built
+    mutable bool _snapshotStale, _membersStale;
 
     void send(const dAmnPacket& packet);
+    void touch(bool members = true);
 
     void addMember(const QString& name, const QString& pcname, int usericon, const QChar& symbol, const QString& realname, const QString& type_name, const QString& gpc);
-    void addMember(const QString& name, const QString& pcname, const QString& props);
+    void addMember(const QString& name, const QString& pcname, const dAmnProtocolCore::User& member);
+    void addMembers(const dAmnProtocolCore::Room& room, dAmnMembershipDiff& diff);
     void removeMember(const QString& name);
+    void setMember(dAmnUser* user, dAmnPrivClass* pc);
+    void reconcileMembers(QVector<dAmnMembership>& incoming, dAmnMembershipDiff& diff);
+    void recountMembers();
+    int releaseMembers(const dAmnPrivClass* pc, QStringList* removed = NULL);
+    void dropMembers();
+    dAmnPrivClass* privclassForMember(const QString& name, const dAmnAtom& pcname);
+    void recordChange(const QString& name, const QString& before, const QString& after);
+
+    void indexName(quint32 userid);
+    void unindexName(quint32 userid);
+    void rebuildNameIndex();
+
+    static int countMembers(const QString& data);
+
+    void updateSlotPrivs(const dAmnPrivClass* pc);
+    int slotFor(dAmnPrivClass* pc);
+    int freeSlot();
+    void compactSlots();
+    void renamePrivclass(dAmnPrivClass* pc, const QString& name);
 
-    void moveMember(dAmnUser* user, dAmnPrivClass* src, dAmnPrivClass* dst);
     uint moveAll(dAmnPrivClass* src, dAmnPrivClass* dst);
     dAmnPrivClass* defaultPrivClass();
 };
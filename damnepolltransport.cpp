@@ -0,0 +1,907 @@
+﻿/*
+    This file is part of
+    amnlib - A C++ library for deviantART Message Network
+    Copyright © 2013 Carl Tessier <http://drfrankenstein90.deviantart.com/>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "damnepolltransport.h"
+
+#include <QSocketNotifier>
+#include <QThreadStorage>
+#include <QMetaObject>
+#include <QEvent>
+#include <QVector>
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+#ifdef MNLIB_HAVE_LIBURING
+#   include <liburing.h>
+#   include <sys/eventfd.h>
+#   include <sys/uio.h>
+#   include <stdlib.h>
+#endif
+
+namespace
+{
+    const int maxEvents = 256;     // per epoll_wait() call
+
+    QThreadStorage<dAmnEpollLoop*> loops;
+    int defaultSlots = 256;
+
+    QAbstractSocket::SocketError socketError(int error)
+    {
+        switch(error)
+        {
+        case ECONNREFUSED:
+            return QAbstractSocket::ConnectionRefusedError;
+        case ECONNRESET:
+        case EPIPE:
+            return QAbstractSocket::RemoteHostClosedError;
+        case ETIMEDOUT:
+            return QAbstractSocket::SocketTimeoutError;
+        case ENETUNREACH:
+        case EHOSTUNREACH:
+        case ENETDOWN:
+            return QAbstractSocket::NetworkError;
+        case EACCES:
+        case EPERM:
+            return QAbstractSocket::SocketAccessError;
+        case EMFILE:
+        case ENFILE:
+        case ENOBUFS:
+        case ENOMEM:
+            return QAbstractSocket::SocketResourceError;
+        default:
+            return QAbstractSocket::UnknownSocketError;
+        }
+    }
+}
+
+#ifdef MNLIB_HAVE_LIBURING
+// Operations are tagged with their transport's slot, shifted left once, with
+// the low bit set for writes.
+struct dAmnEpollLoop::Ring
+{
+    static const quint64 cancelTag = ~quint64(0);
+
+    io_uring ring;
+    int eventfd;                // signalled by the kernel on completions
+    char* memory;
+    QVector<dAmnEpollTransport*> owners;    // by slot
+    QVector<int> freeSlots;
+    int unsubmitted;
+
+    char* buffer(int index) { return this->memory + index * dAmnEpollLoop::bufferSize; }
+};
+#else
+struct dAmnEpollLoop::Ring
+{
+};
+#endif
+
+dAmnEpollLoop::dAmnEpollLoop(int ringSlots, QObject* parent)
+    : QObject(parent), _epoll(-1), _notifier(NULL), _ring(NULL), _passQueued(false)
+{
+    this->_epoll = epoll_create1(EPOLL_CLOEXEC);
+    if(this->_epoll < 0)
+    {
+        MNLIB_CRIT("epoll_create1 failed: %s", strerror(errno));
+        return;
+    }
+
+    this->_notifier = new QSocketNotifier(this->_epoll, QSocketNotifier::Read, this);
+    connect(this->_notifier, SIGNAL(activated(int)), this, SLOT(processEvents()));
+
+#ifdef MNLIB_HAVE_LIBURING
+    if(ringSlots <= 0)
+        return;
+
+    Ring* ring = new Ring;
+    ring->eventfd = -1;
+    ring->memory = NULL;
+    ring->unsubmitted = 0;
+
+    int result = io_uring_queue_init(ringSlots * 2 + 16, &ring->ring, 0);
+    if(result < 0)
+    {
+        MNLIB_WARN("io_uring unavailable, staying on epoll: %s", strerror(-result));
+        delete ring;
+        return;
+    }
+
+    const int buffers = ringSlots * 2;
+    QVector<iovec> iov (buffers);
+    if(posix_memalign(reinterpret_cast<void**>(&ring->memory), 4096, size_t(buffers) * bufferSize) != 0)
+        ring->memory = NULL;
+    else
+    {
+        for(int i = 0; i < buffers; i++)
+        {
+            iov[i].iov_base = ring->buffer(i);
+            iov[i].iov_len = bufferSize;
+        }
+        result = io_uring_register_buffers(&ring->ring, iov.constData(), buffers);
+    }
+
+    if(!ring->memory || result < 0)
+    {
+        // Registered buffers are locked in memory, which RLIMIT_MEMLOCK may not allow.
+        MNLIB_WARN("Could not register %d io_uring buffers, staying on epoll: %s",
+                   buffers, strerror(ring->memory ? -result : ENOMEM));
+        io_uring_queue_exit(&ring->ring);
+        free(ring->memory);
+        delete ring;
+        return;
+    }
+
+    ring->eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    epoll_event ev;
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = NULL;         // the ring, not a transport
+    if(ring->eventfd < 0
+       || io_uring_register_eventfd(&ring->ring, ring->eventfd) < 0
+       || epoll_ctl(this->_epoll, EPOLL_CTL_ADD, ring->eventfd, &ev) < 0)
+    {
+        MNLIB_WARN("Could not watch io_uring completions, staying on epoll.");
+        if(ring->eventfd >= 0)
+            ::close(ring->eventfd);
+        io_uring_queue_exit(&ring->ring);
+        free(ring->memory);
+        delete ring;
+        return;
+    }
+
+    ring->owners.fill(NULL, ringSlots);
+    ring->freeSlots.reserve(ringSlots);
+    for(int i = ringSlots - 1; i >= 0; i--)
+        ring->freeSlots.append(i);
+
+    this->_ring = ring;
+#else
+    Q_UNUSED(ringSlots);
+#endif
+}
+
+dAmnEpollLoop::~dAmnEpollLoop()
+{
+    foreach(dAmnEpollTransport* transport, this->_attached)
+    {
+        this->remove(transport);
+        transport->_loop = NULL;
+    }
+
+#ifdef MNLIB_HAVE_LIBURING
+    if(this->_ring)
+    {
+        io_uring_queue_exit(&this->_ring->ring);
+        ::close(this->_ring->eventfd);
+        free(this->_ring->memory);
+    }
+#endif
+    delete this->_ring;
+
+    delete this->_notifier;
+    if(this->_epoll >= 0)
+        ::close(this->_epoll);
+}
+
+dAmnEpollLoop* dAmnEpollLoop::instance()
+{
+    if(!loops.hasLocalData())
+        loops.setLocalData(new dAmnEpollLoop(defaultSlots));
+    return loops.localData();
+}
+
+int dAmnEpollLoop::defaultRingSlots()
+{
+    return defaultSlots;
+}
+
+void dAmnEpollLoop::setDefaultRingSlots(int count)
+{
+    defaultSlots = count;
+}
+
+bool dAmnEpollLoop::usesRing() const
+{
+    return this->_ring != NULL;
+}
+
+int dAmnEpollLoop::transportCount() const
+{
+    return this->_attached.size();
+}
+
+void dAmnEpollLoop::add(dAmnEpollTransport* transport)
+{
+    this->_attached.insert(transport);
+
+    // Open connections that get buffers of their own skip epoll altogether;
+    // everything else waits there, for the connection to be made if nothing else.
+    if(transport->_open && this->acquireSlot(transport))
+    {
+        this->submitRead(transport);
+        if(!transport->_out.isEmpty())
+            this->markDirty(transport);
+        return;
+    }
+
+    epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = transport;
+    if(epoll_ctl(this->_epoll, EPOLL_CTL_ADD, transport->_fd, &ev) < 0)
+    {
+        transport->_errno = errno;
+        this->markReady(transport, dAmnEpollTransport::gotError);
+    }
+}
+
+void dAmnEpollLoop::remove(dAmnEpollTransport* transport)
+{
+    if(!this->_attached.remove(transport))
+        return;
+
+    if(transport->_slot >= 0)
+        this->releaseSlot(transport);
+    else
+        epoll_ctl(this->_epoll, EPOLL_CTL_DEL, transport->_fd, NULL);
+
+    for(int i = this->_ready.size() - 1; i >= 0; i--)
+        if(this->_ready.at(i) == transport)
+            this->_ready.removeAt(i);
+    for(int i = this->_dirty.size() - 1; i >= 0; i--)
+        if(this->_dirty.at(i) == transport)
+            this->_dirty.removeAt(i);
+    transport->_queued = false;
+}
+
+// The connection was made: hand it to the ring if there's room.
+void dAmnEpollLoop::established(dAmnEpollTransport* transport)
+{
+    transport->_open = true;
+    this->markReady(transport, dAmnEpollTransport::gotConnected);
+
+    if(this->acquireSlot(transport))
+    {
+        epoll_ctl(this->_epoll, EPOLL_CTL_DEL, transport->_fd, NULL);
+        this->submitRead(transport);
+    }
+
+    if(!transport->_out.isEmpty())
+        this->markDirty(transport);
+}
+
+void dAmnEpollLoop::markReady(dAmnEpollTransport* transport, int flags)
+{
+    transport->_notify |= flags;
+    if(!transport->_queued)
+    {
+        transport->_queued = true;
+        this->_ready.append(transport);
+    }
+    this->queuePass();
+}
+
+void dAmnEpollLoop::markDirty(dAmnEpollTransport* transport)
+{
+    if(!this->_dirty.contains(transport))
+        this->_dirty.append(transport);
+    this->queuePass();
+}
+
+void dAmnEpollLoop::queuePass()
+{
+    if(this->_passQueued)
+        return;
+
+    this->_passQueued = true;
+    QMetaObject::invokeMethod(this, "processEvents", Qt::QueuedConnection);
+}
+
+// Nothing here emits anything until every transport has had its I/O done, so
+// no one can delete a transport from under us halfway through.
+void dAmnEpollLoop::processEvents()
+{
+    this->_passQueued = false;
+
+    epoll_event events[maxEvents];
+    int count;
+    do
+    {
+        count = epoll_wait(this->_epoll, events, maxEvents, 0);
+        for(int i = 0; i < count; i++)
+        {
+            if(events[i].data.ptr)
+                this->handleEvent(static_cast<dAmnEpollTransport*>(events[i].data.ptr), events[i].events);
+            else
+                this->reap();
+        }
+    }
+    while(count == maxEvents);
+
+    QList<QPointer<dAmnEpollTransport> > dirty;
+    dirty.swap(this->_dirty);
+    foreach(const QPointer<dAmnEpollTransport>& transport, dirty)
+    {
+        if(!transport)
+            continue;
+        if(transport->_slot >= 0)
+            this->submitWrite(transport);
+        else if(transport->_open)
+            this->sendPending(transport);
+    }
+    this->submit();
+
+    QList<QPointer<dAmnEpollTransport> > ready;
+    ready.swap(this->_ready);
+    foreach(const QPointer<dAmnEpollTransport>& transport, ready)
+        if(transport && transport->_loop == this)
+            transport->deliver();
+}
+
+void dAmnEpollLoop::handleEvent(dAmnEpollTransport* transport, quint32 events)
+{
+    if(!this->_attached.contains(transport))
+        return;
+
+    if(!transport->_open)
+    {
+        if(!(events & (EPOLLOUT | EPOLLERR | EPOLLHUP)))
+            return;
+
+        int error = 0;
+        socklen_t length = sizeof(error);
+        if(getsockopt(transport->_fd, SOL_SOCKET, SO_ERROR, &error, &length) < 0)
+            error = errno;
+
+        if(error)
+        {
+            transport->_errno = error;
+            this->markReady(transport, dAmnEpollTransport::gotError);
+            return;
+        }
+
+        this->established(transport);
+        if(transport->_slot >= 0)
+            return;
+    }
+
+    if(events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+        this->receive(transport);
+    if(events & EPOLLOUT)
+        this->sendPending(transport);
+}
+
+// Edge-triggered: read until the kernel has nothing more for us.
+void dAmnEpollLoop::receive(dAmnEpollTransport* transport)
+{
+    QByteArray& in = transport->_in;
+    int flags = 0;
+
+    forever
+    {
+        const int size = in.size();
+        in.resize(size + bufferSize);
+        const ssize_t read = ::recv(transport->_fd, in.data() + size, bufferSize, 0);
+        in.resize(size + qMax<ssize_t>(read, 0));
+
+        if(read > 0)
+            flags |= dAmnEpollTransport::gotData;
+        else if(read == 0)
+        {
+            flags |= dAmnEpollTransport::gotClosed;
+            break;
+        }
+        else if(errno == EINTR)
+            continue;
+        else
+        {
+            if(errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                transport->_errno = errno;
+                flags |= dAmnEpollTransport::gotError;
+            }
+            break;
+        }
+    }
+
+    if(flags)
+        this->markReady(transport, flags);
+}
+
+void dAmnEpollLoop::sendPending(dAmnEpollTransport* transport)
+{
+    QByteArray& out = transport->_out;
+    int sent = 0;
+
+    while(sent < out.size())
+    {
+        const ssize_t written = ::send(transport->_fd, out.constData() + sent, out.size() - sent, MSG_NOSIGNAL);
+        if(written >= 0)
+            sent += written;
+        else if(errno == EINTR)
+            continue;
+        else
+        {
+            // On EAGAIN the rest waits for EPOLLOUT.
+            if(errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                transport->_errno = errno;
+                this->markReady(transport, dAmnEpollTransport::gotError);
+            }
+            break;
+        }
+    }
+
+    out.remove(0, sent);
+    if(out.isEmpty() && transport->_closeWhenWritten)
+        this->markReady(transport, dAmnEpollTransport::gotClosed);
+}
+
+#ifdef MNLIB_HAVE_LIBURING
+
+bool dAmnEpollLoop::acquireSlot(dAmnEpollTransport* transport)
+{
+    if(!this->_ring || this->_ring->freeSlots.isEmpty())
+        return false;
+
+    transport->_slot = this->_ring->freeSlots.takeLast();
+    this->_ring->owners[transport->_slot] = transport;
+    return true;
+}
+
+// Cancels the transport's reads and writes and waits for them to finish
+// before its buffers go to someone else. Whatever they got done is kept.
+void dAmnEpollLoop::releaseSlot(dAmnEpollTransport* transport)
+{
+    Ring* ring = this->_ring;
+    transport->_detaching = true;
+
+    for(int write = 0; write < 2; write++)
+    {
+        if(!(write ? transport->_writing : transport->_reading))
+            continue;
+
+        io_uring_sqe* sqe = io_uring_get_sqe(&ring->ring);
+        if(!sqe)
+        {
+            this->submit();
+            sqe = io_uring_get_sqe(&ring->ring);
+        }
+        io_uring_prep_cancel(sqe, reinterpret_cast<void*>((quintptr(transport->_slot) << 1) | write), 0);
+        io_uring_sqe_set_data(sqe, reinterpret_cast<void*>(quintptr(Ring::cancelTag)));
+        ring->unsubmitted++;
+    }
+    this->submit();
+
+    while(transport->_reading || transport->_writing)
+        this->reap(true);
+
+    ring->owners[transport->_slot] = NULL;
+    ring->freeSlots.append(transport->_slot);
+    transport->_slot = -1;
+    transport->_detaching = false;
+
+    // Others may have completed while we waited.
+    this->queuePass();
+}
+
+void dAmnEpollLoop::submitRead(dAmnEpollTransport* transport)
+{
+    Ring* ring = this->_ring;
+    io_uring_sqe* sqe = io_uring_get_sqe(&ring->ring);
+    if(!sqe)
+    {
+        this->submit();
+        sqe = io_uring_get_sqe(&ring->ring);
+    }
+
+    const int index = transport->_slot * 2;
+    io_uring_prep_read_fixed(sqe, transport->_fd, ring->buffer(index), bufferSize, 0, index);
+    io_uring_sqe_set_data(sqe, reinterpret_cast<void*>(quintptr(transport->_slot) << 1));
+    ring->unsubmitted++;
+    transport->_reading = true;
+}
+
+void dAmnEpollLoop::submitWrite(dAmnEpollTransport* transport)
+{
+    if(transport->_writing || transport->_out.isEmpty())
+        return;
+
+    Ring* ring = this->_ring;
+    io_uring_sqe* sqe = io_uring_get_sqe(&ring->ring);
+    if(!sqe)
+    {
+        this->submit();
+        sqe = io_uring_get_sqe(&ring->ring);
+    }
+
+    const int index = transport->_slot * 2 + 1;
+    const int length = qMin(transport->_out.size(), int(bufferSize));
+    memcpy(ring->buffer(index), transport->_out.constData(), length);
+    io_uring_prep_write_fixed(sqe, transport->_fd, ring->buffer(index), length, 0, index);
+    io_uring_sqe_set_data(sqe, reinterpret_cast<void*>((quintptr(transport->_slot) << 1) | 1));
+    ring->unsubmitted++;
+    transport->_writing = true;
+}
+
+void dAmnEpollLoop::submit()
+{
+    if(!this->_ring || !this->_ring->unsubmitted)
+        return;
+
+    io_uring_submit(&this->_ring->ring);
+    this->_ring->unsubmitted = 0;
+}
+
+void dAmnEpollLoop::reap(bool wait)
+{
+    Ring* ring = this->_ring;
+    if(!ring)
+        return;
+
+    if(!wait)
+    {
+        eventfd_t value;
+        eventfd_read(ring->eventfd, &value);
+    }
+
+    io_uring_cqe* cqe;
+    if(wait && io_uring_wait_cqe(&ring->ring, &cqe) == 0)
+    {
+        const quint64 tag = quintptr(io_uring_cqe_get_data(cqe));
+        const int result = cqe->res;
+        io_uring_cqe_seen(&ring->ring, cqe);
+        this->complete(tag, result);
+    }
+
+    while(io_uring_peek_cqe(&ring->ring, &cqe) == 0)
+    {
+        const quint64 tag = quintptr(io_uring_cqe_get_data(cqe));
+        const int result = cqe->res;
+        io_uring_cqe_seen(&ring->ring, cqe);
+        this->complete(tag, result);
+    }
+
+    this->submit();
+}
+
+void dAmnEpollLoop::complete(quint64 tag, int result)
+{
+    if(tag == Ring::cancelTag)
+        return;
+
+    Ring* ring = this->_ring;
+    const int slot = int(tag >> 1);
+    dAmnEpollTransport* transport = ring->owners.value(slot);
+    if(!transport)
+        return;
+
+    if(tag & 1)
+    {
+        transport->_writing = false;
+        if(result > 0)
+        {
+            transport->_out.remove(0, result);
+            if(transport->_out.isEmpty() && transport->_closeWhenWritten)
+                this->markReady(transport, dAmnEpollTransport::gotClosed);
+        }
+        else if(result < 0 && result != -EAGAIN && result != -EINTR && result != -ECANCELED)
+        {
+            transport->_errno = -result;
+            this->markReady(transport, dAmnEpollTransport::gotError);
+            return;
+        }
+
+        if(!transport->_detaching)
+            this->submitWrite(transport);
+    }
+    else
+    {
+        transport->_reading = false;
+        if(result > 0)
+        {
+            transport->_in.append(ring->buffer(slot * 2), result);
+            this->markReady(transport, dAmnEpollTransport::gotData);
+        }
+        else if(result == 0)
+        {
+            this->markReady(transport, dAmnEpollTransport::gotClosed);
+            return;
+        }
+        else if(result == -ECANCELED)
+            return;
+        else if(result != -EAGAIN && result != -EINTR)
+        {
+            transport->_errno = -result;
+            this->markReady(transport, dAmnEpollTransport::gotError);
+            return;
+        }
+
+        if(!transport->_detaching)
+            this->submitRead(transport);
+    }
+}
+
+#else
+
+bool dAmnEpollLoop::acquireSlot(dAmnEpollTransport*)
+{
+    return false;
+}
+
+void dAmnEpollLoop::releaseSlot(dAmnEpollTransport*)
+{
+}
+
+void dAmnEpollLoop::submitRead(dAmnEpollTransport*)
+{
+}
+
+void dAmnEpollLoop::submitWrite(dAmnEpollTransport*)
+{
+}
+
+void dAmnEpollLoop::submit()
+{
+}
+
+void dAmnEpollLoop::reap(bool)
+{
+}
+
+void dAmnEpollLoop::complete(quint64, int)
+{
+}
+
+#endif // MNLIB_HAVE_LIBURING
+
+dAmnEpollTransport::dAmnEpollTransport(QObject* parent)
+    : dAmnTransport(parent),
+      _loop(NULL), _fd(-1), _open(false), _port(0), _lookup(-1),
+      _closeWhenWritten(false),
+      _slot(-1), _reading(false), _writing(false), _detaching(false),
+      _notify(0), _queued(false), _errno(0), _error(QAbstractSocket::UnknownSocketError)
+{
+}
+
+dAmnEpollTransport::~dAmnEpollTransport()
+{
+    this->release();
+}
+
+void dAmnEpollTransport::connectToHost(const QString& host, quint16 port)
+{
+    if(this->state() != unconnected)
+    {
+        MNLIB_WARN("Attempted to connect an already connected transport.");
+        return;
+    }
+
+    this->_port = port;
+    this->_in.clear();
+    this->_out.clear();
+    this->_closeWhenWritten = false;
+    this->setState(connecting);
+
+    QHostAddress address;
+    if(address.setAddress(host))
+        this->open(address);
+    else
+        this->_lookup = QHostInfo::lookupHost(host, this, SLOT(hostFound(QHostInfo)));
+}
+
+void dAmnEpollTransport::hostFound(const QHostInfo& info)
+{
+    if(info.lookupId() != this->_lookup)
+        return;
+    this->_lookup = -1;
+
+    if(info.error() != QHostInfo::NoError || info.addresses().isEmpty())
+    {
+        this->_error = QAbstractSocket::HostNotFoundError;
+        this->_errorString = info.errorString();
+        emit error(this->_error);
+        this->close();
+        return;
+    }
+
+    this->open(info.addresses().first());
+}
+
+void dAmnEpollTransport::open(const QHostAddress& address)
+{
+    sockaddr_storage storage;
+    memset(&storage, 0, sizeof(storage));
+    socklen_t length;
+
+    if(address.protocol() == QAbstractSocket::IPv6Protocol)
+    {
+        sockaddr_in6* addr = reinterpret_cast<sockaddr_in6*>(&storage);
+        const Q_IPV6ADDR ip = address.toIPv6Address();
+        addr->sin6_family = AF_INET6;
+        addr->sin6_port = htons(this->_port);
+        memcpy(&addr->sin6_addr, &ip, sizeof(ip));
+        length = sizeof(sockaddr_in6);
+    }
+    else
+    {
+        sockaddr_in* addr = reinterpret_cast<sockaddr_in*>(&storage);
+        addr->sin_family = AF_INET;
+        addr->sin_port = htons(this->_port);
+        addr->sin_addr.s_addr = htonl(address.toIPv4Address());
+        length = sizeof(sockaddr_in);
+    }
+
+    this->_fd = ::socket(storage.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(this->_fd < 0)
+    {
+        this->fail(errno);
+        return;
+    }
+
+    if(!this->_loop)
+        this->_loop = dAmnEpollLoop::instance();
+    this->_loop->add(this);
+
+    if(::connect(this->_fd, reinterpret_cast<sockaddr*>(&storage), length) == 0)
+        this->_loop->established(this);
+    else if(errno != EINPROGRESS)
+        this->fail(errno);
+}
+
+void dAmnEpollTransport::disconnectFromHost()
+{
+    switch(this->state())
+    {
+    case unconnected:
+    case closing:
+        return;
+    case connecting:
+        this->close();
+        return;
+    case connected:
+        break;
+    }
+
+    if(this->_out.isEmpty() && !this->_writing)
+    {
+        this->close();
+        return;
+    }
+
+    this->_closeWhenWritten = true;
+    this->setState(closing);
+}
+
+qint64 dAmnEpollTransport::write(const QByteArray& data)
+{
+    if(this->state() != connecting && this->state() != connected)
+    {
+        MNLIB_WARN("Attempted to write to a closed transport.");
+        return -1;
+    }
+
+    this->_out.append(data);
+    // Sent once the loop comes around, along with everything else written until then.
+    if(this->_loop && this->_open)
+        this->_loop->markDirty(this);
+    return data.size();
+}
+
+QByteArray dAmnEpollTransport::readAll()
+{
+    QByteArray data;
+    data.swap(this->_in);
+    return data;
+}
+
+QString dAmnEpollTransport::errorString() const
+{
+    return this->_errorString;
+}
+
+bool dAmnEpollTransport::event(QEvent* e)
+{
+    // Sent before we move, while we still belong to the old loop's thread.
+    if(e->type() == QEvent::ThreadChange && this->_loop)
+    {
+        this->_loop->remove(this);
+        this->_loop = NULL;
+        QMetaObject::invokeMethod(this, "attach", Qt::QueuedConnection);
+    }
+
+    return dAmnTransport::event(e);
+}
+
+void dAmnEpollTransport::attach()
+{
+    if(this->_loop || this->_fd < 0)
+        return;
+
+    this->_loop = dAmnEpollLoop::instance();
+    this->_loop->add(this);
+    if(!this->_in.isEmpty())
+        this->_loop->markReady(this, gotData);
+}
+
+void dAmnEpollTransport::deliver()
+{
+    const int notify = this->_notify;
+    this->_notify = 0;
+    this->_queued = false;
+
+    QPointer<dAmnEpollTransport> guard (this);
+
+    if(notify & gotConnected)
+        this->setState(connected);
+    if(guard && (notify & gotData) && !this->_in.isEmpty())
+        emit readyRead();
+    if(!guard)
+        return;
+
+    if(notify & gotError)
+        this->fail(this->_errno);
+    else if(notify & gotClosed)
+        this->close();
+}
+
+void dAmnEpollTransport::fail(int code)
+{
+    this->_error = socketError(code);
+    this->_errorString = QString::fromLocal8Bit(strerror(code));
+
+    QPointer<dAmnEpollTransport> guard (this);
+    emit error(this->_error);
+    if(guard)
+        this->close();
+}
+
+void dAmnEpollTransport::close()
+{
+    this->release();
+    this->setState(unconnected);
+}
+
+// Everything close() does short of telling anyone. Whatever came in stays
+// readable.
+void dAmnEpollTransport::release()
+{
+    if(this->_lookup >= 0)
+    {
+        QHostInfo::abortHostLookup(this->_lookup);
+        this->_lookup = -1;
+    }
+
+    if(this->_loop)
+        this->_loop->remove(this);
+
+    if(this->_fd >= 0)
+    {
+        ::close(this->_fd);
+        this->_fd = -1;
+    }
+
+    this->_open = false;
+    this->_out.clear();
+    this->_closeWhenWritten = false;
+    this->_notify = 0;
+}
@@ -0,0 +1,158 @@
+﻿/*
+    This file is part of
+    amnlib - A C++ library for deviantART Message Network
+    Copyright © 2013 Carl Tessier <http://drfrankenstein90.deviantart.com/>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DAMNEPOLLTRANSPORT_H
+#define DAMNEPOLLTRANSPORT_H
+
+#include "mnlib_global.h"
+#include "damntransport.h"
+
+#include <QObject>
+#include <QList>
+#include <QSet>
+#include <QPointer>
+#include <QHostInfo>
+#include <QHostAddress>
+
+class QSocketNotifier;
+class dAmnEpollTransport;
+
+// Drives every dAmnEpollTransport of one thread from a single edge-triggered
+// epoll set, so the thread's event loop watches one descriptor however many
+// connections there are, and each pass over it reads everything that came in
+// before anyone is told.
+//
+// Built with MNLIB_HAVE_LIBURING, connected transports read and write through
+// io_uring instead, into buffers registered with the kernel once when the
+// loop starts. Everything written during one pass of the event loop then
+// goes out in a single submission. Transports that find no free buffers, or
+// loops whose ring can't be set up, stay on epoll.
+class MNLIBSHARED_EXPORT dAmnEpollLoop : public QObject
+{
+    Q_OBJECT
+
+    friend class dAmnEpollTransport;
+
+public:
+    static const int bufferSize = 16384;    // per registered buffer; two per transport
+
+    explicit dAmnEpollLoop(int ringSlots = 256, QObject* parent = 0);
+    ~dAmnEpollLoop();
+
+    // The current thread's loop, created with defaultRingSlots() on first use.
+    static dAmnEpollLoop* instance();
+    static int defaultRingSlots();
+    static void setDefaultRingSlots(int count);
+
+    bool usesRing() const;
+    int transportCount() const;
+
+private slots:
+    void processEvents();
+
+private:
+    struct Ring;
+
+    int _epoll;
+    QSocketNotifier* _notifier;
+    Ring* _ring;                // NULL when everything goes through epoll
+    QSet<dAmnEpollTransport*> _attached;
+    QList<QPointer<dAmnEpollTransport> > _ready, _dirty;
+    bool _passQueued;
+
+    void add(dAmnEpollTransport* transport);
+    void remove(dAmnEpollTransport* transport);
+    void established(dAmnEpollTransport* transport);
+
+    void markReady(dAmnEpollTransport* transport, int flags);
+    void markDirty(dAmnEpollTransport* transport);
+    void queuePass();
+
+    void handleEvent(dAmnEpollTransport* transport, quint32 events);
+    void receive(dAmnEpollTransport* transport);
+    void sendPending(dAmnEpollTransport* transport);
+
+    bool acquireSlot(dAmnEpollTransport* transport);
+    void releaseSlot(dAmnEpollTransport* transport);
+    void submitRead(dAmnEpollTransport* transport);
+    void submitWrite(dAmnEpollTransport* transport);
+    void submit();
+    void reap(bool wait = false);
+    void complete(quint64 tag, int result);
+};
+
+// A transport on the thread's dAmnEpollLoop. It follows its object to another
+// thread, finishing whatever it has in flight with the old thread's loop first.
+class MNLIBSHARED_EXPORT dAmnEpollTransport : public dAmnTransport
+{
+    Q_OBJECT
+
+    friend class dAmnEpollLoop;
+
+    enum Notification
+    {
+        gotData = 0x1, gotConnected = 0x2, gotClosed = 0x4, gotError = 0x8
+    };
+
+    dAmnEpollLoop* _loop;       // NULL until there is a socket
+    int _fd;
+    bool _open;                 // the connection is established
+    quint16 _port;
+    int _lookup;                // host lookup id, -1 when none
+
+    QByteArray _in, _out;
+    bool _closeWhenWritten;
+
+    int _slot;                  // registered buffers of ours, -1 when on epoll
+    bool _reading, _writing, _detaching;
+
+    int _notify;                // Notifications waiting for the loop's pass
+    bool _queued;
+    int _errno;
+    QAbstractSocket::SocketError _error;
+    QString _errorString;
+
+public:
+    explicit dAmnEpollTransport(QObject* parent = 0);
+    ~dAmnEpollTransport();
+
+    void connectToHost(const QString& host, quint16 port);
+    void disconnectFromHost();
+
+    qint64 write(const QByteArray& data);
+    QByteArray readAll();
+
+    QString errorString() const;
+
+protected:
+    bool event(QEvent* e);
+
+private slots:
+    void hostFound(const QHostInfo& info);
+    void attach();
+
+private:
+    void open(const QHostAddress& address);
+    void deliver();
+    void fail(int code);
+    void close();
+    void release();
+};
+
+#endif // DAMNEPOLLTRANSPORT_H
@@ -0,0 +1,278 @@
+﻿/*
+    This file is part of
+    amnlib - A C++ library for deviantART Message Network
+    Copyright © 2013 Carl Tessier <http://drfrankenstein90.deviantart.com/>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "damnjoinscheduler.h"
+#include "damnsession.h"
+#include "events.h"
+
+#include <algorithm>
+
+dAmnJoinScheduler::dAmnJoinScheduler(dAmnSession* session)
+    : QObject(session), _session(session),
+      _maxInFlight(8), _interval(200), _timeout(30000),
+      _rejoin(true), _loggedIn(session->state() == dAmnSession::online), _busy(false),
+      _lastSent(-1), _joined(0), _failed(0)
+{
+    this->_timer.setSingleShot(true);
+    connect(&this->_timer, SIGNAL(timeout()), this, SLOT(pump()));
+
+    connect(session, SIGNAL(joined(const JoinedEvent&)),
+            this, SLOT(handleJoined(const JoinedEvent&)));
+    connect(session, SIGNAL(gotProperty(const PropertyEvent&)),
+            this, SLOT(handleProperty(const PropertyEvent&)));
+    connect(session, SIGNAL(loggedIn(const LoginEvent&)),
+            this, SLOT(handleLogin(const LoginEvent&)));
+    connect(session, SIGNAL(stateChange(dAmnSession::State)),
+            this, SLOT(handleStateChange(dAmnSession::State)));
+}
+
+dAmnSession* dAmnJoinScheduler::session() const
+{
+    return this->_session;
+}
+
+int dAmnJoinScheduler::maxInFlight() const
+{
+    return this->_maxInFlight;
+}
+void dAmnJoinScheduler::setMaxInFlight(int joins)
+{
+    this->_maxInFlight = qMax(joins, 1);
+    this->pump();
+}
+int dAmnJoinScheduler::interval() const
+{
+    return this->_interval;
+}
+// 0 sends joins as fast as maxInFlight() allows.
+void dAmnJoinScheduler::setInterval(int msecs)
+{
+    this->_interval = qMax(msecs, 0);
+}
+int dAmnJoinScheduler::timeout() const
+{
+    return this->_timeout;
+}
+void dAmnJoinScheduler::setTimeout(int msecs)
+{
+    this->_timeout = qMax(msecs, 1);
+}
+bool dAmnJoinScheduler::rejoin() const
+{
+    return this->_rejoin;
+}
+void dAmnJoinScheduler::setRejoin(bool rejoin)
+{
+    this->_rejoin = rejoin;
+}
+
+// Queues rooms behind those already waiting, in the order given. Rooms that
+// are already queued or outstanding aren't joined twice.
+void dAmnJoinScheduler::joinAll(const QList<dAmnChatroomIdentifier>& rooms)
+{
+    foreach(const dAmnChatroomIdentifier& room, rooms)
+    {
+        if(this->isPending(dAmnName(room.toIdString())))
+            continue;
+
+        if(!this->_busy)
+        {
+            this->_busy = true;
+            this->_clock.start();
+            this->_lastSent = -1;
+            this->_joined = this->_failed = 0;
+        }
+
+        this->_queue.append(room);
+    }
+
+    this->pump();
+}
+
+// Drops the queue. Joins already sent are still waited for.
+void dAmnJoinScheduler::cancel()
+{
+    this->_queue.clear();
+    this->pump();
+}
+
+int dAmnJoinScheduler::queued() const
+{
+    return this->_queue.size();
+}
+int dAmnJoinScheduler::outstanding() const
+{
+    return this->_inflight.size();
+}
+bool dAmnJoinScheduler::isIdle() const
+{
+    return this->_queue.isEmpty() && this->_inflight.isEmpty();
+}
+
+void dAmnJoinScheduler::pump()
+{
+    if(!this->_busy || this->_session->state() != dAmnSession::online)
+        return;
+
+    qint64 now = this->_clock.elapsed();
+
+    foreach(const dAmnName& id, this->_inflight.keys())
+        if(now - this->_inflight.value(id) >= this->_timeout)
+            this->settle(id, false, "timed out");
+
+    while(!this->_queue.isEmpty() && this->_inflight.size() < this->_maxInFlight)
+    {
+        if(this->_lastSent >= 0 && now - this->_lastSent < this->_interval)
+        {
+            this->schedule(this->_interval - (now - this->_lastSent));
+            break;
+        }
+
+        dAmnChatroomIdentifier room = this->_queue.takeFirst();
+        this->_inflight.insert(dAmnName(room.toIdString()), now);
+        this->_lastSent = now;
+        this->_session->join(room);
+    }
+
+    if(!this->_inflight.isEmpty())
+    {   // Wake up for the first join to time out.
+        qint64 oldest = *std::min_element(this->_inflight.constBegin(), this->_inflight.constEnd());
+        this->schedule(oldest + this->_timeout - now);
+    }
+
+    if(this->isIdle())
+    {
+        this->_busy = false;
+        this->_timer.stop();
+        MNLIB_DEBUG("Joined %d rooms, %d failed, in %lld ms.",
+                    this->_joined, this->_failed, this->_clock.elapsed());
+        emit finished(this->_joined, this->_failed, this->_clock.elapsed());
+    }
+}
+
+// The server may spell the room differently from how it was asked for.
+void dAmnJoinScheduler::handleJoined(const JoinedEvent& event)
+{
+    dAmnName id (event.chatroom().toIdString());
+    if(!this->_inflight.contains(id))
+        return;
+
+    // On success the room stays outstanding until its members come in.
+    if(event.eventCode() != JoinedEvent::ok)
+    {
+        this->settle(id, false, event.eventString());
+        this->pump();
+    }
+}
+
+void dAmnJoinScheduler::handleProperty(const PropertyEvent& event)
+{
+    if(event.propertyCode() != PropertyEvent::members)
+        return;
+
+    dAmnName id (event.chatroom().toIdString());
+    if(!this->_inflight.contains(id))
+        return;
+
+    this->settle(id, true, QString());
+    this->pump();
+}
+
+void dAmnJoinScheduler::handleLogin(const LoginEvent& event)
+{
+    if(event.eventCode() != LoginEvent::ok)
+        return;
+
+    if(this->_loggedIn && this->_rejoin)
+    {   // The session kept its rooms through the disconnect.
+        QList<dAmnChatroomIdentifier> rooms;
+        foreach(dAmnChatroom* room, this->_session->chatrooms())
+            rooms.append(room->id());
+
+        if(!rooms.isEmpty())
+            MNLIB_DEBUG("Rejoining %d rooms.", rooms.size());
+        this->joinAll(rooms);
+    }
+
+    this->_loggedIn = true;
+    this->pump();
+}
+
+void dAmnJoinScheduler::handleStateChange(dAmnSession::State state)
+{
+    if(state != dAmnSession::offline || this->_inflight.isEmpty())
+        return;
+
+    // Whatever was outstanding is lost with the connection; send it again
+    // first once we're back, in the order it went out.
+    QList<QPair<qint64, QString> > lost;
+    for(auto it = this->_inflight.constBegin(); it != this->_inflight.constEnd(); ++it)
+        lost.append(qMakePair(it.value(), it.key().toString()));
+    std::sort(lost.begin(), lost.end());
+
+    for(int i = lost.size() - 1; i >= 0; --i)
+        this->_queue.prepend(dAmnChatroomIdentifier(this->_session, lost.at(i).second));
+
+    this->_inflight.clear();
+    this->_timer.stop();
+    this->_lastSent = -1;
+}
+
+bool dAmnJoinScheduler::isPending(const dAmnName& id) const
+{
+    if(this->_inflight.contains(id))
+        return true;
+
+    foreach(const dAmnChatroomIdentifier& room, this->_queue)
+        if(dAmnName::equals(room.toIdString(), id.toString()))
+            return true;
+
+    return false;
+}
+
+// Reports the room by the id string it was asked for with.
+void dAmnJoinScheduler::settle(const dAmnName& key, bool joined, const QString& reason)
+{
+    QHash<dAmnName, qint64>::iterator it = this->_inflight.find(key);
+    if(it == this->_inflight.end())
+        return;
+
+    const QString id = it.key().toString();
+    qint64 msecs = this->_clock.elapsed() - it.value();
+    this->_inflight.erase(it);
+
+    if(joined)
+    {
+        this->_joined++;
+        emit roomJoined(id, msecs);
+    }
+    else
+    {
+        this->_failed++;
+        MNLIB_WARN("Could not join %s: %s", qPrintable(id), qPrintable(reason));
+        emit roomFailed(id, reason);
+    }
+}
+
+void dAmnJoinScheduler::schedule(qint64 msecs)
+{
+    msecs = qMax(msecs, Q_INT64_C(0));
+    if(!this->_timer.isActive() || this->_timer.remainingTime() > msecs)
+        this->_timer.start(int(msecs));
+}
@@ -0,0 +1,105 @@
+﻿/*
+    This file is part of
+    amnlib - A C++ library for deviantART Message Network
+    Copyright © 2013 Carl Tessier <http://drfrankenstein90.deviantart.com/>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DAMNJOINSCHEDULER_H
+#define DAMNJOINSCHEDULER_H
+
+#include "mnlib_global.h"
+#include "damnsession.h"
+#include "damnchatroom.h"
+#include "damnname.h"
+#include "evtfwd.h"
+
+#include <QObject>
+#include <QString>
+#include <QList>
+#include <QHash>
+#include <QTimer>
+#include <QElapsedTimer>
+
+// Joins many rooms for a session without flooding it. Rooms are joined in the
+// order given, with at most maxInFlight() joins outstanding and at least
+// interval() msecs between two join packets. A room counts as joined once its
+// members property has arrived, so its other properties are in as well; one
+// that is refused or takes longer than timeout() counts as failed.
+//
+// finished() is emitted when nothing is queued or outstanding anymore. Joins
+// still outstanding when the session drops go back to the front of the
+// queue, and with rejoin() on, every room the session was in is joined again
+// after it logs back in.
+class MNLIBSHARED_EXPORT dAmnJoinScheduler : public QObject
+{
+    Q_OBJECT
+
+    dAmnSession* _session;
+
+    int _maxInFlight, _interval, _timeout;
+    bool _rejoin, _loggedIn;
+    bool _busy;                         // a batch is under way
+
+    QList<dAmnChatroomIdentifier> _queue;
+    QHash<dAmnName, qint64> _inflight;  // by id string, as the caller spelled it but
+                                        // matched case-insensitively; when its join was sent
+
+    QElapsedTimer _clock;               // runs since the current batch started
+    qint64 _lastSent;
+    QTimer _timer;
+
+    int _joined, _failed;
+
+public:
+    explicit dAmnJoinScheduler(dAmnSession* session);
+
+    dAmnSession* session() const;
+
+    int maxInFlight() const;
+    void setMaxInFlight(int joins);
+    int interval() const;
+    void setInterval(int msecs);
+    int timeout() const;
+    void setTimeout(int msecs);
+    bool rejoin() const;
+    void setRejoin(bool rejoin);
+
+    void joinAll(const QList<dAmnChatroomIdentifier>& rooms);
+    void cancel();
+
+    int queued() const;
+    int outstanding() const;
+    bool isIdle() const;
+
+signals:
+    void roomJoined(const QString& id, qint64 msecs);
+    void roomFailed(const QString& id, const QString& reason);
+    void finished(int joined, int failed, qint64 msecs);
+
+private slots:
+    void pump();
+    void handleJoined(const JoinedEvent& event);
+    void handleProperty(const PropertyEvent& event);
+    void handleLogin(const LoginEvent& event);
+    void handleStateChange(dAmnSession::State state);
+
+private:
+    bool isPending(const dAmnName& id) const;
+    void settle(const dAmnName& key, bool joined, const QString& reason);
+    void schedule(qint64 msecs);
+};
+
+#endif // DAMNJOINSCHEDULER_H
@@ -0,0 +1,696 @@
+﻿/*
+    This file is part of
+    amnlib - A C++ library for deviantART Message Network
+    Copyright © 2013 Carl Tessier <http://drfrankenstein90.deviantart.com/>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "damnlogindex.h"
+
+#include "damnlogstore.h"
+#include "damnrichtext.h"
+
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+#include <QMap>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QtEndian>
+#include <algorithm>
+#include <cstring>
+
+// Chunk files:
+//
+//   char[8] magic, quint32 lines, quint32 terms, quint32 pool size, reserved
+//   qint64 timestamp of each line
+//   quint32 name offset, name size, postings offset, postings size, per term,
+//     sorted by name bytes
+//   the term names, UTF-8
+//   the posting lists
+//
+// A posting list is a sequence of (line delta, position count, position
+// deltas...) varints, with lines counted from -1 and positions from 0.
+// Senders are indexed as terms made of \x01 and their lowercased name, with
+// no positions.
+
+namespace
+{
+    const char chunkMagic[8] = { 'M', 'N', 'L', 'O', 'G', 'I', 'X', '1' };
+    const int chunkHeaderSize = 24;
+    const int termEntrySize = 16;
+
+    struct Posting
+    {
+        int line;
+        int positions;          // index of the first one in the positions array
+        int count;
+    };
+
+    void putVarint(QByteArray& out, quint32 value)
+    {
+        while(value >= 0x80)
+        {
+            out.append(char(value | 0x80));
+            value >>= 7;
+        }
+        out.append(char(value));
+    }
+
+    bool getVarint(const uchar*& p, const uchar* end, quint32& value)
+    {
+        value = 0;
+        for(int shift = 0; p < end && shift < 35; shift += 7)
+        {
+            uchar b = *p++;
+            value |= quint32(b & 0x7F) << shift;
+            if(!(b & 0x80))
+                return true;
+        }
+        return false;
+    }
+
+    void decode(const uchar* p, const uchar* end, QVector<Posting>& postings, QVector<quint32>& positions)
+    {
+        int line = -1;
+        quint32 delta, count, at;
+        while(getVarint(p, end, delta) && getVarint(p, end, count))
+        {
+            Posting posting;
+            posting.line = line += delta;
+            posting.positions = positions.size();
+            posting.count = count;
+
+            quint32 position = 0;
+            for(quint32 i = 0; i < count && getVarint(p, end, at); ++i)
+                positions.append(position += at);
+
+            postings.append(posting);
+        }
+    }
+
+    // Last line of an encoded posting list, or -1 if it's empty.
+    int lastLine(const QByteArray& list)
+    {
+        const uchar* p = reinterpret_cast<const uchar*>(list.constData());
+        const uchar* end = p + list.size();
+        int line = -1;
+        quint32 delta, count, skip;
+        while(getVarint(p, end, delta) && getVarint(p, end, count))
+        {
+            line += delta;
+            for(quint32 i = 0; i < count; ++i)
+                getVarint(p, end, skip);
+        }
+        return line;
+    }
+
+    bool postingBefore(const Posting& posting, int line)
+    {
+        return posting.line < line;
+    }
+
+    const Posting* findLine(const QVector<Posting>& postings, int line)
+    {
+        QVector<Posting>::const_iterator it =
+                std::lower_bound(postings.constBegin(), postings.constEnd(), line, postingBefore);
+        return it != postings.constEnd() && it->line == line ? &*it : NULL;
+    }
+
+    QString senderTerm(const QString& name)
+    {
+        return QChar(1) + name.toLower();
+    }
+}
+
+struct dAmnLogIndex::Delta
+{
+    struct Term
+    {
+        QByteArray postings;
+        int last;
+
+        Term() : last(-1) {}
+    };
+
+    QString room;
+    qint64 bucket;
+    QVector<qint64> lines;
+    QHash<QString, Term> terms;
+
+    void add(qint64 timestamp, const QString& sender, const QStringList& words)
+    {
+        int line = this->lines.size();
+        this->lines.append(timestamp);
+
+        QHash<QString, QVector<quint32> > occurrences;
+        for(int i = 0; i < words.size(); ++i)
+            occurrences[words[i]].append(i);
+        occurrences[senderTerm(sender)];
+
+        QHash<QString, QVector<quint32> >::const_iterator it;
+        for(it = occurrences.constBegin(); it != occurrences.constEnd(); ++it)
+        {
+            Term& term = this->terms[it.key()];
+            putVarint(term.postings, line - term.last);
+            putVarint(term.postings, it.value().size());
+
+            quint32 previous = 0;
+            foreach(quint32 position, it.value())
+            {
+                putVarint(term.postings, position - previous);
+                previous = position;
+            }
+
+            term.last = line;
+        }
+    }
+};
+
+// A chunk as searched: either a mapped .ix file or an in-memory delta.
+struct dAmnLogIndex::Chunk
+{
+    const Delta* delta;
+
+    QFile file;
+    const uchar* data;
+    int lines, terms;
+    const uchar *timestamps, *directory, *pool, *postings;
+
+    explicit Chunk(const Delta* delta = NULL)
+        : delta(delta), data(NULL), lines(delta ? delta->lines.size() : 0), terms(0)
+    {
+    }
+
+    bool open(const QString& path)
+    {
+        this->file.setFileName(path);
+        if(!this->file.open(QIODevice::ReadOnly))
+            return false;
+
+        qint64 size = this->file.size();
+        this->data = size >= chunkHeaderSize ? this->file.map(0, size) : NULL;
+        if(!this->data || std::memcmp(this->data, chunkMagic, 8) != 0)
+        {
+            MNLIB_WARN("%s is not an index chunk", qPrintable(path));
+            this->data = NULL;
+            return false;
+        }
+
+        this->lines = qFromLittleEndian<quint32>(this->data + 8);
+        this->terms = qFromLittleEndian<quint32>(this->data + 12);
+        quint32 poolsize = qFromLittleEndian<quint32>(this->data + 16);
+
+        this->timestamps = this->data + chunkHeaderSize;
+        this->directory = this->timestamps + qint64(this->lines) * 8;
+        this->pool = this->directory + qint64(this->terms) * termEntrySize;
+        this->postings = this->pool + poolsize;
+        if(this->postings > this->data + size)
+        {
+            MNLIB_WARN("%s is truncated", qPrintable(path));
+            this->data = NULL;
+            return false;
+        }
+
+        return true;
+    }
+
+    qint64 timestamp(int line) const
+    {
+        if(this->delta)
+            return this->delta->lines.at(line);
+
+        return qFromLittleEndian<qint64>(this->timestamps + line * 8);
+    }
+
+    bool find(const QString& term, QVector<Posting>& postings, QVector<quint32>& positions) const
+    {
+        if(this->delta)
+        {
+            QHash<QString, Delta::Term>::const_iterator it = this->delta->terms.constFind(term);
+            if(it == this->delta->terms.constEnd())
+                return false;
+
+            const uchar* p = reinterpret_cast<const uchar*>(it->postings.constData());
+            decode(p, p + it->postings.size(), postings, positions);
+            return true;
+        }
+
+        if(!this->data)
+            return false;
+
+        QByteArray key = term.toUtf8();
+        int lo = 0, hi = this->terms;
+        while(lo < hi)
+        {
+            int mid = (lo + hi) / 2;
+            const uchar* entry = this->directory + mid * termEntrySize;
+            quint32 offset = qFromLittleEndian<quint32>(entry);
+            quint32 size = qFromLittleEndian<quint32>(entry + 4);
+
+            int c = std::memcmp(this->pool + offset, key.constData(), qMin<quint32>(size, key.size()));
+            if(c == 0)
+                c = int(size) - key.size();
+
+            if(c < 0)
+                lo = mid + 1;
+            else if(c > 0)
+                hi = mid;
+            else
+            {
+                const uchar* p = this->postings + qFromLittleEndian<quint32>(entry + 8);
+                decode(p, p + qFromLittleEndian<quint32>(entry + 12), postings, positions);
+                return true;
+            }
+        }
+
+        return false;
+    }
+};
+
+struct dAmnLogIndex::Query
+{
+    QList<QStringList> clauses;     // words, or phrases of consecutive words
+    QStringList senders;            // any of them
+
+    explicit Query(const QString& query)
+    {
+        int i = 0;
+        while(i < query.size())
+        {
+            if(query[i].isSpace())
+            {
+                ++i;
+                continue;
+            }
+
+            int end;
+            QString token;
+            if(query[i] == '"')
+            {
+                end = query.indexOf('"', i + 1);
+                if(end < 0)
+                    end = query.size();
+                token = query.mid(i + 1, end - i - 1);
+                ++end;
+            }
+            else
+            {
+                end = i;
+                while(end < query.size() && !query[end].isSpace())
+                    ++end;
+                token = query.mid(i, end - i);
+            }
+            i = end;
+
+            if(token.startsWith("from:", Qt::CaseInsensitive))
+            {
+                this->senders.append(senderTerm(token.mid(5)));
+                continue;
+            }
+
+            QStringList words = dAmnLogIndex::tokenize(token);
+            if(!words.isEmpty())
+                this->clauses.append(words);
+        }
+    }
+
+    bool isEmpty() const
+    {
+        return this->clauses.isEmpty() && this->senders.isEmpty();
+    }
+};
+
+class dAmnLogIndex::MergeTask : public QRunnable
+{
+    dAmnLogIndex* _index;
+    QSharedPointer<Delta> _delta;
+
+public:
+    MergeTask(dAmnLogIndex* index, QSharedPointer<Delta> delta)
+        : _index(index), _delta(delta)
+    {
+    }
+
+    void run()
+    {
+        this->_index->merge(this->_delta);
+    }
+};
+
+dAmnLogIndex::dAmnLogIndex(dAmnLogStore* store, QObject* parent)
+    : QObject(parent), _store(store)
+{
+    // merges of a room's chunk must happen in order; one thread does that.
+    this->_pool.setMaxThreadCount(1);
+
+    connect(store, SIGNAL(logged(const QString&, const dAmnLogRecord&)),
+            this, SLOT(logged(const QString&, const dAmnLogRecord&)));
+}
+
+dAmnLogIndex::~dAmnLogIndex()
+{
+    this->flush();
+    this->waitForMerges();
+}
+
+dAmnLogStore* dAmnLogIndex::store() const
+{
+    return this->_store;
+}
+
+void dAmnLogIndex::logged(const QString& room, const dAmnLogRecord& record)
+{
+    this->add(room, record);
+}
+
+void dAmnLogIndex::add(const QString& room, const dAmnLogRecord& record)
+{
+    QString key = room.toLower();
+    qint64 bucket = record.timestamp / bucketSpan;
+
+    Delta* delta = this->_active.value(key);
+    if(delta && delta->bucket != bucket)
+    {
+        this->freeze(key);
+        delta = NULL;
+    }
+
+    if(!delta)
+    {
+        delta = new Delta;
+        delta->room = room;
+        delta->bucket = bucket;
+        this->_active.insert(key, delta);
+    }
+
+    QString plain = dAmnRichText(record.tablumps()).toPlain();
+    delta->add(record.timestamp, record.senderName(), tokenize(plain));
+
+    if(delta->lines.size() >= deltaLines)
+        this->freeze(key);
+}
+
+void dAmnLogIndex::flush()
+{
+    foreach(const QString& key, this->_active.keys())
+        this->freeze(key);
+}
+
+void dAmnLogIndex::waitForMerges()
+{
+    this->_pool.waitForDone();
+}
+
+// Lines of the given rooms (or all of them) between from and to that match
+// query, oldest first within each room.
+QList<dAmnLogHit> dAmnLogIndex::search(const QString& query, const QString& room,
+                                       qint64 from, qint64 to, int max)
+{
+    QList<dAmnLogHit> hits;
+    Query q (query);
+    if(q.isEmpty() || max == 0)
+        return hits;
+
+    QStringList rooms;
+    if(room.isEmpty())
+    {
+        rooms = this->_store->rooms();
+        foreach(Delta* delta, this->_active)
+            if(!rooms.contains(delta->room, Qt::CaseInsensitive))
+                rooms.append(delta->room);
+    }
+    else
+        rooms.append(room);
+
+    QMutexLocker locker (&this->_lock);
+
+    foreach(const QString& r, rooms)
+    {
+        QString key = r.toLower();
+
+        QList<qint64> buckets;
+        foreach(const QString& name, QDir(this->_store->roomPath(r)).entryList(QStringList() << "*.ix", QDir::Files))
+            buckets.append(name.left(16).toLongLong(NULL, 16));
+        foreach(const QSharedPointer<Delta>& delta, this->_pending)
+            if(delta->room.toLower() == key)
+                buckets.append(delta->bucket);
+        if(Delta* delta = this->_active.value(key))
+            buckets.append(delta->bucket);
+
+        std::sort(buckets.begin(), buckets.end());
+        buckets.erase(std::unique(buckets.begin(), buckets.end()), buckets.end());
+
+        foreach(qint64 bucket, buckets)
+        {
+            if(bucket < from / bucketSpan || bucket > to / bucketSpan)
+                continue;
+
+            // the file holds the oldest lines, then come pending deltas in
+            // the order they were frozen, then the active one.
+            Chunk chunk;
+            if(chunk.open(this->chunkFile(r, bucket))
+                    && this->searchChunk(chunk, q, r, from, to, max, hits))
+                return hits;
+
+            foreach(const QSharedPointer<Delta>& delta, this->_pending)
+                if(delta->bucket == bucket && delta->room.toLower() == key
+                        && this->searchChunk(Chunk(delta.data()), q, r, from, to, max, hits))
+                    return hits;
+
+            Delta* delta = this->_active.value(key);
+            if(delta && delta->bucket == bucket
+                    && this->searchChunk(Chunk(delta), q, r, from, to, max, hits))
+                return hits;
+        }
+    }
+
+    return hits;
+}
+
+// Appends the matching lines of chunk to hits; returns true once there are
+// max of them.
+bool dAmnLogIndex::searchChunk(const Chunk& chunk, const Query& query, const QString& room,
+                               qint64 from, qint64 to, int max, QList<dAmnLogHit>& hits) const
+{
+    QVector<int> lines;
+    bool any = false;   // whether lines holds anything yet
+
+    QVector<Posting> postings;
+    QVector<quint32> positions;
+
+    if(!query.senders.isEmpty())
+    {
+        foreach(const QString& sender, query.senders)
+            chunk.find(sender, postings, positions);
+        if(postings.isEmpty())
+            return false;
+
+        foreach(const Posting& posting, postings)
+            lines.append(posting.line);
+        std::sort(lines.begin(), lines.end());
+        any = true;
+    }
+
+    foreach(const QStringList& clause, query.clauses)
+    {
+        // postings of each word of the clause, and where their positions went
+        QVector<QVector<Posting> > words(clause.size());
+        positions.clear();
+        for(int i = 0; i < clause.size(); ++i)
+            if(!chunk.find(clause[i], words[i], positions))
+                return false;
+
+        QVector<int> matches;
+        foreach(const Posting& first, words[0])
+        {
+            if(any && !std::binary_search(lines.constBegin(), lines.constEnd(), first.line))
+                continue;
+
+            QVector<const Posting*> others(clause.size(), NULL);
+            bool all = true;
+            for(int i = 1; i < clause.size() && all; ++i)
+                all = (others[i] = findLine(words[i], first.line)) != NULL;
+            if(!all)
+                continue;
+
+            bool found = clause.size() == 1;
+            for(int p = 0; p < first.count && !found; ++p)
+            {
+                quint32 start = positions[first.positions + p];
+                found = true;
+                for(int i = 1; i < clause.size() && found; ++i)
+                {
+                    const quint32* begin = positions.constData() + others[i]->positions;
+                    found = std::binary_search(begin, begin + others[i]->count, start + i);
+                }
+            }
+
+            if(found)
+                matches.append(first.line);
+        }
+
+        lines = matches;
+        any = true;
+        if(lines.isEmpty())
+            return false;
+    }
+
+    foreach(int line, lines)
+    {
+        qint64 timestamp = chunk.timestamp(line);
+        if(timestamp < from || timestamp > to)
+            continue;
+
+        dAmnLogHit hit;
+        hit.room = room;
+        hit.timestamp = timestamp;
+        hits.append(hit);
+
+        if(hits.size() == max)
+            return true;
+    }
+
+    return false;
+}
+
+QStringList dAmnLogIndex::tokenize(const QString& text)
+{
+    QStringList words;
+    QString word;
+    foreach(QChar c, text)
+    {
+        if(c.isLetterOrNumber())
+            word.append(c.toCaseFolded());
+        else if(!word.isEmpty())
+        {
+            words.append(word);
+            word.clear();
+        }
+    }
+
+    if(!word.isEmpty())
+        words.append(word);
+
+    return words;
+}
+
+void dAmnLogIndex::freeze(const QString& key)
+{
+    QSharedPointer<Delta> delta (this->_active.take(key));
+    if(!delta)
+        return;
+
+    {
+        QMutexLocker locker (&this->_lock);
+        this->_pending.append(delta);
+    }
+
+    this->_pool.start(new MergeTask(this, delta));
+}
+
+// Runs on the merge thread.
+void dAmnLogIndex::merge(QSharedPointer<Delta> delta)
+{
+    QString path = this->chunkFile(delta->room, delta->bucket);
+
+    QVector<qint64> lines;
+    QMap<QByteArray, QByteArray> terms;
+
+    Chunk old;
+    if(QFile::exists(path) && old.open(path))
+    {
+        lines.reserve(old.lines + delta->lines.size());
+        for(int i = 0; i < old.lines; ++i)
+            lines.append(old.timestamp(i));
+
+        for(int i = 0; i < old.terms; ++i)
+        {
+            const uchar* entry = old.directory + i * termEntrySize;
+            terms.insert(QByteArray(reinterpret_cast<const char*>(old.pool + qFromLittleEndian<quint32>(entry)),
+                                    qFromLittleEndian<quint32>(entry + 4)),
+                         QByteArray(reinterpret_cast<const char*>(old.postings + qFromLittleEndian<quint32>(entry + 8)),
+                                    qFromLittleEndian<quint32>(entry + 12)));
+        }
+    }
+
+    // the delta's lines come after the old ones; only the first line delta
+    // of each of its lists needs redoing to account for that.
+    int base = lines.size();
+    lines += delta->lines;
+
+    QHash<QString, Delta::Term>::const_iterator it;
+    for(it = delta->terms.constBegin(); it != delta->terms.constEnd(); ++it)
+    {
+        QByteArray& list = terms[it.key().toUtf8()];
+        int last = lastLine(list);
+
+        const uchar* begin = reinterpret_cast<const uchar*>(it->postings.constData());
+        const uchar* p = begin;
+        quint32 first;
+        getVarint(p, begin + it->postings.size(), first);
+
+        putVarint(list, base + int(first) - 1 - last);
+        list.append(it->postings.constData() + (p - begin), it->postings.size() - (p - begin));
+    }
+    old.file.close();
+
+    QByteArray directory, pool, postings;
+    directory.reserve(terms.size() * termEntrySize);
+    QMap<QByteArray, QByteArray>::const_iterator t;
+    for(t = terms.constBegin(); t != terms.constEnd(); ++t)
+    {
+        uchar entry[termEntrySize];
+        qToLittleEndian<quint32>(pool.size(), entry);
+        qToLittleEndian<quint32>(t.key().size(), entry + 4);
+        qToLittleEndian<quint32>(postings.size(), entry + 8);
+        qToLittleEndian<quint32>(t.value().size(), entry + 12);
+        directory.append(reinterpret_cast<const char*>(entry), termEntrySize);
+
+        pool += t.key();
+        postings += t.value();
+    }
+
+    QByteArray data;
+    data.reserve(chunkHeaderSize + lines.size() * 8 + directory.size() + pool.size() + postings.size());
+    data.resize(chunkHeaderSize + lines.size() * 8);
+
+    uchar* header = reinterpret_cast<uchar*>(data.data());
+    std::memcpy(header, chunkMagic, 8);
+    qToLittleEndian<quint32>(lines.size(), header + 8);
+    qToLittleEndian<quint32>(terms.size(), header + 12);
+    qToLittleEndian<quint32>(pool.size(), header + 16);
+    qToLittleEndian<quint32>(0, header + 20);
+    for(int i = 0; i < lines.size(); ++i)
+        qToLittleEndian<qint64>(lines[i], header + chunkHeaderSize + i * 8);
+
+    data += directory;
+    data += pool;
+    data += postings;
+
+    QSaveFile file (path);
+    bool written = file.open(QIODevice::WriteOnly) && file.write(data) == data.size();
+
+    QMutexLocker locker (&this->_lock);
+    if(!written || !file.commit())
+        MNLIB_CRIT("cannot write %s: %s", qPrintable(path), qPrintable(file.errorString()));
+
+    this->_pending.removeOne(delta);
+}
+
+QString dAmnLogIndex::chunkFile(const QString& room, qint64 bucket) const
+{
+    return this->_store->roomPath(room) + '/' + QString("%1.ix").arg(bucket, 16, 16, QChar('0'));
+}
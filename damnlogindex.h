@@ -0,0 +1,105 @@
+﻿/*
+    This file is part of
+    amnlib - A C++ library for deviantART Message Network
+    Copyright © 2013 Carl Tessier <http://drfrankenstein90.deviantart.com/>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DAMNLOGINDEX_H
+#define DAMNLOGINDEX_H
+
+#include "mnlib_global.h"
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+#include <QVector>
+#include <QList>
+#include <QHash>
+#include <QMutex>
+#include <QThreadPool>
+#include <QSharedPointer>
+
+class dAmnLogStore;
+struct dAmnLogRecord;
+
+struct MNLIBSHARED_EXPORT dAmnLogHit
+{
+    QString room;
+    qint64 timestamp;           // scan() the log store at it to get the line
+};
+
+// Full-text index over the lines of a dAmnLogStore.
+//
+// Lines are split into chunks by room and by day. Each chunk maps every word
+// of its lines' plain text, and every sender, to a posting list: the lines it
+// appears in and at which word positions, all delta- and varint-encoded.
+// Chunks are stored as .ix files next to the room's log segments.
+//
+// New lines go to an in-memory chunk for their room. Once it holds enough
+// lines, or the day changes, it is handed to a background thread that merges
+// it into the chunk on disk. Searches see both.
+//
+// Queries are words, "quoted phrases" and from:sender filters, all of which
+// must match. Words are compared case-insensitively.
+class MNLIBSHARED_EXPORT dAmnLogIndex : public QObject
+{
+    Q_OBJECT
+
+public:
+    static const qint64 bucketSpan = Q_INT64_C(86400000);  // one day
+    static const int deltaLines = 4096;
+
+    explicit dAmnLogIndex(dAmnLogStore* store, QObject* parent = 0);
+    ~dAmnLogIndex();
+
+    dAmnLogStore* store() const;
+
+    void add(const QString& room, const dAmnLogRecord& record);
+    void flush();
+    void waitForMerges();
+
+    QList<dAmnLogHit> search(const QString& query, const QString& room = QString(),
+                             qint64 from = 0, qint64 to = Q_INT64_C(0x7FFFFFFFFFFFFFFF),
+                             int max = -1);
+
+    static QStringList tokenize(const QString& text);
+
+private slots:
+    void logged(const QString& room, const dAmnLogRecord& record);
+
+private:
+    struct Delta;
+    struct Chunk;
+    struct Query;
+    class MergeTask;
+    friend class MergeTask;
+
+    dAmnLogStore* _store;
+    QHash<QString, Delta*> _active;                 // by room key, GUI thread only
+    QList<QSharedPointer<Delta> > _pending;         // frozen, waiting to be merged
+    QMutex _lock;                                   // guards _pending and chunk files
+    QThreadPool _pool;
+
+    void freeze(const QString& key);
+    void merge(QSharedPointer<Delta> delta);
+    bool searchChunk(const Chunk& chunk, const Query& query, const QString& room,
+                     qint64 from, qint64 to, int max, QList<dAmnLogHit>& hits) const;
+
+    QString chunkFile(const QString& room, qint64 bucket) const;
+};
+
+#endif // DAMNLOGINDEX_H
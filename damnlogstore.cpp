@@ -0,0 +1,650 @@
+﻿/*
+    This file is part of
+    amnlib - A C++ library for deviantART Message Network
+    Copyright © 2013 Carl Tessier <http://drfrankenstein90.deviantart.com/>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "damnlogstore.h"
+
+#include "damnsession.h"
+#include "damnpacket.h"
+#include "events.h"
+
+#include <QDir>
+#include <QFile>
+#include <QDateTime>
+#include <QUrl>
+#include <QtEndian>
+#include <algorithm>
+
+// Segment files start with a 16-byte header, then hold records back to back:
+//
+//   quint32 size       whole record, header included
+//   qint64  timestamp
+//   quint8  kind
+//   quint8  reserved
+//   quint16 sender size
+//   sender, then text, both UTF-8
+//
+// Index files are (qint64 timestamp, quint32 offset) pairs, one for the first
+// record and then one every indexInterval bytes or so. Everything is
+// little-endian.
+//
+// Segments are named <first>-<seq>.seg, first being the hex timestamp of
+// their first record. Sealing renames them to <first>-<seq>-<last>.seg, so
+// the name alone tells they are full and when their last record is from.
+// Sealed segments may be replaced by their qCompress()ed contents under a
+// .segz name; offsets in the index still refer to the uncompressed data.
+// The index keeps the unsealed name, <first>-<seq>.idx.
+
+namespace
+{
+    const char segmentMagic[8] = { 'M', 'N', 'L', 'O', 'G', 'S', 'E', 'G' };
+    const quint32 segmentVersion = 1;
+    const int segmentHeaderSize = 16;
+    const int recordHeaderSize = 16;
+    const int indexEntrySize = 12;
+    const int indexInterval = 4096;
+    const int bufferLimit = 256 * 1024;
+
+    struct IndexEntry
+    {
+        qint64 timestamp;
+        quint32 offset;
+    };
+
+    inline uchar* bytes(char* p)
+    {
+        return reinterpret_cast<uchar*>(p);
+    }
+    inline const uchar* bytes(const char* p)
+    {
+        return reinterpret_cast<const uchar*>(p);
+    }
+
+    bool validHeader(const char* data, qint64 size)
+    {
+        return size >= segmentHeaderSize
+                && std::equal(segmentMagic, segmentMagic + 8, data)
+                && qFromLittleEndian<quint32>(bytes(data + 8)) == segmentVersion;
+    }
+
+    // Size of the complete record at offset, or 0 if it's cut short or corrupt.
+    quint32 recordAt(const char* data, qint64 size, qint64 offset)
+    {
+        if(size - offset < recordHeaderSize)
+            return 0;
+
+        quint32 length = qFromLittleEndian<quint32>(bytes(data + offset));
+        quint16 sender = qFromLittleEndian<quint16>(bytes(data + offset + 14));
+        if(length < quint32(recordHeaderSize) + sender || length > size - offset)
+            return 0;
+
+        return length;
+    }
+
+    qint64 timestampAt(const char* data, qint64 offset)
+    {
+        return qFromLittleEndian<qint64>(bytes(data + offset + 4));
+    }
+
+    // Offset just past the last complete record, raising last to the latest
+    // timestamp on the way.
+    qint64 walkRecords(const char* data, qint64 size, qint64& last)
+    {
+        qint64 offset = segmentHeaderSize;
+        while(quint32 length = recordAt(data, size, offset))
+        {
+            last = qMax(last, timestampAt(data, offset));
+            offset += length;
+        }
+        return offset;
+    }
+
+    IndexEntry indexEntry(const char* index, int i)
+    {
+        IndexEntry entry;
+        entry.timestamp = qFromLittleEndian<qint64>(bytes(index + i * indexEntrySize));
+        entry.offset = qFromLittleEndian<quint32>(bytes(index + i * indexEntrySize + 8));
+        return entry;
+    }
+
+    QString indexFileFor(const QString& segment)
+    {
+        return segment.left(segment.lastIndexOf('/') + 1 + 21) + ".idx";
+    }
+
+    bool segmentLess(const QString& a, const QString& b)
+    {
+        // the extension doesn't matter; names are fixed-width up to it.
+        return a.leftRef(21) < b.leftRef(21);
+    }
+
+    qint64 segmentFirst(const QString& name)
+    {
+        return name.left(16).toLongLong(NULL, 16);
+    }
+
+    bool isSealed(const QString& name)
+    {
+        return name.size() > 21 && name.at(21) == '-';
+    }
+
+    qint64 segmentLast(const QString& name)
+    {
+        return name.mid(22, 16).toLongLong(NULL, 16);
+    }
+}
+
+struct dAmnLogStore::Writer
+{
+    QString room, dir;
+    QFile segment, index;
+    QByteArray buffer, ibuffer;
+    qint64 size;                // bytes in the segment, buffered ones included
+    qint64 indexed;             // offset of the last indexed record, -1 if none
+    qint64 last;                // latest timestamp logged
+};
+
+QString dAmnLogRecord::senderName() const
+{
+    return QString::fromUtf8(this->sender, this->senderSize);
+}
+
+QString dAmnLogRecord::tablumps() const
+{
+    return QString::fromUtf8(this->text, this->textSize);
+}
+
+dAmnLogStore::dAmnLogStore(const QString& path, QObject* parent)
+    : QObject(parent),
+      _path(path), _segmentsize(8 * 1024 * 1024), _compress(false)
+{
+    QDir().mkpath(path);
+}
+
+dAmnLogStore::~dAmnLogStore()
+{
+    this->flush();
+    qDeleteAll(this->_writers);
+}
+
+const QString& dAmnLogStore::path() const
+{
+    return this->_path;
+}
+
+qint64 dAmnLogStore::segmentSize() const
+{
+    return this->_segmentsize;
+}
+
+void dAmnLogStore::setSegmentSize(qint64 bytes)
+{
+    // index offsets are 32-bit.
+    this->_segmentsize = qBound<qint64>(segmentHeaderSize + 1, bytes, Q_INT64_C(0x7FFFFFFF));
+}
+
+bool dAmnLogStore::compressSealed() const
+{
+    return this->_compress;
+}
+
+void dAmnLogStore::setCompressSealed(bool compress)
+{
+    this->_compress = compress;
+}
+
+void dAmnLogStore::attach(dAmnSession* session)
+{
+    connect(session, SIGNAL(message(const MsgEvent&)),
+            this, SLOT(logMessage(const MsgEvent&)));
+    connect(session, SIGNAL(action(const ActionEvent&)),
+            this, SLOT(logAction(const ActionEvent&)));
+}
+
+void dAmnLogStore::detach(dAmnSession* session)
+{
+    disconnect(session, 0, this, 0);
+}
+
+void dAmnLogStore::logMessage(const MsgEvent& event)
+{
+    this->append(event.packet().param(), dAmnLogRecord::message,
+                 QDateTime::currentMSecsSinceEpoch(), event.userName(),
+                 event.packet().subPacket().data().toUtf8());
+}
+
+void dAmnLogStore::logAction(const ActionEvent& event)
+{
+    this->append(event.packet().param(), dAmnLogRecord::action,
+                 QDateTime::currentMSecsSinceEpoch(), event.userName(),
+                 event.packet().subPacket().data().toUtf8());
+}
+
+void dAmnLogStore::append(const QString& room, dAmnLogRecord::Kind kind, qint64 timestamp,
+                          const QString& sender, const QByteArray& text)
+{
+    Writer* w = this->writer(room);
+    if(!w)
+        return;
+
+    timestamp = qMax(timestamp, w->last);
+
+    if(!w->segment.isOpen() && !this->openSegment(w, timestamp))
+        return;
+
+    QByteArray from = sender.toUtf8();
+    if(from.size() > 0xFFFF)
+        from.truncate(0xFFFF);
+
+    if(w->indexed < 0 || w->size - w->indexed >= indexInterval)
+    {
+        int at = w->ibuffer.size();
+        w->ibuffer.resize(at + indexEntrySize);
+        qToLittleEndian<qint64>(timestamp, bytes(w->ibuffer.data() + at));
+        qToLittleEndian<quint32>(quint32(w->size), bytes(w->ibuffer.data() + at + 8));
+        w->indexed = w->size;
+    }
+
+    quint32 length = recordHeaderSize + from.size() + text.size();
+    int at = w->buffer.size();
+    w->buffer.resize(at + recordHeaderSize);
+
+    char* header = w->buffer.data() + at;
+    qToLittleEndian<quint32>(length, bytes(header));
+    qToLittleEndian<qint64>(timestamp, bytes(header + 4));
+    header[12] = char(kind);
+    header[13] = 0;
+    qToLittleEndian<quint16>(quint16(from.size()), bytes(header + 14));
+    w->buffer.append(from).append(text);
+
+    w->size += length;
+    w->last = timestamp;
+
+    dAmnLogRecord record;
+    record.kind = kind;
+    record.timestamp = timestamp;
+    record.sender = from.constData();
+    record.senderSize = from.size();
+    record.text = text.constData();
+    record.textSize = text.size();
+    emit logged(w->room, record);
+
+    if(w->size >= this->_segmentsize)
+        this->seal(w);
+    else if(w->buffer.size() >= bufferLimit)
+        this->flush(w);
+}
+
+void dAmnLogStore::flush()
+{
+    foreach(Writer* w, this->_writers)
+        this->flush(w);
+}
+
+QStringList dAmnLogStore::rooms() const
+{
+    QStringList rooms;
+    foreach(const QString& dir, QDir(this->_path).entryList(QDir::Dirs | QDir::NoDotAndDotDot, QDir::Name))
+        rooms.append(QUrl::fromPercentEncoding(dir.toLatin1().replace('_', ':')));
+
+    return rooms;
+}
+
+// Where the segments of room live; other archives of that room, like its
+// search index, go there too.
+QString dAmnLogStore::roomPath(const QString& room) const
+{
+    return this->_path + '/' + roomDir(room);
+}
+
+// Calls visit on every record of room logged between from and to inclusive,
+// in order, and returns how many there were.
+int dAmnLogStore::scan(const QString& room, qint64 from, qint64 to, const Visitor& visit)
+{
+    if(Writer* w = this->_writers.value(room.toLower()))
+        this->flush(w);
+
+    QDir dir(this->roomPath(room));
+    QStringList files = dir.entryList(QStringList() << "*.seg" << "*.segz", QDir::Files);
+    std::sort(files.begin(), files.end(), segmentLess);
+
+    int count = 0;
+    bool stop = false;
+    for(int i = 0; i < files.size() && !stop; ++i)
+    {
+        // a segment holds everything from its own first timestamp to the
+        // next segment's.
+        if(segmentFirst(files[i]) > to)
+            break;
+        if(i + 1 < files.size() && segmentFirst(files[i + 1]) < from)
+            continue;
+
+        count += this->scanSegment(dir.filePath(files[i]), from, to, visit, stop);
+    }
+
+    return count;
+}
+
+int dAmnLogStore::scanSegment(const QString& file, qint64 from, qint64 to, const Visitor& visit, bool& stop) const
+{
+    QFile segment (file);
+    if(!segment.open(QIODevice::ReadOnly))
+    {
+        MNLIB_WARN("cannot open %s: %s", qPrintable(file), qPrintable(segment.errorString()));
+        return 0;
+    }
+
+    QByteArray inflated;
+    const char* data;
+    qint64 size;
+    if(file.endsWith(".segz"))
+    {
+        inflated = qUncompress(segment.readAll());
+        data = inflated.constData();
+        size = inflated.size();
+    }
+    else
+    {
+        size = segment.size();
+        data = size > 0 ? reinterpret_cast<const char*>(segment.map(0, size)) : NULL;
+        if(!data && size > 0)
+        {
+            inflated = segment.readAll();
+            data = inflated.constData();
+        }
+    }
+
+    if(!data || !validHeader(data, size))
+    {
+        MNLIB_WARN("%s is not a log segment", qPrintable(file));
+        return 0;
+    }
+
+    // start from the last indexed record before from; there may be records
+    // with the same timestamp on both sides of an index entry.
+    qint64 offset = segmentHeaderSize;
+    QFile index (indexFileFor(file));
+    if(index.open(QIODevice::ReadOnly) && index.size() >= indexEntrySize)
+    {
+        int entries = index.size() / indexEntrySize;
+        const char* idx = reinterpret_cast<const char*>(index.map(0, entries * indexEntrySize));
+        QByteArray copy;
+        if(!idx)
+        {
+            copy = index.readAll();
+            idx = copy.constData();
+        }
+
+        int lo = 0, hi = entries;
+        while(lo < hi)
+        {
+            int mid = (lo + hi) / 2;
+            if(indexEntry(idx, mid).timestamp < from)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+
+        if(lo > 0)
+        {
+            IndexEntry entry = indexEntry(idx, lo - 1);
+            if(entry.offset >= quint32(segmentHeaderSize) && entry.offset < size)
+                offset = entry.offset;
+        }
+    }
+
+    int count = 0;
+    dAmnLogRecord record;
+    while(quint32 length = recordAt(data, size, offset))
+    {
+        record.timestamp = timestampAt(data, offset);
+        if(record.timestamp > to)
+        {
+            stop = true;
+            break;
+        }
+
+        if(record.timestamp >= from)
+        {
+            const char* r = data + offset;
+            record.kind = dAmnLogRecord::Kind(quint8(r[12]));
+            record.senderSize = qFromLittleEndian<quint16>(bytes(r + 14));
+            record.sender = r + recordHeaderSize;
+            record.text = record.sender + record.senderSize;
+            record.textSize = length - recordHeaderSize - record.senderSize;
+
+            ++count;
+            if(!visit(record))
+            {
+                stop = true;
+                break;
+            }
+        }
+
+        offset += length;
+    }
+
+    return count;
+}
+
+dAmnLogStore::Writer* dAmnLogStore::writer(const QString& room)
+{
+    QString key = room.toLower();
+    Writer* w = this->_writers.value(key);
+    if(w)
+        return w;
+
+    w = new Writer;
+    w->room = room;
+    w->dir = this->roomPath(room);
+    w->size = 0;
+    w->indexed = -1;
+    w->last = 0;
+
+    if(!QDir().mkpath(w->dir))
+    {
+        MNLIB_WARN("cannot create %s", qPrintable(w->dir));
+        delete w;
+        return NULL;
+    }
+
+    this->recover(w);
+    this->_writers.insert(key, w);
+    return w;
+}
+
+// Picks up where a previous run left off: reopens the latest segment if it
+// wasn't sealed, dropping a record that was only partly written, and seals
+// it instead if it had already grown to segmentSize().
+void dAmnLogStore::recover(Writer* w)
+{
+    QDir dir (w->dir);
+    QStringList files = dir.entryList(QStringList() << "*.seg" << "*.segz", QDir::Files);
+    if(files.isEmpty())
+        return;
+
+    std::sort(files.begin(), files.end(), segmentLess);
+    QString latest = files.last();
+    QString path = dir.filePath(latest);
+    w->last = segmentFirst(latest);
+
+    if(isSealed(latest))
+    {
+        w->last = qMax(w->last, segmentLast(latest));
+        return;
+    }
+
+    if(!latest.endsWith(".seg"))
+    {   // compressed before sealed names carried their last timestamp.
+        QFile segment (path);
+        QByteArray data = segment.open(QIODevice::ReadOnly) ? qUncompress(segment.readAll()) : QByteArray();
+        if(validHeader(data.constData(), data.size()))
+            walkRecords(data.constData(), data.size(), w->last);
+        else
+            MNLIB_WARN("%s is not a log segment", qPrintable(path));
+        return;
+    }
+
+    w->segment.setFileName(path);
+    w->index.setFileName(indexFileFor(path));
+    if(!w->segment.open(QIODevice::ReadWrite) || !w->index.open(QIODevice::ReadWrite))
+    {
+        MNLIB_WARN("cannot reopen %s", qPrintable(path));
+        w->segment.close();
+        w->index.close();
+        return;
+    }
+
+    QByteArray data = w->segment.readAll();
+    if(!validHeader(data.constData(), data.size()))
+    {
+        MNLIB_WARN("%s is not a log segment; starting a new one", qPrintable(path));
+        w->segment.close();
+        w->index.close();
+        return;
+    }
+
+    qint64 good = walkRecords(data.constData(), data.size(), w->last);
+    if(good < data.size())
+    {
+        MNLIB_WARN("%s: dropping %lld bytes of incomplete records", qPrintable(path), data.size() - good);
+        w->segment.resize(good);
+    }
+
+    QByteArray idx = w->index.readAll();
+    int entries = idx.size() / indexEntrySize;
+    while(entries > 0 && indexEntry(idx.constData(), entries - 1).offset >= good)
+        --entries;
+    if(entries * indexEntrySize != idx.size())
+        w->index.resize(entries * indexEntrySize);
+
+    w->indexed = entries > 0 ? qint64(indexEntry(idx.constData(), entries - 1).offset) : -1;
+    w->size = good;
+    w->segment.seek(good);
+    w->index.seek(entries * indexEntrySize);
+
+    // full, but the previous run stopped before renaming it.
+    if(w->size >= this->_segmentsize)
+        this->seal(w);
+}
+
+bool dAmnLogStore::openSegment(Writer* w, qint64 first)
+{
+    QDir dir (w->dir);
+    QString name;
+    for(int seq = 0; ; ++seq)
+    {
+        name = segmentName(first) + QString("-%1").arg(seq, 4, 16, QChar('0'));
+        if(dir.entryList(QStringList() << name + ".seg" << name + ".segz" << name + "-*", QDir::Files).isEmpty())
+            break;
+    }
+
+    w->segment.setFileName(dir.filePath(name + ".seg"));
+    w->index.setFileName(dir.filePath(name + ".idx"));
+    if(!w->segment.open(QIODevice::WriteOnly | QIODevice::Append)
+            || !w->index.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        MNLIB_WARN("cannot create %s: %s", qPrintable(w->segment.fileName()),
+                   qPrintable(w->segment.errorString()));
+        w->segment.close();
+        w->index.close();
+        return false;
+    }
+
+    char header[segmentHeaderSize];
+    std::copy(segmentMagic, segmentMagic + 8, header);
+    qToLittleEndian<quint32>(segmentVersion, bytes(header + 8));
+    qToLittleEndian<quint32>(0, bytes(header + 12));
+
+    w->buffer.append(header, segmentHeaderSize);
+    w->size = segmentHeaderSize;
+    w->indexed = -1;
+    return true;
+}
+
+void dAmnLogStore::flush(Writer* w)
+{
+    if(!w->segment.isOpen())
+        return;
+
+    if(!w->buffer.isEmpty())
+    {
+        if(w->segment.write(w->buffer) != w->buffer.size())
+            MNLIB_CRIT("write to %s failed: %s", qPrintable(w->segment.fileName()),
+                       qPrintable(w->segment.errorString()));
+        w->buffer.resize(0);
+        w->segment.flush();
+    }
+
+    if(!w->ibuffer.isEmpty())
+    {
+        w->index.write(w->ibuffer);
+        w->ibuffer.resize(0);
+        w->index.flush();
+    }
+}
+
+void dAmnLogStore::seal(Writer* w)
+{
+    this->flush(w);
+
+    QString path = w->segment.fileName();
+    w->segment.close();
+    w->index.close();
+
+    QString sealed = path.left(path.lastIndexOf('.')) + '-' + segmentName(w->last) + ".seg";
+    if(QFile::rename(path, sealed))
+        path = sealed;
+    else
+        MNLIB_WARN("cannot rename %s to %s", qPrintable(path), qPrintable(sealed));
+
+    if(this->_compress)
+    {
+        QFile plain (path);
+        QFile packed (path + 'z');
+        if(plain.open(QIODevice::ReadOnly) && packed.open(QIODevice::WriteOnly))
+        {
+            QByteArray data = qCompress(plain.readAll());
+            if(packed.write(data) == data.size() && packed.flush())
+            {
+                plain.remove();
+                path = packed.fileName();
+            }
+            else
+            {
+                MNLIB_WARN("cannot compress %s: %s", qPrintable(path), qPrintable(packed.errorString()));
+                packed.remove();
+            }
+        }
+    }
+
+    emit segmentSealed(w->room, path);
+}
+
+// "chat:Botdom" lives in chat_botdom. Underscores and anything else that
+// could upset a file system are percent-encoded, so rooms() can tell the
+// names back exactly.
+QString dAmnLogStore::roomDir(const QString& room)
+{
+    return QString::fromLatin1(QUrl::toPercentEncoding(room.toLower(), ":", "_").replace(':', '_'));
+}
+
+QString dAmnLogStore::segmentName(qint64 first)
+{
+    return QString("%1").arg(first, 16, 16, QChar('0'));
+}
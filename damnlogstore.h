@@ -0,0 +1,126 @@
+﻿/*
+    This file is part of
+    amnlib - A C++ library for deviantART Message Network
+    Copyright © 2013 Carl Tessier <http://drfrankenstein90.deviantart.com/>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DAMNLOGSTORE_H
+#define DAMNLOGSTORE_H
+
+#include "mnlib_global.h"
+#include "evtfwd.h"
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+#include <QHash>
+
+#include <functional>
+
+class dAmnSession;
+
+// One logged line, as a view into a mapped (or decompressed) segment. The
+// pointers are only good for the duration of the visitor call.
+struct MNLIBSHARED_EXPORT dAmnLogRecord
+{
+    enum Kind
+    {
+        message, action
+    };
+
+    Kind kind;
+    qint64 timestamp;           // msecs since the epoch
+    const char* sender;         // UTF-8, not null-terminated
+    int senderSize;
+    const char* text;           // raw tablumps, UTF-8, not null-terminated
+    int textSize;
+
+    QString senderName() const;
+    QString tablumps() const;
+};
+
+// Archives chatroom messages and actions on disk.
+//
+// Each room gets its own directory of append-only segment files, named after
+// the timestamp of their first record, and a sparse index next to each one
+// mapping timestamps to offsets every few KiB. Once a segment grows past
+// segmentSize() it is sealed: renamed to carry the timestamp of its last
+// record too, and compressed if compressSealed() is set. The next record
+// starts a new one. Writes are buffered per room and reach the
+// disk on flush(), when a buffer fills up, or when a segment is sealed.
+//
+// Timestamps are kept non-decreasing within a room so segments and indexes
+// can be searched by time; a record older than its predecessor is logged
+// with its predecessor's timestamp.
+class MNLIBSHARED_EXPORT dAmnLogStore : public QObject
+{
+    Q_OBJECT
+
+public:
+    // Return false to stop the scan.
+    typedef std::function<bool (const dAmnLogRecord&)> Visitor;
+
+    explicit dAmnLogStore(const QString& path, QObject* parent = 0);
+    ~dAmnLogStore();
+
+    const QString& path() const;
+
+    qint64 segmentSize() const;
+    void setSegmentSize(qint64 bytes);
+    bool compressSealed() const;
+    void setCompressSealed(bool compress);
+
+    void attach(dAmnSession* session);
+    void detach(dAmnSession* session);
+
+    void append(const QString& room, dAmnLogRecord::Kind kind, qint64 timestamp,
+                const QString& sender, const QByteArray& text);
+    void flush();
+
+    QStringList rooms() const;
+    QString roomPath(const QString& room) const;
+    int scan(const QString& room, qint64 from, qint64 to, const Visitor& visit);
+
+public slots:
+    void logMessage(const MsgEvent& event);
+    void logAction(const ActionEvent& event);
+
+signals:
+    void logged(const QString& room, const dAmnLogRecord& record);
+    void segmentSealed(const QString& room, const QString& segment);
+
+private:
+    struct Writer;
+
+    QString _path;
+    qint64 _segmentsize;
+    bool _compress;
+    QHash<QString, Writer*> _writers;
+
+    Writer* writer(const QString& room);
+    bool openSegment(Writer* w, qint64 first);
+    void recover(Writer* w);
+    void flush(Writer* w);
+    void seal(Writer* w);
+
+    int scanSegment(const QString& file, qint64 from, qint64 to, const Visitor& visit, bool& stop) const;
+
+    static QString roomDir(const QString& room);
+    static QString segmentName(qint64 first);
+};
+
+#endif // DAMNLOGSTORE_H
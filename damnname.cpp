@@ -0,0 +1,100 @@
+﻿/*
+    This file is part of
+    amnlib - A C++ library for deviantART Message Network
+    Copyright © 2013 Carl Tessier <http://drfrankenstein90.deviantart.com/>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "damnname.h"
+
+#include <QString>
+#include <QChar>
+
+dAmnName::dAmnName()
+    : _hash(0)
+{
+}
+
+dAmnName::dAmnName(const QString& name)
+    : _name(name), _hash(foldedHash(name))
+{
+}
+
+const QString& dAmnName::toString() const
+{
+    return this->_name;
+}
+
+uint dAmnName::hash() const
+{
+    return this->_hash;
+}
+
+bool dAmnName::isEmpty() const
+{
+    return this->_name.isEmpty();
+}
+
+bool dAmnName::operator ==(const dAmnName& rhs) const
+{
+    return this->_hash == rhs._hash && equals(this->_name, rhs._name);
+}
+
+bool dAmnName::operator !=(const dAmnName& rhs) const
+{
+    return !(*this == rhs);
+}
+
+bool dAmnName::operator <(const dAmnName& rhs) const
+{
+    return compare(this->_name, rhs._name) < 0;
+}
+
+uint dAmnName::foldedHash(const QString& name)
+{   // FNV-1a over the folded UTF-16 code units. Names are nearly always
+    // ASCII, which gets folded by hand.
+    uint hash = 2166136261u;
+
+    const QChar* c = name.constData();
+    const QChar* const end = c + name.size();
+    for(; c < end; ++c)
+    {
+        ushort u = c->unicode();
+        if(u < 0x80)
+        {
+            if(u >= 'A' && u <= 'Z')
+                u += 'a' - 'A';
+        }
+        else
+        {
+            u = c->toCaseFolded().unicode();
+        }
+
+        hash = (hash ^ u) * 16777619u;
+    }
+
+    return hash;
+}
+
+bool dAmnName::equals(const QString& left, const QString& right)
+{
+    return left.size() == right.size()
+        && QString::compare(left, right, Qt::CaseInsensitive) == 0;
+}
+
+int dAmnName::compare(const QString& left, const QString& right)
+{
+    return QString::compare(left, right, Qt::CaseInsensitive);
+}
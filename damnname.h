@@ -0,0 +1,57 @@
+﻿/*
+    This file is part of
+    amnlib - A C++ library for deviantART Message Network
+    Copyright © 2013 Carl Tessier <http://drfrankenstein90.deviantart.com/>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DAMNNAME_H
+#define DAMNNAME_H
+
+#include "mnlib_global.h"
+
+#include <QString>
+
+// dAmn names (users, mostly) are case-insensitive. dAmnName keeps a name
+// along with the hash of its case-folded form, which is computed once, so
+// it can be used as a hash key and compared without building a folded copy.
+class MNLIBSHARED_EXPORT dAmnName
+{
+    QString _name;
+    uint _hash;
+
+public:
+    dAmnName();
+    dAmnName(const QString& name);
+
+    const QString& toString() const;
+    uint hash() const;
+    bool isEmpty() const;
+
+    bool operator ==(const dAmnName& rhs) const;
+    bool operator !=(const dAmnName& rhs) const;
+    bool operator <(const dAmnName& rhs) const;
+
+    static uint foldedHash(const QString& name);
+    static bool equals(const QString& left, const QString& right);
+    static int compare(const QString& left, const QString& right);
+};
+
+inline uint qHash(const dAmnName& name)
+{
+    return name.hash();
+}
+
+#endif // DAMNNAME_H
@@ -29,7 +29,7 @@
 
 dAmnPacket::dAmnPacket(dAmnSession* parent)
         :dAmnObject(parent),
-         _subpacket(NULL)
+         _subpacket(NULL), _kcmd(unknown)
 {
 }
 
@@ -41,7 +41,9 @@ dAmnPacket::dAmnPacket(dAmnSession* parent, const QString& cmd, const QString& p
 }
 
 dAmnPacket::dAmnPacket(const dAmnPacket& packet)
-    : dAmnObject(packet.session())
+    : dAmnObject(packet.session()),
+      _cmd(packet._cmd), _param(packet._param), _data(packet._data), _args(packet._args),
+      _subpacket(NULL), _kcmd(packet._kcmd)
 {
     if(packet._subpacket != NULL)
     {
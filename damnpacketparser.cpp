@@ -27,6 +27,36 @@ class dAmnSession;
 #include <QChar>
 #include <QHash>
 #include "damnpacket.h"
+#include "damnatom.h"
+
+namespace
+{
+    // Arguments whose values come from small, closed sets: properties,
+    // privclasses and error codes. Those are pooled like commands and
+    // argument names.
+    bool isClosedSetArg(const QString& name)
+    {
+        return name == QLatin1String("p") || name == QLatin1String("pc")
+            || name == QLatin1String("e");
+    }
+
+    // Arguments naming users; those share the pooled name of the user, if
+    // we know them, but don't keep it pooled.
+    bool isNameArg(const QString& name)
+    {
+        return name == QLatin1String("u") || name == QLatin1String("by")
+            || name == QLatin1String("s");
+    }
+
+    QString pooledArg(const QString& name, const QString& value)
+    {
+        if(isClosedSetArg(name))
+            return dAmnAtom::intern(value);
+        if(isNameArg(name))
+            return dAmnAtom::share(value);
+        return value;
+    }
+}
 
 dAmnPacketParser::dAmnPacketParser(dAmnSession* session)
     : session(session)
@@ -117,7 +147,7 @@ dAmnPacket* dAmnPacketParser::parsePacket(QByteArray* raw)
                     MNLIB_WARN("Argument '%s' in packet has empty value.",
                                qPrintable(arg_name));
                 }
-                args[arg_name] = arg_value;
+                args[dAmnAtom::intern(arg_name)] = pooledArg(arg_name, arg_value);
                 arg_name = QString();
                 arg_value = QString();
 
@@ -134,7 +164,7 @@ dAmnPacket* dAmnPacketParser::parsePacket(QByteArray* raw)
     }
 
     dAmnPacket* packet = new dAmnPacket(this->session,
-                                        cmd, param, data);
+                                        dAmnAtom::intern(cmd), dAmnAtom::share(param), data);
     packet->setArgs(args);
 
     return packet;
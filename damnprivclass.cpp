@@ -18,113 +18,148 @@
 */
 
 #include "damnprivclass.h"
-#include "damnpacketparser.h"
 #include "damnchatroom.h"
 
 #include <QString>
-#include <QStringList>
-#include <QTextStream>
+#include <QStringRef>
+#include <QLatin1String>
+#include <algorithm>
+
+namespace
+{
+    struct PrivName
+    {
+        const char* name;
+        dAmnPrivClass::KnownPrivs priv;
+    };
+
+    const PrivName privNames[] =
+    {
+#       define KPRIV(name) { #name, dAmnPrivClass::name },
+        KPRIV(join) KPRIV(title) KPRIV(topic) KPRIV(kick) KPRIV(msg) KPRIV(shownotice) KPRIV(admin)
+        KPRIV(images) KPRIV(smilies) KPRIV(emoticons) KPRIV(thumbs) KPRIV(avatars) KPRIV(websites) KPRIV(objects)
+        KPRIV(order)
+#       undef KPRIV
+    };
+}
 
 dAmnPrivClass::dAmnPrivClass(dAmnChatroom* parent)
-    : QObject(parent)
+    : QObject(parent), _order(0), _slot(0), _usercount(0)
 {
+    this->clearPrivs();
 }
 
 dAmnPrivClass::dAmnPrivClass(dAmnChatroom* parent, const QString& name, uint order)
-    : QObject(parent), _name(name), _order(order)
+    : QObject(parent), _name(name), _order(order), _slot(0), _usercount(0)
 {
-    this->setObjectName(this->_name);
+    this->setObjectName(name);
+    this->clearPrivs();
 }
 
 dAmnPrivClass::dAmnPrivClass(dAmnChatroom* parent, const QString& command)
-    : QObject(parent)
+    : QObject(parent), _order(0), _slot(0), _usercount(0)
 {
     int pos = command.indexOf(' ');
     //this->setObjectName(command.mid(0, pos));
-    this->_name = command.mid(0, pos);
-    this->setObjectName(this->_name);
+    this->_name = dAmnAtom(command.mid(0, pos));
+    this->setObjectName(this->_name.toString());
 
+    this->clearPrivs();
     this->apply(command.mid(pos));
 }
 
-void dAmnPrivClass::apply(QString commands)
+void dAmnPrivClass::apply(const QString& commands)
 {
-    QTextStream parser (&commands);
+    const int size = commands.size();
+    int pos = 0;
 
-    while(!parser.atEnd())
+    for(;;)
     {
-        QString command;
-        parser >> command;
+        while(pos < size && commands.at(pos).isSpace())
+            ++pos;
+        if(pos == size)
+            break;
+
+        int start = pos;
+        while(pos < size && !commands.at(pos).isSpace())
+            ++pos;
 
-        QString priv;
+        QStringRef priv;
         int value;
 
-        switch(command[0].toLatin1())
+        switch(commands.at(start).toLatin1())
         {
         case '+':
-            priv = command.mid(1);
+            priv = commands.midRef(start + 1, pos - start - 1);
             value = 1;
         break;
         case '-':
-            priv = command.mid(1);
+            priv = commands.midRef(start + 1, pos - start - 1);
             value = 0;
         break;
 
         default:
-            QPair<QString, QString> pair = dAmnPacketParser::splitPair(command);
-            priv = pair.first;
-            value = pair.second.toInt();
+            QStringRef command = commands.midRef(start, pos - start);
+            int eq = command.indexOf('=');
+            priv = commands.midRef(start, eq < 0 ? pos - start : eq);
+            value = eq < 0 ? 0 : commands.midRef(start + eq + 1, pos - start - eq - 1).toInt();
         }
 
-        switch(getPriv(priv))
-        {
-        case join:      this->_joinpriv = value;        break;
-		case topic:		this->_topicpriv = value;       break;
-        case title:     this->_titlepriv = value;       break;
-        case kick:      this->_kickpriv = value;        break;
-        case msg:       this->_msgpriv = value;         break;
-        case shownotice:this->_shownoticepriv = value;  break;
-        case admin:     this->_adminpriv = value;       break;
-        case images:    this->_imagespriv = value;      break;
-        case smilies:   this->_smiliespriv = value;     break;
-        case emoticons: this->_emoticonspriv = value;   break;
-        case thumbs:    this->_thumbspriv = value;      break;
-        case avatars:   this->_avatarspriv = value;     break;
-        case websites:  this->_websitespriv = value;    break;
-        case objects:   this->_objectspriv = value;     break;
-        case order:     this->_order = (uint) value;    break;
-		case unknown: default: qt_noop();
-        }
+        this->setPriv(getPriv(priv), value);
     }
-}
 
-QHash<QString, dAmnPrivClass::KnownPrivs> dAmnPrivClass::_kpriv_map;
+    if(dAmnChatroom* room = this->chatroom())
+        room->updateSlotPrivs(this);
+}
 
-void dAmnPrivClass::initKPriv()
+dAmnPrivClass::KnownPrivs dAmnPrivClass::getPriv(const QStringRef& privname)
 {
-#   define KPRIV(name) _kpriv_map[#name] = name;
-    KPRIV(join) KPRIV(title) KPRIV(kick) KPRIV(msg) KPRIV(shownotice) KPRIV(admin)
-    KPRIV(images) KPRIV(smilies) KPRIV(emoticons) KPRIV(thumbs) KPRIV(avatars) KPRIV(websites) KPRIV(objects)
-    KPRIV(order)
-#   undef KPRIV
+    for(const PrivName* p = privNames; p != privNames + sizeof privNames / sizeof *privNames; ++p)
+        if(privname == QLatin1String(p->name))
+            return p->priv;
+
+    return unknown;
 }
 
-dAmnPrivClass::KnownPrivs dAmnPrivClass::getPriv(QString privname)
+void dAmnPrivClass::clearPrivs()
 {
-    if(_kpriv_map.isEmpty())
-        initKPriv();
+    this->_privs = 0;
+    std::fill_n(this->_limits, objects - images + 1, 0);
+}
 
-    return _kpriv_map[privname];
+void dAmnPrivClass::setPriv(KnownPrivs priv, int value)
+{
+    switch(priv)
+    {
+    case order:
+        this->_order = (uint) value;
+        return;
+    case images: case smilies: case emoticons: case thumbs: case avatars: case websites: case objects:
+        this->_limits[priv - images] = qBound(-0x8000, value, 0x7FFF);
+        // fall through
+    case join: case title: case topic: case kick: case msg: case shownotice: case admin:
+        if(value)
+            this->_privs |= 1 << priv;
+        else
+            this->_privs &= ~(1 << priv);
+        return;
+    case unknown: default: qt_noop();
+    }
 }
 
 const QString& dAmnPrivClass::name() const
+{
+    return this->_name.toString();
+}
+
+dAmnAtom dAmnPrivClass::atom() const
 {
     return this->_name;
 }
 
 void dAmnPrivClass::setName(const QString& name)
 {
-    this->_name = name;
+    this->_name = dAmnAtom(name);
 }
 
 uint dAmnPrivClass::orderValue() const
@@ -137,32 +172,52 @@ void dAmnPrivClass::setOrderValue(uint order)
     this->_order = order;
 }
 
-const QSet<dAmnUser*>& dAmnPrivClass::users() const
+dAmnChatroom* dAmnPrivClass::chatroom() const
+{
+    return qobject_cast<dAmnChatroom*>(this->parent());
+}
+
+QList<dAmnUser*> dAmnPrivClass::users() const
 {
-    return this->_users;
+    return this->chatroom()->members(this);
 }
 
-bool dAmnPrivClass::joinPriv() const { return this->_joinpriv; }
-bool dAmnPrivClass::titlePriv() const { return this->_titlepriv; }
-bool dAmnPrivClass::kickPriv() const { return this->_kickpriv; }
-bool dAmnPrivClass::msgPriv() const { return this->_msgpriv; }
-bool dAmnPrivClass::showNoticePriv() const { return this->_shownoticepriv; }
-bool dAmnPrivClass::adminPriv() const { return this->_adminpriv; }
+int dAmnPrivClass::userCount() const
+{
+    return this->_usercount;
+}
 
-int dAmnPrivClass::imagesPriv() const { return this->_imagespriv; }
-int dAmnPrivClass::smiliesPriv() const { return this->_smiliespriv; }
-int dAmnPrivClass::emoticonsPriv() const { return this->_emoticonspriv; }
-int dAmnPrivClass::thumbsPriv() const { return this->_thumbspriv; }
-int dAmnPrivClass::avatarsPriv() const { return this->_avatarspriv; }
-int dAmnPrivClass::websitesPriv() const { return this->_websitespriv; }
-int dAmnPrivClass::objectsPriv() const { return this->_objectspriv; }
+quint16 dAmnPrivClass::privs() const
+{
+    return this->_privs;
+}
 
-void dAmnPrivClass::addUser(dAmnUser* user)
+// Whether the privilege is granted, or for numeric ones, non-zero.
+bool dAmnPrivClass::can(KnownPrivs priv) const
 {
-    this->_users.insert(user);
+    return priv != unknown && priv != order && (this->_privs & (1 << priv));
 }
 
-void dAmnPrivClass::removeUser(dAmnUser* user)
+int dAmnPrivClass::limit(KnownPrivs priv) const
 {
-    this->_users.remove(user);
+    if(priv >= images && priv <= objects)
+        return this->_limits[priv - images];
+
+    return this->can(priv);
 }
+
+bool dAmnPrivClass::joinPriv() const { return this->can(join); }
+bool dAmnPrivClass::titlePriv() const { return this->can(title); }
+bool dAmnPrivClass::topicPriv() const { return this->can(topic); }
+bool dAmnPrivClass::kickPriv() const { return this->can(kick); }
+bool dAmnPrivClass::msgPriv() const { return this->can(msg); }
+bool dAmnPrivClass::showNoticePriv() const { return this->can(shownotice); }
+bool dAmnPrivClass::adminPriv() const { return this->can(admin); }
+
+int dAmnPrivClass::imagesPriv() const { return this->_limits[images - images]; }
+int dAmnPrivClass::smiliesPriv() const { return this->_limits[smilies - images]; }
+int dAmnPrivClass::emoticonsPriv() const { return this->_limits[emoticons - images]; }
+int dAmnPrivClass::thumbsPriv() const { return this->_limits[thumbs - images]; }
+int dAmnPrivClass::avatarsPriv() const { return this->_limits[avatars - images]; }
+int dAmnPrivClass::websitesPriv() const { return this->_limits[websites - images]; }
+int dAmnPrivClass::objectsPriv() const { return this->_limits[objects - images]; }
@@ -21,10 +21,11 @@
 #define DAMNPRIVCLASS_H
 
 #include <QObject>
-#include <QHash>
-#include <QSet>
+#include <QString>
+#include <QList>
 
 #include "mnlib_global.h"
+#include "damnatom.h"
 
 class dAmnChatroom;
 class dAmnUser;
@@ -33,14 +34,7 @@ class MNLIBSHARED_EXPORT dAmnPrivClass : public QObject
 {
     Q_OBJECT
 
-    QString _name;
-
-    uint _order;
-
-    bool _joinpriv, _titlepriv, _topicpriv, _kickpriv, _msgpriv, _shownoticepriv, _adminpriv;
-    int _imagespriv, _smiliespriv, _emoticonspriv, _thumbspriv, _avatarspriv, _websitespriv, _objectspriv;
-
-    QSet<dAmnUser*> _users;
+    friend class dAmnChatroom;
 
 public:
     enum KnownPrivs
@@ -51,22 +45,44 @@ public:
     };
 
 private:
-    static QHash<QString, KnownPrivs> _kpriv_map;
-    static void initKPriv();
-    static KnownPrivs getPriv(QString privname);
+    dAmnAtom _name;
+
+    uint _order;
+
+    // Membership lives in the chatroom; we only keep the slot our new members
+    // go to there and a head count.
+    quint8 _slot;
+    int _usercount;
+
+    // One bit per privilege, indexed by KnownPrivs: set for the boolean ones
+    // that are granted and for the numeric ones that aren't zero. The numeric
+    // values themselves are in _limits, starting from images.
+    quint16 _privs;
+    qint16 _limits[objects - images + 1];
+
+    static KnownPrivs getPriv(const QStringRef& privname);
+    void clearPrivs();
+    void setPriv(KnownPrivs priv, int value);
 
 public:
     dAmnPrivClass(dAmnChatroom* parent);
     dAmnPrivClass(dAmnChatroom* parent, const QString& name, uint order);
     dAmnPrivClass(dAmnChatroom* parent, const QString& command);
 
-    void apply(QString command);
+    void apply(const QString& commands);
 
     const QString& name() const;
+    dAmnAtom atom() const;
     void setName(const QString& name);
     uint orderValue() const;
     void setOrderValue(uint order);
-    const QSet<dAmnUser*>& users() const;
+    dAmnChatroom* chatroom() const;
+    QList<dAmnUser*> users() const;
+    int userCount() const;
+
+    quint16 privs() const;
+    bool can(KnownPrivs priv) const;
+    int limit(KnownPrivs priv) const;
 
     bool joinPriv() const;
     bool titlePriv() const;
@@ -83,9 +99,6 @@ public:
     int avatarsPriv() const;
     int websitesPriv() const;
     int objectsPriv() const;
-
-    void addUser(dAmnUser* user);
-    void removeUser(dAmnUser* user);
 };
 
 #endif // DAMNPRIVCLASS_H
@@ -0,0 +1,853 @@
+﻿/*
+    This file is part of
+    amnlib - A C++ library for deviantART Message Network
+    Copyright © 2013 Carl Tessier <http://drfrankenstein90.deviantart.com/>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "damnprotocolcore.h"
+#include "damnatom.h"
+
+#include <QSet>
+
+// Packets are a command line, "cmd param", then name=value argument lines,
+// then, after an empty line, a body which may be a packet of its own. Each
+// one ends with a '\0'. Commands and argument names are pooled in dAmnAtom;
+// params and the users named by u, by and s share the pooled names of rooms
+// and users we hold, if any.
+
+namespace
+{
+    bool isNameArg(const QString& name)
+    {
+        return name == QLatin1String("u") || name == QLatin1String("by")
+            || name == QLatin1String("s");
+    }
+
+    // One "key=value" line of a member's properties, as found in the members
+    // property and after a join.
+    void readProperty(const QStringRef& key, const QString& value,
+                      dAmnProtocolCore::User& user, QString& privclass)
+    {
+        if(key == QLatin1String("pc")) privclass = value;
+        else if(key == QLatin1String("usericon")) user.usericon = value.toInt();
+        else if(key == QLatin1String("symbol"))
+            user.symbol = value.isEmpty() ? QChar(QChar::Null) : value.at(0);
+        else if(key == QLatin1String("realname")) user.realname = value;
+        else if(key == QLatin1String("typename")) user.type_name = value;
+        else if(key == QLatin1String("gpc")) user.gpc = value;
+        else
+            MNLIB_WARN("Unknown user property %s = %s for %s",
+                       qPrintable(key.toString()), qPrintable(value), qPrintable(user.name));
+    }
+
+    void readProperties(const QString& text, dAmnProtocolCore::User& user, QString& privclass)
+    {
+        int line = 0;
+        while(line < text.size())
+        {
+            int eol = text.indexOf('\n', line);
+            if(eol < 0)
+                eol = text.size();
+
+            const int equals = text.indexOf('=', line);
+            if(equals > line && equals < eol)
+                readProperty(text.midRef(line, equals - line),
+                             text.mid(equals + 1, eol - equals - 1), user, privclass);
+
+            line = eol + 1;
+        }
+    }
+}
+
+int dAmnProtocolCore::Room::order(const QString& privclass) const
+{
+    foreach(const Privclass& pc, this->privclasses)
+        if(pc.name == privclass)
+            return pc.order;
+
+    return -1;
+}
+
+// Where the members of a removed privclass go; empty if there's no such
+// privclass, and they leave.
+QString dAmnProtocolCore::Room::defaultPrivclass() const
+{
+    foreach(const Privclass& pc, this->privclasses)
+        if(pc.order == 25)
+            return pc.name;
+
+    return QString();
+}
+
+bool dAmnProtocolCore::Packet::isNull() const
+{
+    return this->command.isEmpty();
+}
+
+QString dAmnProtocolCore::Packet::arg(const QString& name) const
+{
+    return this->args.value(name);
+}
+
+dAmnProtocolCore::Packet dAmnProtocolCore::Packet::subPacket() const
+{
+    return parse(this->body);
+}
+
+QString dAmnProtocolCore::Packet::toString() const
+{
+    QString text = this->command;
+    if(!this->param.isEmpty())
+        text.append(' ').append(this->param);
+    text.append('\n');
+
+    for(QHash<QString, QString>::const_iterator it = this->args.constBegin(); it != this->args.constEnd(); ++it)
+        text.append(it.key()).append('=').append(it.value()).append('\n');
+
+    if(!this->body.isEmpty())
+        text.append('\n').append(this->body);
+
+    return text;
+}
+
+QByteArray dAmnProtocolCore::Packet::toByteArray() const
+{
+    QByteArray frame = this->toString().toUtf8();
+    frame.append('\0');
+    return frame;
+}
+
+// A null packet if there's no command.
+dAmnProtocolCore::Packet dAmnProtocolCore::Packet::parse(const QString& text)
+{
+    Packet packet;
+
+    int eol = text.indexOf('\n');
+    if(eol < 0)
+        eol = text.size();
+
+    const int space = text.indexOf(' ');
+    if(space >= 0 && space < eol)
+    {
+        packet.command = dAmnAtom::intern(text.left(space));
+        packet.param = dAmnAtom::share(text.mid(space + 1, eol - space - 1));
+    }
+    else
+        packet.command = dAmnAtom::intern(text.left(eol));
+
+    if(packet.command.isEmpty())
+        return Packet();
+
+    int pos = eol + 1;
+    while(pos < text.size())
+    {
+        eol = text.indexOf('\n', pos);
+        if(eol < 0)
+            eol = text.size();
+
+        if(eol == pos)
+        {   // the empty line before the body
+            ++pos;
+            break;
+        }
+
+        const int equals = text.indexOf('=', pos);
+        if(equals <= pos || equals > eol)
+            break;  // not an argument; take the rest as the body
+
+        const QString name = dAmnAtom::intern(text.mid(pos, equals - pos));
+        const QString value = text.mid(equals + 1, eol - equals - 1);
+        packet.args.insert(name, isNameArg(name) ? dAmnAtom::share(value) : value);
+        pos = eol + 1;
+    }
+
+    if(pos < text.size())
+        packet.body = text.mid(pos);
+
+    return packet;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+dAmnProtocolCore::dAmnProtocolCore(const QString& username, const QByteArray& token, const QString& agent)
+    : _username(username), _agent(agent), _token(token),
+      _state(disconnected), _tracking(true), _inputPos(0)
+{
+}
+
+dAmnProtocolCore::State dAmnProtocolCore::state() const
+{
+    return this->_state;
+}
+
+const QString& dAmnProtocolCore::userName() const
+{
+    return this->_username;
+}
+
+void dAmnProtocolCore::setAgent(const QString& agent)
+{
+    this->_agent = agent;
+}
+
+bool dAmnProtocolCore::tracking() const
+{
+    return this->_tracking;
+}
+
+void dAmnProtocolCore::setTracking(bool enabled)
+{
+    this->_tracking = enabled;
+}
+
+// Turning it off forgets the room's members, and the users in no other room;
+// turning it back on, they come back with the next members property.
+void dAmnProtocolCore::setTracking(const QString& room, bool enabled)
+{
+    QHash<dAmnName, Room>::iterator it = this->_rooms.find(dAmnName(room));
+    if(it == this->_rooms.end() || it->tracking == enabled)
+        return;
+
+    it->tracking = enabled;
+    if(!enabled)
+        this->dropMembers(*it);
+}
+
+// Call once the transport is connected; the handshake goes out.
+void dAmnProtocolCore::connectionOpened()
+{
+    this->_input.clear();
+    this->_inputPos = 0;
+    this->_state = handshaking;
+
+    Packet packet;
+    packet.command = "dAmnClient";
+    packet.param = DAMN_VERSION;
+    packet.args.insert("agent", this->_agent);
+    this->send(packet);
+}
+
+// Rooms are kept, to be joined again on the next connection.
+void dAmnProtocolCore::connectionClosed()
+{
+    this->_input.clear();
+    this->_inputPos = 0;
+    this->_state = disconnected;
+}
+
+// Nothing is parsed until nextEvent() asks for it, pings included, so drain
+// the events after each feed().
+void dAmnProtocolCore::feed(const QByteArray& bytes)
+{
+    this->_input.append(bytes);
+}
+
+bool dAmnProtocolCore::hasOutput() const
+{
+    return !this->_output.isEmpty();
+}
+
+QByteArray dAmnProtocolCore::takeOutput()
+{
+    QByteArray output;
+    output.swap(this->_output);
+    return output;
+}
+
+bool dAmnProtocolCore::nextEvent(Event& event)
+{
+    while(this->_events.isEmpty())
+    {
+        const int end = this->_input.indexOf('\0', this->_inputPos);
+        if(end < 0)
+        {   // Keep only the partial frame, for the next feed().
+            this->_input.remove(0, this->_inputPos);
+            this->_inputPos = 0;
+            return false;
+        }
+
+        const int start = this->_inputPos;
+        this->_inputPos = end + 1;
+        this->handle(this->_input.mid(start, end - start));
+    }
+
+    event = this->_events.dequeue();
+    return true;
+}
+
+void dAmnProtocolCore::handle(const QByteArray& raw)
+{
+    Event event;
+    event.packet = Packet::parse(QString::fromUtf8(raw.constData(), raw.size()));
+    event.raw = raw;
+    event.ok = true;
+    event.type = other;
+
+    const Packet& packet = event.packet;
+    if(packet.isNull())
+    {
+        MNLIB_WARN("Dropped a packet without a command.");
+        return;
+    }
+
+    const QString& cmd = packet.command;
+    if(cmd == "dAmnServer")
+    {
+        event.type = handshake;
+        event.ok = packet.param == DAMN_VERSION;
+        if(!event.ok)
+        {
+            event.reason = "version mismatch";
+            this->_state = closed;
+        }
+        else if(this->_state == handshaking)
+        {
+            Packet login;
+            login.command = "login";
+            login.param = this->_username;
+            login.args.insert("pk", QString::fromLatin1(this->_token));
+            this->send(login);
+            this->_state = loggingIn;
+        }
+    }
+    else if(cmd == "login")
+    {
+        event.type = loggedIn;
+        event.ok = packet.arg("e") == "ok";
+        event.reason = packet.arg("e");
+        if(event.ok)
+        {
+            this->_username = packet.param;
+            this->_state = online;
+        }
+        else
+            this->_state = closed;
+    }
+    else if(cmd == "join")
+    {
+        event.type = joined;
+        event.room = packet.param;
+        event.ok = packet.arg("e") == "ok";
+        event.reason = packet.arg("e");
+        if(event.ok)
+            this->trackJoined(event.room);
+    }
+    else if(cmd == "part")
+    {
+        event.type = parted;
+        event.room = packet.param;
+        event.ok = packet.arg("e") == "ok";
+        event.reason = packet.args.contains("r") ? packet.arg("r") : packet.arg("e");
+        if(event.ok)
+            this->trackParted(event.room);
+    }
+    else if(cmd == "kicked")
+    {
+        event.type = kicked;
+        event.room = packet.param;
+        event.reason = packet.body;
+        this->trackParted(event.room);
+    }
+    else if(cmd == "property")
+    {
+        if(packet.param.startsWith("login:"))
+            event.type = whois;
+        else
+        {
+            event.type = property;
+            event.room = packet.param;
+            this->trackProperty(event.room, packet);
+        }
+    }
+    else if(cmd == "recv")
+    {
+        event.type = recv;
+        event.room = packet.param;
+        this->trackRecv(event.room, packet, event.changes);
+    }
+    else if(cmd == "ping")
+    {
+        event.type = ping;
+        this->pong();
+    }
+    else if(cmd == "disconnect")
+    {
+        event.type = disconnect;
+        event.reason = packet.arg("e");
+        this->_state = closed;
+    }
+    else if(cmd == "send" || cmd == "kick" || cmd == "get" || cmd == "set" || cmd == "kill")
+    {
+        event.type = error;
+        event.ok = false;
+        event.room = packet.param;
+        event.reason = packet.arg("e");
+    }
+
+    this->_events.enqueue(event);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// A frame of the caller's own making, '\0' included.
+void dAmnProtocolCore::send(const QByteArray& frame)
+{
+    this->_output.append(frame);
+}
+
+void dAmnProtocolCore::send(const Packet& packet)
+{
+    this->_output.append(packet.toByteArray());
+}
+
+void dAmnProtocolCore::roomCommand(const QString& room, const QString& command, const QString& param,
+                                   const QString& body, const QString& argname, const QString& argvalue)
+{
+    Packet inner;
+    inner.command = command;
+    inner.param = param;
+    inner.body = body;
+    if(!argname.isEmpty())
+        inner.args.insert(argname, argvalue);
+
+    Packet packet;
+    packet.command = "send";
+    packet.param = room;
+    packet.body = inner.toString();
+    this->send(packet);
+}
+
+void dAmnProtocolCore::join(const QString& room)
+{
+    Packet packet;
+    packet.command = "join";
+    packet.param = room;
+    this->send(packet);
+}
+void dAmnProtocolCore::part(const QString& room)
+{
+    Packet packet;
+    packet.command = "part";
+    packet.param = room;
+    this->send(packet);
+}
+
+void dAmnProtocolCore::say(const QString& room, const QString& text)
+{
+    this->roomCommand(room, "msg", "main", text);
+}
+void dAmnProtocolCore::act(const QString& room, const QString& text)
+{
+    this->roomCommand(room, "action", "main", text);
+}
+void dAmnProtocolCore::npmsg(const QString& room, const QString& text)
+{
+    this->roomCommand(room, "npmsg", "main", text);
+}
+
+void dAmnProtocolCore::promote(const QString& room, const QString& user, const QString& privclass)
+{
+    this->roomCommand(room, "promote", user, privclass);
+}
+void dAmnProtocolCore::demote(const QString& room, const QString& user, const QString& privclass)
+{
+    this->roomCommand(room, "demote", user, privclass);
+}
+
+void dAmnProtocolCore::kick(const QString& room, const QString& user, const QString& reason)
+{
+    Packet packet;
+    packet.command = "kick";
+    packet.param = room;
+    packet.args.insert("u", user);
+    packet.body = reason;
+    this->send(packet);
+}
+
+void dAmnProtocolCore::ban(const QString& room, const QString& user)
+{
+    this->roomCommand(room, "ban", user, QString());
+}
+void dAmnProtocolCore::unban(const QString& room, const QString& user)
+{
+    this->roomCommand(room, "unban", user, QString());
+}
+
+void dAmnProtocolCore::getProperty(const QString& room, const QString& property)
+{
+    Packet packet;
+    packet.command = "get";
+    packet.param = room;
+    packet.args.insert("p", property);
+    this->send(packet);
+}
+void dAmnProtocolCore::setProperty(const QString& room, const QString& property, const QString& value)
+{
+    Packet packet;
+    packet.command = "set";
+    packet.param = room;
+    packet.args.insert("p", property);
+    packet.body = value;
+    this->send(packet);
+}
+
+void dAmnProtocolCore::admin(const QString& room, const QString& command)
+{
+    this->roomCommand(room, "admin", QString(), command);
+}
+
+void dAmnProtocolCore::requestWhois(const QString& user)
+{
+    this->getProperty(QString("login:%1").arg(user), "info");
+}
+
+void dAmnProtocolCore::kill(const QString& user, const QString& reason)
+{
+    Packet packet;
+    packet.command = "kill";
+    packet.param = QString("login:%1").arg(user);
+    packet.body = reason;
+    this->send(packet);
+}
+
+void dAmnProtocolCore::pong()
+{
+    Packet packet;
+    packet.command = "pong";
+    this->send(packet);
+}
+
+void dAmnProtocolCore::quit()
+{
+    Packet packet;
+    packet.command = "quit";
+    this->send(packet);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+QStringList dAmnProtocolCore::rooms() const
+{
+    QStringList ids;
+    foreach(const dAmnName& id, this->_rooms.keys())
+        ids.append(id.toString());
+    return ids;
+}
+
+const dAmnProtocolCore::Room* dAmnProtocolCore::room(const QString& id) const
+{
+    QHash<dAmnName, Room>::const_iterator it = this->_rooms.constFind(dAmnName(id));
+    return it == this->_rooms.constEnd() ? NULL : &*it;
+}
+
+const dAmnProtocolCore::User* dAmnProtocolCore::user(const QString& name) const
+{
+    return this->user(dAmnName(name));
+}
+
+const dAmnProtocolCore::User* dAmnProtocolCore::user(const dAmnName& name) const
+{
+    QHash<dAmnName, User>::const_iterator it = this->_users.constFind(name);
+    return it == this->_users.constEnd() ? NULL : &*it;
+}
+
+int dAmnProtocolCore::userCount() const
+{
+    return this->_users.size();
+}
+
+// Rejoining a room we kept keeps what we knew of it.
+void dAmnProtocolCore::trackJoined(const QString& id)
+{
+    const dAmnName key (id);
+    if(this->_rooms.contains(key))
+        return;
+
+    Room room;
+    room.tracking = this->_tracking;
+    this->_rooms.insert(key, room);
+}
+
+void dAmnProtocolCore::trackParted(const QString& id)
+{
+    QHash<dAmnName, Room>::iterator it = this->_rooms.find(dAmnName(id));
+    if(it == this->_rooms.end())
+        return;
+
+    this->dropMembers(*it);
+    this->_rooms.erase(it);
+}
+
+void dAmnProtocolCore::trackProperty(const QString& id, const Packet& packet)
+{
+    QHash<dAmnName, Room>::iterator room = this->_rooms.find(dAmnName(id));
+    if(room == this->_rooms.end())
+        return;
+
+    const QString p = packet.arg("p");
+    if(p == "title")
+        room->title = packet.body;
+    else if(p == "topic")
+        room->topic = packet.body;
+    else if(p == "privclasses")
+    {
+        room->privclasses.clear();
+        int line = 0;
+        while(line < packet.body.size())
+        {
+            int eol = packet.body.indexOf('\n', line);
+            if(eol < 0)
+                eol = packet.body.size();
+
+            const int colon = packet.body.indexOf(':', line);
+            if(colon > line && colon < eol)
+            {
+                Privclass pc;
+                pc.order = packet.body.midRef(line, colon - line).toString().toInt();
+                pc.name = packet.body.mid(colon + 1, eol - colon - 1);
+                room->privclasses.append(pc);
+            }
+
+            line = eol + 1;
+        }
+
+        // Members of privclasses that are gone wait in the default one until
+        // the members property says where they really are.
+        const QString fallback = room->defaultPrivclass();
+        QSet<QString> gone;
+        foreach(const QString& pc, room->members)
+            if(room->order(pc) < 0)
+                gone.insert(pc);
+        foreach(const QString& pc, gone)
+            this->moveMembers(*room, pc, fallback, NULL);
+    }
+    else if(p == "members" && room->tracking)
+        this->trackMembers(*room, packet.body);
+}
+
+// The members property lists everyone, once per connection. Everyone listed
+// is referenced before those we had are let go, so users who stay aren't
+// dropped in between.
+void dAmnProtocolCore::trackMembers(Room& room, const QString& data)
+{
+    const QList<dAmnName> previous = room.members.keys();
+    room.members.clear();
+
+    User user;
+    QString privclass;
+
+    int line = 0;
+    while(line < data.size())
+    {
+        int eol = data.indexOf('\n', line);
+        if(eol < 0)
+            eol = data.size();
+
+        if(eol - line > 7 && data.midRef(line, 7) == QLatin1String("member "))
+        {
+            if(!user.name.isEmpty())
+                this->addMember(room, user.name, privclass, user, NULL);
+
+            user = User();
+            privclass.clear();
+            user.name = dAmnAtom::share(data.mid(line + 7, eol - line - 7));
+        }
+        else if(!user.name.isEmpty())
+        {
+            const int equals = data.indexOf('=', line);
+            if(equals > line && equals < eol)
+                readProperty(data.midRef(line, equals - line),
+                             data.mid(equals + 1, eol - equals - 1), user, privclass);
+        }
+
+        line = eol + 1;
+    }
+
+    if(!user.name.isEmpty())
+        this->addMember(room, user.name, privclass, user, NULL);
+
+    foreach(const dAmnName& gone, previous)
+        this->releaseUser(gone);
+}
+
+void dAmnProtocolCore::trackRecv(const QString& id, const Packet& packet, QList<Change>& changes)
+{
+    QHash<dAmnName, Room>::iterator room = this->_rooms.find(dAmnName(id));
+    if(room == this->_rooms.end())
+        return;
+
+    const Packet sub = packet.subPacket();
+    if(sub.command == "admin")
+    {
+        const QString name = sub.arg("name");
+        if(sub.param == "create" || sub.param == "update")
+        {
+            int order = room->order(name);
+            foreach(const QString& priv, sub.arg("privs").split(' '))
+                if(priv.startsWith("order="))
+                    order = priv.mid(6).toInt();
+
+            QList<Privclass>::iterator it = room->privclasses.begin();
+            while(it != room->privclasses.end() && it->name != name)
+                ++it;
+            if(it == room->privclasses.end())
+            {
+                Privclass pc;
+                pc.name = name;
+                room->privclasses.append(pc);
+                it = room->privclasses.end() - 1;
+            }
+            it->order = qMax(order, 0);
+        }
+        else if(sub.param == "rename" || sub.param == "move")
+        {
+            const QString prev = sub.arg("prev");
+            if(sub.param == "rename" && room->order(name) < 0)
+            {   // Nobody changes privclass; only its name does.
+                for(QList<Privclass>::iterator it = room->privclasses.begin(); it != room->privclasses.end(); ++it)
+                    if(it->name == prev)
+                        it->name = name;
+                this->moveMembers(*room, prev, name, NULL);
+            }
+            else    // renamed over an existing privclass; that's a move
+                this->moveMembers(*room, prev, name, &changes);
+        }
+        else if(sub.param == "remove")
+        {
+            for(QList<Privclass>::iterator it = room->privclasses.begin(); it != room->privclasses.end(); )
+                it = it->name == name ? room->privclasses.erase(it) : it + 1;
+            this->moveMembers(*room, name, room->defaultPrivclass(), &changes);
+        }
+        return;
+    }
+
+    if(!room->tracking)
+        return;
+
+    if(sub.command == "join")
+    {
+        User user;
+        QString privclass;
+        user.name = sub.param;
+        readProperties(sub.body, user, privclass);
+        this->addMember(*room, sub.param, privclass, user, &changes);
+    }
+    else if(sub.command == "part" || sub.command == "kicked")
+        this->removeMember(*room, sub.param, &changes);
+    else if(sub.command == "privchg")
+    {
+        QHash<dAmnName, QString>::iterator member = room->members.find(dAmnName(sub.param));
+        if(member == room->members.end() || *member == sub.arg("pc"))
+            return;
+
+        Change change;
+        change.user = sub.param;
+        change.before = *member;
+        change.after = sub.arg("pc");
+        changes.append(change);
+        *member = change.after;
+    }
+}
+
+void dAmnProtocolCore::addMember(Room& room, const QString& name, const QString& privclass,
+                                 const User& props, QList<Change>* changes)
+{
+    const dAmnName key (name);
+    QHash<dAmnName, QString>::iterator member = room.members.find(key);
+
+    User& user = this->_users[key];
+    const int rooms = user.rooms + (member == room.members.end() ? 1 : 0);
+    user = props;
+    user.rooms = rooms;
+
+    if(changes && (member == room.members.end() || *member != privclass))
+    {
+        Change change;
+        change.user = name;
+        change.before = member == room.members.end() ? QString() : *member;
+        change.after = privclass;
+        changes->append(change);
+    }
+
+    room.members.insert(key, privclass);
+}
+
+void dAmnProtocolCore::removeMember(Room& room, const QString& name, QList<Change>* changes)
+{
+    const dAmnName key (name);
+    QHash<dAmnName, QString>::iterator member = room.members.find(key);
+    if(member == room.members.end())
+        return;
+
+    if(changes)
+    {
+        Change change;
+        change.user = name;
+        change.before = *member;
+        changes->append(change);
+    }
+
+    room.members.erase(member);
+    this->releaseUser(key);
+}
+
+// Moving to no privclass at all means leaving.
+void dAmnProtocolCore::moveMembers(Room& room, const QString& from, const QString& to, QList<Change>* changes)
+{
+    if(from == to)
+        return;
+
+    QList<dAmnName> gone;
+    for(QHash<dAmnName, QString>::iterator it = room.members.begin(); it != room.members.end(); ++it)
+    {
+        if(it.value() != from)
+            continue;
+
+        if(changes)
+        {
+            Change change;
+            change.user = this->_users.value(it.key()).name;
+            change.before = from;
+            change.after = to;
+            changes->append(change);
+        }
+
+        if(to.isEmpty())
+            gone.append(it.key());
+        else
+            it.value() = to;
+    }
+
+    foreach(const dAmnName& name, gone)
+    {
+        room.members.remove(name);
+        this->releaseUser(name);
+    }
+}
+
+void dAmnProtocolCore::dropMembers(Room& room)
+{
+    foreach(const dAmnName& name, room.members.keys())
+        this->releaseUser(name);
+    room.members.clear();
+}
+
+void dAmnProtocolCore::releaseUser(const dAmnName& name)
+{
+    QHash<dAmnName, User>::iterator it = this->_users.find(name);
+    if(it != this->_users.end() && --it->rooms <= 0)
+        this->_users.erase(it);
+}
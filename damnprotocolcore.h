@@ -0,0 +1,200 @@
+﻿/*
+    This file is part of
+    amnlib - A C++ library for deviantART Message Network
+    Copyright © 2013 Carl Tessier <http://drfrankenstein90.deviantart.com/>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DAMNPROTOCOLCORE_H
+#define DAMNPROTOCOLCORE_H
+
+#include "mnlib_global.h"
+#include "damnname.h"
+
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QQueue>
+
+// The dAmn protocol without any I/O: bytes read from the connection go in
+// through feed(), bytes to write come out of takeOutput(), and what happened
+// comes out of nextEvent(). Nothing here is a QObject or needs an event loop,
+// so any loop can drive it, one core per connection.
+//
+// The core answers the handshake and pings by itself, and keeps the rooms it
+// is in along with their privclasses, title and topic, their members unless
+// tracking is turned off, and the users in any of them. Frames are parsed
+// one at a time, as nextEvent() gets to them, so what the core knows is
+// always as of the event last handed out.
+class MNLIBSHARED_EXPORT dAmnProtocolCore
+{
+public:
+    enum State
+    {
+        disconnected, handshaking, loggingIn, online, closed
+    };
+
+    struct MNLIBSHARED_EXPORT Packet
+    {
+        QString command, param, body;
+        QHash<QString, QString> args;
+
+        bool isNull() const;
+        QString arg(const QString& name) const;
+        Packet subPacket() const;
+        QString toString() const;       // without the terminating '\0'
+        QByteArray toByteArray() const;
+
+        static Packet parse(const QString& text);
+    };
+
+    enum EventType
+    {
+        handshake,      // ok unless the server speaks another version
+        loggedIn,       // ok, or reason says why not
+        joined, parted, kicked,
+        property,       // room property, packet.arg("p") says which
+        whois,
+        recv,           // packet.subPacket() is what happened in room
+        ping,
+        disconnect,
+        error,          // a command of ours was refused
+        other
+    };
+
+    struct MNLIBSHARED_EXPORT Change
+    {
+        QString user, before, after;    // privclass names; empty when not a member
+    };
+
+    struct MNLIBSHARED_EXPORT Event
+    {
+        EventType type;
+        bool ok;
+        QString room, reason;
+        Packet packet;
+        QByteArray raw;
+        QList<Change> changes;          // what a recv did to the room's members
+    };
+
+    struct MNLIBSHARED_EXPORT User
+    {
+        QString name, realname, type_name, gpc;
+        QChar symbol;
+        int usericon;
+        int rooms;      // how many of our rooms they're in
+
+        User() : usericon(0), rooms(0) {}
+    };
+
+    struct MNLIBSHARED_EXPORT Privclass
+    {
+        QString name;
+        int order;
+    };
+
+    struct MNLIBSHARED_EXPORT Room
+    {
+        QString title, topic;
+        QList<Privclass> privclasses;       // as listed
+        QHash<dAmnName, QString> members;   // privclass of each
+        bool tracking;                      // whether members are kept
+
+        Room() : tracking(true) {}
+
+        int order(const QString& privclass) const;      // -1 if there's no such privclass
+        QString defaultPrivclass() const;
+    };
+
+private:
+    QString _username, _agent;
+    QByteArray _token;
+    State _state;
+    bool _tracking;
+
+    QByteArray _input, _output;
+    int _inputPos;                      // where the next frame starts
+    QQueue<Event> _events;
+
+    QHash<dAmnName, Room> _rooms;       // by id string, "chat:Botdom"
+    QHash<dAmnName, User> _users;
+
+public:
+    dAmnProtocolCore(const QString& username, const QByteArray& token, const QString& agent = QString());
+
+    State state() const;
+    const QString& userName() const;
+    void setAgent(const QString& agent);
+    // Whether rooms joined from now on keep their members, and whether room does.
+    bool tracking() const;
+    void setTracking(bool enabled);
+    void setTracking(const QString& room, bool enabled);
+
+    // Transport
+    void connectionOpened();
+    void connectionClosed();
+    void feed(const QByteArray& bytes);
+    bool hasOutput() const;
+    QByteArray takeOutput();
+    bool nextEvent(Event& event);
+
+    // Commands
+    void send(const QByteArray& frame);
+    void send(const Packet& packet);
+    void join(const QString& room);
+    void part(const QString& room);
+    void say(const QString& room, const QString& text);
+    void act(const QString& room, const QString& text);
+    void npmsg(const QString& room, const QString& text);
+    void promote(const QString& room, const QString& user, const QString& privclass = QString());
+    void demote(const QString& room, const QString& user, const QString& privclass = QString());
+    void kick(const QString& room, const QString& user, const QString& reason = QString());
+    void ban(const QString& room, const QString& user);
+    void unban(const QString& room, const QString& user);
+    void getProperty(const QString& room, const QString& property);
+    void setProperty(const QString& room, const QString& property, const QString& value);
+    void admin(const QString& room, const QString& command);
+    void requestWhois(const QString& user);
+    void kill(const QString& user, const QString& reason = QString());
+    void pong();
+    void quit();
+
+    // Tracking; pointers stay good until the next nextEvent().
+    QStringList rooms() const;
+    const Room* room(const QString& id) const;
+    const User* user(const QString& name) const;
+    const User* user(const dAmnName& name) const;
+    int userCount() const;
+
+private:
+    void handle(const QByteArray& raw);
+    void trackJoined(const QString& id);
+    void trackParted(const QString& id);
+    void trackProperty(const QString& id, const Packet& packet);
+    void trackRecv(const QString& id, const Packet& packet, QList<Change>& changes);
+    void trackMembers(Room& room, const QString& data);
+    void addMember(Room& room, const QString& name, const QString& privclass,
+                   const User& props, QList<Change>* changes);
+    void removeMember(Room& room, const QString& name, QList<Change>* changes);
+    void moveMembers(Room& room, const QString& from, const QString& to, QList<Change>* changes);
+    void dropMembers(Room& room);
+    void releaseUser(const dAmnName& name);
+    void roomCommand(const QString& room, const QString& command, const QString& param,
+                     const QString& body, const QString& argname = QString(), const QString& argvalue = QString());
+};
+
+#endif // DAMNPROTOCOLCORE_H
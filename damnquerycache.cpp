@@ -0,0 +1,391 @@
+﻿/*
+    This file is part of
+    amnlib - A C++ library for deviantART Message Network
+    Copyright © 2013 Carl Tessier <http://drfrankenstein90.deviantart.com/>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "damnquerycache.h"
+#include "damnpacket.h"
+#include "events.h"
+
+#include <QMetaObject>
+#include <QPair>
+
+#include <algorithm>
+
+dAmnQueryCache::dAmnQueryCache(dAmnSession* session)
+    : QObject(session), _session(session),
+      _whoisTtl(60000), _propertyTtl(30000), _capacity(defaultCapacity),
+      _replaying(false), _hits(0), _misses(0), _merged(0)
+{
+    this->_clock.start();
+
+    connect(session, SIGNAL(gotWhois(WhoisEvent)), this, SLOT(handleWhois(WhoisEvent)));
+    connect(session, SIGNAL(gotProperty(PropertyEvent)), this, SLOT(handleProperty(PropertyEvent)));
+    connect(session, SIGNAL(getError(GetError)), this, SLOT(handleGetError(GetError)));
+
+    connect(session, SIGNAL(join(JoinEvent)), this, SLOT(handleJoin(JoinEvent)));
+    connect(session, SIGNAL(part(PartEvent)), this, SLOT(handlePart(PartEvent)));
+    connect(session, SIGNAL(kick(KickEvent)), this, SLOT(handleKick(KickEvent)));
+    connect(session, SIGNAL(privChg(PrivchgEvent)), this, SLOT(handlePrivchg(PrivchgEvent)));
+    connect(session, SIGNAL(privUpdate(PrivUpdateEvent)), this, SLOT(handlePrivUpdate(PrivUpdateEvent)));
+    connect(session, SIGNAL(privMove(PrivMoveEvent)), this, SLOT(handlePrivMove(PrivMoveEvent)));
+    connect(session, SIGNAL(privRemove(PrivRemoveEvent)), this, SLOT(handlePrivRemove(PrivRemoveEvent)));
+
+    connect(session, SIGNAL(joined(JoinedEvent)), this, SLOT(handleJoined(JoinedEvent)));
+    connect(session, SIGNAL(parted(PartedEvent)), this, SLOT(handleParted(PartedEvent)));
+    connect(session, SIGNAL(kicked(KickedEvent)), this, SLOT(handleKicked(KickedEvent)));
+
+    connect(session, SIGNAL(stateChange(dAmnSession::State)),
+            this, SLOT(handleStateChange(dAmnSession::State)));
+}
+
+dAmnQueryCache::~dAmnQueryCache()
+{
+}
+
+dAmnSession* dAmnQueryCache::session() const
+{
+    return this->_session;
+}
+
+int dAmnQueryCache::ttl(dAmnRequest::Kind kind) const
+{
+    switch(kind)
+    {
+    case dAmnRequest::whois:    return this->_whoisTtl;
+    case dAmnRequest::get:      return this->_propertyTtl;
+    default:                    return 0;
+    }
+}
+
+void dAmnQueryCache::setTtl(dAmnRequest::Kind kind, int msecs)
+{
+    switch(kind)
+    {
+    case dAmnRequest::whois:
+        this->_whoisTtl = qMax(msecs, 0);
+        break;
+    case dAmnRequest::get:
+        this->_propertyTtl = qMax(msecs, 0);
+        break;
+    default:
+        MNLIB_WARN("Only whois and get answers are cached.");
+        return;
+    }
+
+    if(msecs <= 0)
+    {   // Forget what we won't use anymore.
+        const QString prefix = dAmnRequestTable::key(kind, QString());
+        foreach(const QString& key, this->_entries.keys())
+            if(key.startsWith(prefix))
+                this->remove(key);
+    }
+}
+
+int dAmnQueryCache::capacity() const
+{
+    return this->_capacity;
+}
+
+void dAmnQueryCache::setCapacity(int entries)
+{
+    this->_capacity = qMax(entries, 1);
+    if(this->_entries.size() > this->_capacity)
+        this->sweep();
+}
+
+bool dAmnQueryCache::lookup(dAmnRequest::Kind kind, const QString& target, const dAmnRequest& request)
+{
+    const QString key = dAmnRequestTable::key(kind, target);
+    const qint64 now = this->_clock.elapsed();
+
+    auto it = this->_entries.find(key);
+    if(it != this->_entries.end())
+    {
+        if(now - it->stored < this->ttl(kind))
+        {
+            this->_hits++;
+            it->used = now;
+            if(this->_replays.isEmpty())
+                QMetaObject::invokeMethod(this, "replay", Qt::QueuedConnection);
+            Replay replay;
+            replay.kind = kind;
+            replay.answer = it->answer;
+            replay.request = request;
+            this->_replays.append(replay);
+            return true;
+        }
+
+        this->remove(key);
+    }
+
+    auto asked = this->_inflight.constFind(key);
+    if(asked != this->_inflight.constEnd() && now - asked.value() < inflightTimeout)
+    {
+        this->_merged++;
+        return true;
+    }
+
+    this->_misses++;
+    this->_inflight.insert(key, now);
+    return false;
+}
+
+dAmnRequest dAmnQueryCache::pending(dAmnRequest::Kind kind, const QString& target) const
+{
+    return this->_pending.value(dAmnRequestTable::key(kind, target));
+}
+
+void dAmnQueryCache::setPending(dAmnRequest::Kind kind, const QString& target, const dAmnRequest& request)
+{
+    this->_pending.insert(dAmnRequestTable::key(kind, target), request);
+}
+
+void dAmnQueryCache::invalidate(dAmnRequest::Kind kind, const QString& target)
+{
+    this->remove(dAmnRequestTable::key(kind, target));
+}
+
+void dAmnQueryCache::invalidateUser(const QString& name)
+{
+    this->invalidate(dAmnRequest::whois, QString("login:%1").arg(name));
+}
+
+void dAmnQueryCache::invalidateRoom(const QString& id)
+{
+    const QString prefix = dAmnRequestTable::key(dAmnRequest::get, id + '/');
+    foreach(const QString& key, this->_entries.keys())
+        if(key.startsWith(prefix))
+            this->remove(key);
+}
+
+void dAmnQueryCache::clear()
+{
+    this->_entries.clear();
+}
+
+int dAmnQueryCache::size() const
+{
+    return this->_entries.size();
+}
+
+int dAmnQueryCache::hits() const
+{
+    return this->_hits;
+}
+
+int dAmnQueryCache::misses() const
+{
+    return this->_misses;
+}
+
+int dAmnQueryCache::merged() const
+{
+    return this->_merged;
+}
+
+void dAmnQueryCache::replay()
+{
+    QList<Replay> replays;
+    replays.swap(this->_replays);
+
+    this->_replaying = true;
+    foreach(const Replay& replay, replays)
+        this->deliver(replay);
+    this->_replaying = false;
+}
+
+void dAmnQueryCache::deliver(const Replay& replay)
+{
+    if(replay.request.id() != 0)
+    {   // Whoever asked may have given up since.
+        dAmnRequestTable* table = this->_session->requests();
+        if(!table->isPending(replay.request.id()))
+            return;
+
+        dAmnResult result;
+        result.status = dAmnResult::ok;
+        result.data = replay.answer;
+        table->finish(replay.request.id(), result);
+        return;
+    }
+
+    // Whois and property answers are both property packets.
+    dAmnPacket packet (this->_session, "property", replay.answer.param, replay.answer.data);
+    packet.setArgs(replay.answer.args);
+
+    if(replay.kind == dAmnRequest::whois)
+        emit this->_session->gotWhois(WhoisEvent(this->_session, packet));
+    else
+        emit this->_session->gotProperty(PropertyEvent(this->_session, packet));
+}
+
+void dAmnQueryCache::store(dAmnRequest::Kind kind, const QString& target, dAmnPacket& packet)
+{
+    const QString key = dAmnRequestTable::key(kind, target);
+    this->settle(key);
+
+    // What we replay ourselves is what we already have.
+    if(this->_replaying || this->ttl(kind) <= 0)
+        return;
+
+    Entry entry;
+    entry.answer = dAmnEventData::fromPacket(packet);
+    entry.stored = entry.used = this->_clock.elapsed();
+    this->_entries.insert(key, entry);
+
+    if(this->_entries.size() > this->_capacity)
+        this->sweep();
+}
+
+void dAmnQueryCache::settle(const QString& key)
+{
+    this->_inflight.remove(key);
+    this->_pending.remove(key);
+}
+
+void dAmnQueryCache::remove(const QString& key)
+{
+    this->_entries.remove(key);
+}
+
+void dAmnQueryCache::sweep()
+{
+    const qint64 now = this->_clock.elapsed();
+    const QString whois = dAmnRequestTable::key(dAmnRequest::whois, QString());
+
+    for(auto it = this->_entries.begin(); it != this->_entries.end();)
+    {
+        const int ttl = it.key().startsWith(whois) ? this->_whoisTtl : this->_propertyTtl;
+        if(now - it->stored >= ttl)
+            it = this->_entries.erase(it);
+        else
+            ++it;
+    }
+
+    // Answers that never came aren't waited for anymore either.
+    for(auto it = this->_inflight.begin(); it != this->_inflight.end();)
+    {
+        if(now - it.value() >= inflightTimeout)
+        {
+            this->_pending.remove(it.key());
+            it = this->_inflight.erase(it);
+        }
+        else
+            ++it;
+    }
+
+    if(this->_entries.size() <= this->_capacity)
+        return;
+
+    // Still full of live answers; drop the least recently used down to
+    // three quarters, so the next few stores don't sweep again.
+    QList<QPair<qint64, QString> > byUse;
+    byUse.reserve(this->_entries.size());
+    for(auto it = this->_entries.constBegin(); it != this->_entries.constEnd(); ++it)
+        byUse.append(qMakePair(it->used, it.key()));
+    std::sort(byUse.begin(), byUse.end());
+
+    const int excess = this->_entries.size() - this->_capacity * 3 / 4;
+    for(int i = 0; i < excess; i++)
+        this->_entries.remove(byUse.at(i).second);
+}
+
+void dAmnQueryCache::handleWhois(const WhoisEvent& event)
+{
+    this->store(dAmnRequest::whois, event.packet().param(), event.packet());
+}
+
+void dAmnQueryCache::handleProperty(const PropertyEvent& event)
+{
+    this->store(dAmnRequest::get,
+                QString("%1/%2").arg(event.packet().param(), event.propertyString()),
+                event.packet());
+}
+
+void dAmnQueryCache::handleGetError(const GetError& error)
+{
+    const QString param = error.packet().param();
+    if(param.startsWith("login:"))
+        this->settle(dAmnRequestTable::key(dAmnRequest::whois, param));
+    else
+        this->settle(dAmnRequestTable::key(dAmnRequest::get, QString("%1/%2").arg(param, error.propertyName())));
+}
+
+void dAmnQueryCache::handleJoin(const JoinEvent& event)
+{
+    this->invalidateUser(event.userName());
+    this->invalidate(dAmnRequest::get, event.chatroom().toIdString() + "/members");
+}
+
+void dAmnQueryCache::handlePart(const PartEvent& event)
+{
+    this->invalidateUser(event.userName());
+    this->invalidate(dAmnRequest::get, event.chatroom().toIdString() + "/members");
+}
+
+void dAmnQueryCache::handleKick(const KickEvent& event)
+{
+    this->invalidateUser(event.userName());
+    this->invalidate(dAmnRequest::get, event.chatroom().toIdString() + "/members");
+}
+
+void dAmnQueryCache::handlePrivchg(const PrivchgEvent& event)
+{
+    this->invalidateUser(event.userName());
+    this->invalidate(dAmnRequest::get, event.chatroom().toIdString() + "/members");
+}
+
+void dAmnQueryCache::handlePrivUpdate(const PrivUpdateEvent& event)
+{
+    this->invalidateRoom(event.chatroom().toIdString());
+}
+
+void dAmnQueryCache::handlePrivMove(const PrivMoveEvent& event)
+{
+    this->invalidateRoom(event.chatroom().toIdString());
+}
+
+void dAmnQueryCache::handlePrivRemove(const PrivRemoveEvent& event)
+{
+    this->invalidateRoom(event.chatroom().toIdString());
+}
+
+void dAmnQueryCache::handleJoined(const JoinedEvent& event)
+{
+    this->invalidateRoom(event.chatroom().toIdString());
+}
+
+void dAmnQueryCache::handleParted(const PartedEvent& event)
+{
+    this->invalidateRoom(event.chatroom().toIdString());
+}
+
+void dAmnQueryCache::handleKicked(const KickedEvent& event)
+{
+    this->invalidateRoom(event.chatroom().toIdString());
+}
+
+// Nothing asked for before the session dropped will be answered.
+void dAmnQueryCache::handleStateChange(dAmnSession::State state)
+{
+    if(state != dAmnSession::offline)
+        return;
+
+    this->_inflight.clear();
+    this->_pending.clear();
+}
@@ -0,0 +1,143 @@
+﻿/*
+    This file is part of
+    amnlib - A C++ library for deviantART Message Network
+    Copyright © 2013 Carl Tessier <http://drfrankenstein90.deviantart.com/>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DAMNQUERYCACHE_H
+#define DAMNQUERYCACHE_H
+
+#include "mnlib_global.h"
+#include "damnsession.h"
+#include "damnrequest.h"
+#include "damnstrandexecutor.h"
+#include "evtfwd.h"
+
+#include <QObject>
+#include <QString>
+#include <QList>
+#include <QHash>
+#include <QElapsedTimer>
+
+// Remembers whois and room property answers for a while, so asking again
+// is answered from memory rather than by the server, and something already
+// asked for is only asked once until its answer arrives. Answers from memory
+// arrive a pass of the event loop later and only go to whoever asked: the
+// request that looked them up, or else the session's gotWhois() or
+// gotProperty(). Rooms and the rest of the session never see them again.
+//
+// A user's whois is forgotten when they join, part, get kicked or change
+// privclass anywhere; a room's members when anyone does so there; and all of
+// a room's properties when we join or leave it, or its privclasses change.
+//
+// Answers nobody asks for again are swept out once they expire, and past
+// capacity() the least recently used ones go first, so asking about many
+// different users doesn't grow the cache without end.
+class MNLIBSHARED_EXPORT dAmnQueryCache : public QObject
+{
+    Q_OBJECT
+
+    struct Entry
+    {
+        dAmnEventData answer;   // the property packet that answered
+        qint64 stored;          // on _clock
+        qint64 used;            // on _clock; last looked up or stored
+    };
+
+    struct Replay
+    {
+        dAmnRequest::Kind kind;
+        dAmnEventData answer;
+        dAmnRequest request;    // none for plain whois() and getProperty()
+    };
+
+    dAmnSession* _session;
+    QHash<QString, Entry> _entries;         // by key
+    QHash<QString, qint64> _inflight;       // by key; when it was asked for
+    QHash<QString, dAmnRequest> _pending;   // by key; handed to whoever else asks
+    int _whoisTtl, _propertyTtl;
+    int _capacity;
+    QElapsedTimer _clock;
+
+    QList<Replay> _replays;
+    bool _replaying;
+
+    int _hits, _misses, _merged;
+
+public:
+    static const int inflightTimeout = 30000;   // msecs an answer is waited for
+    static const int defaultCapacity = 1024;    // answers remembered at most
+
+    explicit dAmnQueryCache(dAmnSession* session);
+    ~dAmnQueryCache();
+
+    dAmnSession* session() const;
+
+    // Only whois and get are cached; 0 turns caching a kind off.
+    int ttl(dAmnRequest::Kind kind) const;
+    void setTtl(dAmnRequest::Kind kind, int msecs);
+
+    int capacity() const;
+    void setCapacity(int entries);
+
+    // True when the answer is remembered, and on its way to request or the
+    // session's signals, or already asked for; the caller only asks the
+    // server when it's false.
+    bool lookup(dAmnRequest::Kind kind, const QString& target, const dAmnRequest& request = dAmnRequest());
+
+    dAmnRequest pending(dAmnRequest::Kind kind, const QString& target) const;
+    void setPending(dAmnRequest::Kind kind, const QString& target, const dAmnRequest& request);
+
+    void invalidate(dAmnRequest::Kind kind, const QString& target);
+    void invalidateUser(const QString& name);
+    void invalidateRoom(const QString& id);
+    void clear();
+
+    int size() const;
+    int hits() const;
+    int misses() const;
+    int merged() const;
+
+private slots:
+    void replay();
+
+    void handleWhois(const WhoisEvent& event);
+    void handleProperty(const PropertyEvent& event);
+    void handleGetError(const GetError& error);
+
+    void handleJoin(const JoinEvent& event);
+    void handlePart(const PartEvent& event);
+    void handleKick(const KickEvent& event);
+    void handlePrivchg(const PrivchgEvent& event);
+    void handlePrivUpdate(const PrivUpdateEvent& event);
+    void handlePrivMove(const PrivMoveEvent& event);
+    void handlePrivRemove(const PrivRemoveEvent& event);
+
+    void handleJoined(const JoinedEvent& event);
+    void handleParted(const PartedEvent& event);
+    void handleKicked(const KickedEvent& event);
+
+    void handleStateChange(dAmnSession::State state);
+
+private:
+    void store(dAmnRequest::Kind kind, const QString& target, dAmnPacket& packet);
+    void deliver(const Replay& replay);
+    void settle(const QString& key);
+    void remove(const QString& key);
+    void sweep();
+};
+
+#endif // DAMNQUERYCACHE_H
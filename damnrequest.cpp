@@ -0,0 +1,308 @@
+﻿/*
+    This file is part of
+    amnlib - A C++ library for deviantART Message Network
+    Copyright © 2013 Carl Tessier <http://drfrankenstein90.deviantart.com/>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "damnrequest.h"
+#include "damnpacket.h"
+
+dAmnResult::dAmnResult()
+    : status(cancelled)
+{
+    this->data.command = dAmnPacket::unknown;
+    this->data.received = 0;
+}
+
+bool dAmnResult::isOk() const
+{
+    return this->status == ok;
+}
+
+dAmnRequest::dAmnRequest()
+    : _table(NULL), _id(0)
+{
+}
+
+dAmnRequest::dAmnRequest(dAmnRequestTable* table, quint64 id)
+    : _table(table), _id(id)
+{
+}
+
+quint64 dAmnRequest::id() const
+{
+    return this->_id;
+}
+
+bool dAmnRequest::isPending() const
+{
+    return this->_table && this->_table->isPending(this->_id);
+}
+
+void dAmnRequest::then(const std::function<void(const dAmnResult&)>& callback) const
+{
+    if(this->_table)
+        this->_table->then(this->_id, callback);
+}
+
+void dAmnRequest::cancel() const
+{
+    if(this->_table)
+        this->_table->cancel(this->_id);
+}
+
+dAmnRequestTable::dAmnRequestTable(dAmnSession* session)
+    : QObject(session), _session(session), _nextId(1), _timeout(30000)
+{
+    this->_clock.start();
+    this->_timer.setSingleShot(true);
+
+    connect(&this->_timer, SIGNAL(timeout()), this, SLOT(expire()));
+    connect(session, SIGNAL(stateChange(dAmnSession::State)),
+            this, SLOT(handleStateChange(dAmnSession::State)));
+}
+
+// The session cancels what's left while it's still whole; see ~dAmnSession().
+dAmnRequestTable::~dAmnRequestTable()
+{
+}
+
+dAmnSession* dAmnRequestTable::session() const
+{
+    return this->_session;
+}
+
+int dAmnRequestTable::timeout() const
+{
+    return this->_timeout;
+}
+
+void dAmnRequestTable::setTimeout(int msecs)
+{
+    this->_timeout = qMax(msecs, 1);
+}
+
+QString dAmnRequestTable::key(dAmnRequest::Kind kind, const QString& target)
+{
+    return QString::number(kind).append(' ').append(target.toLower());
+}
+
+// Targets are room id strings for join and part, "login:" and the name for
+// whois and kill, and the room id string, a slash and the property or user
+// name for get, set and kick.
+dAmnRequest dAmnRequestTable::add(dAmnRequest::Kind kind, const QString& target)
+{
+    const quint64 id = this->_nextId++;
+
+    Entry& entry = this->_entries[id];
+    entry.key = key(kind, target);
+    entry.deadline = this->_clock.elapsed() + this->_timeout;
+    entry.stillborn = this->_session->state() != dAmnSession::online;
+    this->_byKey[entry.key].append(id);
+
+    // Deadlines only grow, so a running timer is already due first.
+    if(entry.stillborn)
+        this->_timer.start(0);
+    else if(!this->_timer.isActive())
+        this->schedule();
+
+    return dAmnRequest(this, id);
+}
+
+bool dAmnRequestTable::isPending(quint64 id) const
+{
+    return this->_entries.contains(id);
+}
+
+int dAmnRequestTable::outstanding() const
+{
+    return this->_entries.size();
+}
+
+void dAmnRequestTable::then(quint64 id, const Callback& callback)
+{
+    if(!this->_entries.contains(id))
+    {
+        MNLIB_WARN("Request %llu is not pending anymore.", id);
+        return;
+    }
+
+    this->_entries[id].callbacks.append(callback);
+}
+
+void dAmnRequestTable::cancel(quint64 id)
+{
+    if(!this->_entries.contains(id))
+        return;
+
+    dAmnResult result;
+    result.status = dAmnResult::cancelled;
+    result.error = "cancelled";
+    this->finish(id, result);
+}
+
+void dAmnRequestTable::cancelAll(const QString& reason)
+{
+    dAmnResult result;
+    result.status = dAmnResult::cancelled;
+    result.error = reason;
+
+    // Callbacks may make new requests; those stay.
+    foreach(quint64 id, this->_entries.keys())
+        if(this->_entries.contains(id))
+            this->finish(id, result);
+}
+
+void dAmnRequestTable::match(dAmnPacket& packet)
+{
+    if(this->_entries.isEmpty())
+        return;
+
+    const QString param = packet.param();
+    const bool login = param.startsWith("login:");
+
+    switch(packet.command())
+    {
+    case dAmnPacket::join:
+        this->answer(dAmnRequest::join, param, packet, packet);
+        break;
+    case dAmnPacket::part:
+        this->answer(dAmnRequest::part, param, packet, packet);
+        break;
+    case dAmnPacket::property:
+        if(login)
+            this->answer(dAmnRequest::whois, param, packet, packet);
+        else
+        {   // A set is answered by the next update of the property.
+            const QString target = param + '/' + packet.arg("p");
+            this->answer(dAmnRequest::get, target, packet, packet);
+            this->answer(dAmnRequest::set, target, packet, packet);
+        }
+        break;
+    case dAmnPacket::get:
+        if(login)
+            this->answer(dAmnRequest::whois, param, packet, packet);
+        else
+            this->answer(dAmnRequest::get, param + '/' + packet.arg("p"), packet, packet);
+        break;
+    case dAmnPacket::set:
+        this->answer(dAmnRequest::set, param + '/' + packet.arg("p"), packet, packet);
+        break;
+    case dAmnPacket::kick:
+        this->answer(dAmnRequest::kick, param + '/' + packet.arg("u"), packet, packet);
+        break;
+    case dAmnPacket::kill:
+        this->answer(dAmnRequest::kill, param, packet, packet);
+        break;
+    case dAmnPacket::recv:
+    {
+        dAmnPacket& sub = packet.subPacket();
+        if(sub.command() == dAmnPacket::kicked)
+            this->answer(dAmnRequest::kick, param + '/' + sub.param(), sub, packet);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+// Settles the oldest request waiting on this kind and target, by the e= of
+// status; data is what the result carries.
+void dAmnRequestTable::answer(dAmnRequest::Kind kind, const QString& target, dAmnPacket& status, dAmnPacket& data)
+{
+    auto it = this->_byKey.constFind(key(kind, target));
+    if(it == this->_byKey.constEnd())
+        return;
+
+    const quint64 id = it->first();
+    const QString e = status.arg("e");
+
+    dAmnResult result;
+    result.status = (e.isEmpty() || e == "ok") ? dAmnResult::ok : dAmnResult::failed;
+    if(result.status == dAmnResult::failed)
+        result.error = e;
+    result.data = dAmnEventData::fromPacket(data);
+
+    this->finish(id, result);
+}
+
+void dAmnRequestTable::finish(quint64 id, const dAmnResult& result)
+{
+    const Entry entry = this->_entries.take(id);
+
+    QList<quint64>& queue = this->_byKey[entry.key];
+    queue.removeOne(id);
+    if(queue.isEmpty())
+        this->_byKey.remove(entry.key);
+
+    emit finished(id, result);
+    foreach(const Callback& callback, entry.callbacks)
+        callback(result);
+}
+
+void dAmnRequestTable::expire()
+{
+    const qint64 now = this->_clock.elapsed();
+
+    QList<quint64> stillborn, expired;
+    for(auto it = this->_entries.constBegin(); it != this->_entries.constEnd(); ++it)
+    {
+        if(it->stillborn)
+            stillborn.append(it.key());
+        else if(it->deadline <= now)
+            expired.append(it.key());
+    }
+
+    dAmnResult result;
+    result.status = dAmnResult::cancelled;
+    result.error = "not connected";
+    foreach(quint64 id, stillborn)
+        if(this->_entries.contains(id))
+            this->finish(id, result);
+
+    result.status = dAmnResult::timedOut;
+    result.error = QString("no answer after %1 msecs").arg(this->_timeout);
+    foreach(quint64 id, expired)
+        if(this->_entries.contains(id))
+            this->finish(id, result);
+
+    this->schedule();
+}
+
+void dAmnRequestTable::schedule()
+{
+    if(this->_entries.isEmpty())
+    {
+        this->_timer.stop();
+        return;
+    }
+
+    qint64 next = -1;
+    for(auto it = this->_entries.constBegin(); it != this->_entries.constEnd(); ++it)
+    {
+        const qint64 due = it->stillborn ? 0 : it->deadline;
+        if(next < 0 || due < next)
+            next = due;
+    }
+
+    this->_timer.start(int(qMax<qint64>(next - this->_clock.elapsed(), 0)));
+}
+
+void dAmnRequestTable::handleStateChange(dAmnSession::State state)
+{
+    if(state == dAmnSession::offline)
+        this->cancelAll("disconnected");
+}
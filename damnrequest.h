@@ -0,0 +1,217 @@
+﻿/*
+    This file is part of
+    amnlib - A C++ library for deviantART Message Network
+    Copyright © 2013 Carl Tessier <http://drfrankenstein90.deviantart.com/>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DAMNREQUEST_H
+#define DAMNREQUEST_H
+
+#include "mnlib_global.h"
+#include "damnsession.h"
+#include "damnstrandexecutor.h"
+
+#include <QObject>
+#include <QString>
+#include <QList>
+#include <QHash>
+#include <QPointer>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <functional>
+
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+#   define MNLIB_HAVE_COROUTINES 1
+#   include <coroutine>
+#   include <exception>
+#endif
+
+class dAmnPacket;
+class dAmnRequestTable;
+
+// How a request to the server turned out.
+struct MNLIBSHARED_EXPORT dAmnResult
+{
+    enum Status
+    {
+        ok, failed, timedOut, cancelled
+    };
+
+    Status status;
+    QString error;          // the server's e= when failed, otherwise why not ok
+    dAmnEventData data;     // the packet that answered, if any
+
+    dAmnResult();
+    bool isOk() const;
+};
+
+// A request waiting on the server, as handed out by dAmnSession's *Async()
+// methods. It's only a handle: copies refer to the same request, and once the
+// request is finished they all go stale.
+//
+// Register a callback with then(), listen to dAmnRequestTable::finished(),
+// or, in C++20, co_await it from a coroutine; the result only ever arrives
+// from the event loop, so there's always time to do either.
+class MNLIBSHARED_EXPORT dAmnRequest
+{
+    QPointer<dAmnRequestTable> _table;
+    quint64 _id;
+
+public:
+    enum Kind
+    {
+        join, part, whois, get, set, kick, kill
+    };
+
+    dAmnRequest();
+    dAmnRequest(dAmnRequestTable* table, quint64 id);
+
+    quint64 id() const;
+    bool isPending() const;
+
+    void then(const std::function<void(const dAmnResult&)>& callback) const;
+    void cancel() const;
+
+#ifdef MNLIB_HAVE_COROUTINES
+    class Awaiter;
+    Awaiter operator co_await() const;
+#endif
+};
+
+#ifdef MNLIB_HAVE_COROUTINES
+class dAmnRequest::Awaiter
+{
+    dAmnRequest _request;
+    dAmnResult _result;
+
+public:
+    explicit Awaiter(const dAmnRequest& request)
+        : _request(request)
+    {
+        this->_result.status = dAmnResult::cancelled;
+        this->_result.error = "not pending";
+    }
+
+    bool await_ready() const
+    {
+        return !this->_request.isPending();
+    }
+    void await_suspend(std::coroutine_handle<> handle)
+    {
+        this->_request.then([this, handle](const dAmnResult& result)
+        {
+            this->_result = result;
+            handle.resume();
+        });
+    }
+    dAmnResult await_resume()
+    {
+        return this->_result;
+    }
+};
+
+inline dAmnRequest::Awaiter dAmnRequest::operator co_await() const
+{
+    return Awaiter(*this);
+}
+
+// A coroutine nobody waits for: it starts right away, runs to its first
+// co_await and carries on from the event loop from there.
+//
+//     dAmnTask greet(dAmnSession* session)
+//     {
+//         dAmnResult joined = co_await session->joinAsync("Botdom");
+//         if(joined.isOk())
+//             ...
+//     }
+struct dAmnTask
+{
+    struct promise_type
+    {
+        dAmnTask get_return_object() { return dAmnTask(); }
+        std::suspend_never initial_suspend() noexcept { return std::suspend_never(); }
+        std::suspend_never final_suspend() noexcept { return std::suspend_never(); }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+#endif
+
+// Matches the server's answers, and its errors, to a session's requests by
+// command and target. Several requests for the same thing are answered in
+// the order they were made. Requests that go unanswered for timeout() msecs
+// finish as timed out, and all of them are cancelled when the session drops.
+class MNLIBSHARED_EXPORT dAmnRequestTable : public QObject
+{
+    Q_OBJECT
+
+    friend class dAmnQueryCache;
+
+public:
+    typedef std::function<void(const dAmnResult&)> Callback;
+
+private:
+    struct Entry
+    {
+        QString key;
+        qint64 deadline;        // on _clock
+        bool stillborn;         // made while offline
+        QList<Callback> callbacks;
+    };
+
+    dAmnSession* _session;
+    QHash<quint64, Entry> _entries;
+    QHash<QString, QList<quint64> > _byKey;     // oldest first
+    quint64 _nextId;
+    int _timeout;
+    QElapsedTimer _clock;
+    QTimer _timer;
+
+public:
+    explicit dAmnRequestTable(dAmnSession* session);
+    ~dAmnRequestTable();
+
+    dAmnSession* session() const;
+
+    int timeout() const;
+    void setTimeout(int msecs);
+
+    dAmnRequest add(dAmnRequest::Kind kind, const QString& target);
+    bool isPending(quint64 id) const;
+    int outstanding() const;
+
+    void then(quint64 id, const Callback& callback);
+    void cancel(quint64 id);
+    void cancelAll(const QString& reason);
+
+    void match(dAmnPacket& packet);
+
+    static QString key(dAmnRequest::Kind kind, const QString& target);
+
+signals:
+    void finished(quint64 id, const dAmnResult& result);
+
+private slots:
+    void expire();
+    void handleStateChange(dAmnSession::State state);
+
+private:
+    void answer(dAmnRequest::Kind kind, const QString& target, dAmnPacket& packet, dAmnPacket& data);
+    void finish(quint64 id, const dAmnResult& result);
+    void schedule();
+};
+
+#endif // DAMNREQUEST_H
@@ -0,0 +1,204 @@
+﻿/*
+    This file is part of
+    amnlib - A C++ library for deviantART Message Network
+    Copyright © 2013 Carl Tessier <http://drfrankenstein90.deviantart.com/>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "damnroomhistory.h"
+
+#include "mnlib_global.h"
+
+#include <cstring>
+
+dAmnRoomHistory::dAmnRoomHistory(int maxlines, int maxbytes)
+    : _head(0), _bytes(0), _first(0), _count(0)
+{
+    this->_arena.resize(qMax(0, maxbytes));
+    this->_entries.resize(qMax(0, maxlines));
+}
+
+int dAmnRoomHistory::maxLines() const
+{
+    return this->_entries.size();
+}
+
+int dAmnRoomHistory::maxBytes() const
+{
+    return this->_arena.size();
+}
+
+void dAmnRoomHistory::setLimits(int maxlines, int maxbytes)
+{
+    maxlines = qMax(0, maxlines);
+    maxbytes = qMax(0, maxbytes);
+    if(maxlines == this->maxLines() && maxbytes == this->maxBytes())
+        return;
+
+    // replay the old contents into fresh storage; the oldest lines fall out
+    // on their own if they no longer fit.
+    QByteArray arena = this->_arena;
+    QVector<Entry> entries;
+    entries.reserve(this->_count);
+    for(int i = 0; i < this->_count; ++i)
+        entries.append(this->entry(i));
+
+    this->_arena = QByteArray(maxbytes, '\0');
+    this->_entries = QVector<Entry>(maxlines);
+    this->_head = this->_bytes = this->_first = this->_count = 0;
+
+    foreach(const Entry& e, entries)
+        this->append(Kind(e.kind), this->_senders.at(e.sender),
+                     QByteArray::fromRawData(arena.constData() + e.position % arena.size(), e.size),
+                     e.timestamp);
+}
+
+void dAmnRoomHistory::append(Kind kind, const QString& sender, const QByteArray& tablumps, qint64 timestamp)
+{
+    int capacity = this->_arena.size();
+    if(this->_entries.isEmpty() || capacity == 0)
+        return;
+
+    int size = tablumps.size();
+    if(size > capacity)
+    {
+        MNLIB_DEBUG("history line of %d bytes truncated to %d", size, capacity);
+        size = capacity;
+    }
+
+    if(this->_count == this->_entries.size())
+        this->dropOldest();
+
+    // positions only ever grow, so the lines whose bytes are about to be
+    // overwritten are always a run of the oldest ones: those that start more
+    // than a full arena before the end of the new line.
+    qint64 start = this->_head;
+    if(start % capacity + size > capacity)
+        start += capacity - start % capacity;
+
+    while(this->_count > 0)
+    {
+        const Entry& oldest = this->entry(0);
+        if(oldest.position >= start + size - capacity)
+            break;
+
+        this->dropOldest();
+    }
+
+    if(size > 0)
+        std::memcpy(this->_arena.data() + start % capacity, tablumps.constData(), size);
+
+    Entry& e = this->_entries[(this->_first + this->_count) % this->_entries.size()];
+    e.timestamp = timestamp;
+    e.position = start;
+    e.size = size;
+    e.sender = this->senderId(sender);
+    e.kind = kind;
+
+    ++this->_count;
+    this->_bytes += size;
+    this->_head = start + size;
+}
+
+void dAmnRoomHistory::clear()
+{
+    this->_head = this->_bytes = this->_first = this->_count = 0;
+    this->_senders.clear();
+    this->_senderIds.clear();
+}
+
+int dAmnRoomHistory::count() const
+{
+    return this->_count;
+}
+
+int dAmnRoomHistory::bytes() const
+{
+    return this->_bytes;
+}
+
+dAmnRoomHistory::Line dAmnRoomHistory::at(int index) const
+{
+    const Entry& e = this->entry(index);
+
+    Line line;
+    line.kind = Kind(e.kind);
+    line.sender = e.sender;
+    line.timestamp = e.timestamp;
+    line.data = this->_arena.constData() + e.position % this->_arena.size();
+    line.size = e.size;
+    return line;
+}
+
+const QString& dAmnRoomHistory::senderName(quint32 sender) const
+{
+    return this->_senders.at(sender);
+}
+
+QString dAmnRoomHistory::text(const Line& line) const
+{
+    return QString::fromUtf8(line.data, line.size);
+}
+
+const dAmnRoomHistory::Entry& dAmnRoomHistory::entry(int index) const
+{
+    Q_ASSERT(index >= 0 && index < this->_count);
+    return this->_entries.at((this->_first + index) % this->_entries.size());
+}
+
+void dAmnRoomHistory::dropOldest()
+{
+    this->_bytes -= this->_entries.at(this->_first).size;
+    this->_first = (this->_first + 1) % this->_entries.size();
+    --this->_count;
+}
+
+quint32 dAmnRoomHistory::senderId(const QString& sender)
+{
+    QHash<QString, quint32>::const_iterator it = this->_senderIds.constFind(sender);
+    if(it != this->_senderIds.constEnd())
+        return it.value();
+
+    // names of people who scrolled out are kept until there are clearly
+    // more of them than of lines; then the table is rebuilt from the lines.
+    if(this->_senders.size() >= 64 && this->_senders.size() > 2 * this->_entries.size())
+        this->compactSenders();
+
+    quint32 id = this->_senders.size();
+    this->_senders.append(sender);
+    this->_senderIds.insert(sender, id);
+    return id;
+}
+
+void dAmnRoomHistory::compactSenders()
+{
+    QVector<QString> senders;
+    QVector<quint32> remap(this->_senders.size(), quint32(-1));
+    this->_senderIds.clear();
+
+    for(int i = 0; i < this->_count; ++i)
+    {
+        Entry& e = this->_entries[(this->_first + i) % this->_entries.size()];
+        if(remap[e.sender] == quint32(-1))
+        {
+            remap[e.sender] = senders.size();
+            this->_senderIds.insert(this->_senders.at(e.sender), senders.size());
+            senders.append(this->_senders.at(e.sender));
+        }
+        e.sender = remap[e.sender];
+    }
+
+    this->_senders = senders;
+}
@@ -0,0 +1,104 @@
+﻿/*
+    This file is part of
+    amnlib - A C++ library for deviantART Message Network
+    Copyright © 2013 Carl Tessier <http://drfrankenstein90.deviantart.com/>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DAMNROOMHISTORY_H
+#define DAMNROOMHISTORY_H
+
+#include "mnlib_global.h"
+
+#include <QString>
+#include <QByteArray>
+#include <QVector>
+#include <QHash>
+
+// Recent messages and actions of a chatroom, bounded both by line count and
+// by the bytes of text kept. The raw tablumps of every line live in a single
+// circular arena; lines only record where theirs are, who sent them and when.
+//
+// Lines are handed out as views into the arena. Reading them doesn't
+// allocate, but a view is only good until the next append().
+class MNLIBSHARED_EXPORT dAmnRoomHistory
+{
+public:
+    enum Kind
+    {
+        message, action
+    };
+
+    struct Line
+    {
+        Kind kind;
+        quint32 sender;         // see senderName()
+        qint64 timestamp;       // msecs since the epoch
+        const char* data;       // raw tablumps, UTF-8, not null-terminated
+        int size;
+    };
+
+private:
+    struct Entry
+    {
+        qint64 timestamp;
+        qint64 position;        // in bytes ever written, gaps included
+        quint32 size, sender;
+        quint8 kind;
+    };
+
+    QByteArray _arena;
+    qint64 _head;               // position of the next line's bytes
+    int _bytes;
+
+    QVector<Entry> _entries;    // circular, _first is the oldest
+    int _first, _count;
+
+    QVector<QString> _senders;
+    QHash<QString, quint32> _senderIds;
+
+public:
+    dAmnRoomHistory(int maxlines, int maxbytes);
+
+    int maxLines() const;
+    int maxBytes() const;
+    void setLimits(int maxlines, int maxbytes);
+
+    void append(Kind kind, const QString& sender, const QByteArray& tablumps, qint64 timestamp);
+    void clear();
+
+    int count() const;
+    int bytes() const;
+    Line at(int index) const;   // 0 is the oldest line
+    const QString& senderName(quint32 sender) const;
+    QString text(const Line& line) const;
+
+    // Calls visit(const Line&) on the last n lines, oldest first.
+    template <typename Visitor> void visitLast(int n, Visitor visit) const
+    {
+        for(int i = qMax(0, this->_count - n); i < this->_count; ++i)
+            visit(this->at(i));
+    }
+
+private:
+    const Entry& entry(int index) const;
+    void dropOldest();
+    quint32 senderId(const QString& sender);
+    void compactSenders();
+};
+
+Q_DECLARE_TYPEINFO(dAmnRoomHistory::Line, Q_PRIMITIVE_TYPE);
+
+#endif // DAMNROOMHISTORY_H
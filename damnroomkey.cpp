@@ -0,0 +1,100 @@
+﻿/*
+    This file is part of
+    amnlib - A C++ library for deviantART Message Network
+    Copyright © 2013 Carl Tessier <http://drfrankenstein90.deviantart.com/>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "damnroomkey.h"
+#include "damnchatroom.h"
+
+namespace
+{
+    const QString nullString;
+}
+
+bool dAmnRoomKey::isPrivate() const
+{
+    return this->d && this->d->pchat;
+}
+
+const QString& dAmnRoomKey::idString() const
+{
+    return this->d ? this->d->idString.toString() : nullString;
+}
+
+const QString& dAmnRoomKey::toString() const
+{
+    return this->d ? this->d->displayString : nullString;
+}
+
+const QString& dAmnRoomKey::name() const
+{
+    return this->d ? this->d->name.toString() : nullString;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+dAmnRoomKeyRegistry::dAmnRoomKeyRegistry()
+{
+}
+
+dAmnRoomKeyRegistry::~dAmnRoomKeyRegistry()
+{
+    qDeleteAll(this->_data);
+}
+
+dAmnRoomKey dAmnRoomKeyRegistry::find(const QString& idstring) const
+{
+    return dAmnRoomKey(this->_keys.value(dAmnName(idstring)));
+}
+
+dAmnRoomKey dAmnRoomKeyRegistry::key(const dAmnChatroomIdentifier& id)
+{
+    const dAmnName idstring (id.toIdString());
+
+    if(const dAmnRoomKey::Data* known = this->_keys.value(idstring))
+        return dAmnRoomKey(known);
+
+    dAmnRoomKey::Data* data = new dAmnRoomKey::Data;
+    data->idString = dAmnAtom(idstring.toString());
+    data->displayString = dAmnAtom::share(id.toString());   // a pchat's is a username
+    data->name = dAmnAtom(id.name);
+    data->hash = idstring.hash();
+    data->pchat = id.type == dAmnChatroom::pchat;
+
+    this->_data.append(data);
+    this->_keys.insert(idstring, data);
+
+    return dAmnRoomKey(data);
+}
+
+dAmnRoomKey dAmnRoomKeyRegistry::key(const QString& idstring, const dAmnChatroomIdentifier& id)
+{
+    const dAmnName alias (idstring);
+    if(const dAmnRoomKey::Data* known = this->_keys.value(alias))
+        return dAmnRoomKey(known);
+
+    dAmnRoomKey key = this->key(id);
+    if(!dAmnName::equals(idstring, key.idString()))
+        this->_keys.insert(alias, key.d);
+
+    return key;
+}
+
+int dAmnRoomKeyRegistry::count() const
+{
+    return this->_data.size();
+}
@@ -0,0 +1,100 @@
+﻿/*
+    This file is part of
+    amnlib - A C++ library for deviantART Message Network
+    Copyright © 2013 Carl Tessier <http://drfrankenstein90.deviantart.com/>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DAMNROOMKEY_H
+#define DAMNROOMKEY_H
+
+#include "mnlib_global.h"
+#include "damnname.h"
+#include "damnatom.h"
+
+#include <QString>
+#include <QHash>
+#include <QList>
+
+struct dAmnChatroomIdentifier;
+
+// A chatroom as a session knows it, made once per room by the session's
+// dAmnRoomKeyRegistry. It keeps the id string used in packets, the name shown
+// to users and the case-folded hash of the former, so sending to a room or
+// finding it again allocates nothing. Keys are compared by identity and stay
+// valid as long as their registry.
+class MNLIBSHARED_EXPORT dAmnRoomKey
+{
+    friend class dAmnRoomKeyRegistry;
+
+    struct Data
+    {
+        dAmnAtom idString;      // chat:Botdom, pchat:alice:bob
+        QString displayString;  // #Botdom, or the other user
+        dAmnAtom name;          // Botdom, or the other user
+        uint hash;
+        bool pchat;
+    };
+
+    const Data* d;
+
+    explicit dAmnRoomKey(const Data* data) : d(data) {}
+
+public:
+    dAmnRoomKey() : d(NULL) {}
+
+    bool isNull() const { return this->d == NULL; }
+    bool isPrivate() const;
+    const QString& idString() const;
+    const QString& toString() const;
+    const QString& name() const;
+    uint hash() const { return this->d ? this->d->hash : 0; }
+
+    bool operator ==(const dAmnRoomKey& rhs) const { return this->d == rhs.d; }
+    bool operator !=(const dAmnRoomKey& rhs) const { return this->d != rhs.d; }
+};
+Q_DECLARE_TYPEINFO(dAmnRoomKey, Q_PRIMITIVE_TYPE);
+
+inline uint qHash(const dAmnRoomKey& key)
+{
+    return key.hash();
+}
+
+// Hands out the keys of one session. Rooms are few, so their keys are kept
+// until the session goes, even after leaving them. Room names are
+// case-insensitive, and so are the id strings looked up here.
+class MNLIBSHARED_EXPORT dAmnRoomKeyRegistry
+{
+    Q_DISABLE_COPY(dAmnRoomKeyRegistry)
+
+    QHash<dAmnName, const dAmnRoomKey::Data*> _keys;  // by id string and any alias
+    QList<dAmnRoomKey::Data*> _data;
+
+public:
+    dAmnRoomKeyRegistry();
+    ~dAmnRoomKeyRegistry();
+
+    // The key known by this id string, or a null one. A single hash probe.
+    dAmnRoomKey find(const QString& idstring) const;
+    // The key of a room, made if need be.
+    dAmnRoomKey key(const dAmnChatroomIdentifier& id);
+    // Same, also making the id string as given find the key from now on:
+    // rooms may come spelled differently from how we'd write them.
+    dAmnRoomKey key(const QString& idstring, const dAmnChatroomIdentifier& id);
+
+    int count() const;
+};
+
+#endif // DAMNROOMKEY_H
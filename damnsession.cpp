@@ -20,15 +20,24 @@
 #include "damnsession.h"
 #include "damnpacket.h"
 #include "events.h"
+#include "damnwatchengine.h"
+#include "damnjoinscheduler.h"
+#include "damnstrandexecutor.h"
+#include "damnrequest.h"
+#include "damnquerycache.h"
 
 #include <QHostAddress>
 #include <QRegExp>
 #include <QCoreApplication>
+#include <QThread>
 
 dAmnSession::dAmnSession(const QString& username, const QByteArray& token, QObject* parent)
     : QObject(parent),
-      _state(offline), _packetdevice(this, this->_socket), _socket(this),
-      _username(username), _authtoken(token)
+      _state(offline), _transport(NULL), _core(username, token),
+      _username(username),
+      _userTable(NULL),
+      _watch(NULL), _joins(NULL), _requests(NULL), _cache(NULL), _executor(NULL), _memberTracking(dAmnChatroom::fullMembers),
+      _snapshotWanted(0), _publishing(false), _snapshotQueued(false)
 {
     QCoreApplication* app = QCoreApplication::instance();
     QString name;
@@ -40,16 +49,26 @@ dAmnSession::dAmnSession(const QString& username, const QByteArray& token, QObje
     else
         _useragent = QString("mnlib/").append(MNLIB_VERSION);
 
-    connect(&this->_socket, SIGNAL(error(QAbstractSocket::SocketError)),
-            this, SIGNAL(socketError(QAbstractSocket::SocketError)));
-    connect(&this->_socket, SIGNAL(stateChanged(QAbstractSocket::SocketState)),
-            this, SLOT(socketStateChange(QAbstractSocket::SocketState)));
-    connect(&this->_packetdevice, SIGNAL(packetReady(dAmnPacket&)),
-            this, SLOT(handlePacket(dAmnPacket&)));
+    this->_core.setAgent(this->_useragent);
+
+    this->_userTable = new dAmnUserTable(this);
+    this->_userTable->attach(this);
+
+    this->setTransport(new dAmnQtTransport(this));
+
+    this->publishSnapshot();
 }
 
 dAmnSession::~dAmnSession()
 {
+    // While whoever waits on them can still use us.
+    if(this->_requests)
+        this->_requests->cancelAll("session deleted");
+
+    // Rooms let go of their members, which needs us whole.
+    qDeleteAll(this->_chatrooms);
+    this->_chatrooms.clear();
+    this->_userTable->detach(this);
 }
 
 const QString& dAmnSession::userName() const
@@ -62,9 +81,84 @@ dAmnSession::State dAmnSession::state() const
     return this->_state;
 }
 
-QHash<QString, dAmnUser*>& dAmnSession::users()
+// Rooms, members and users as the protocol has it, up to the packet being
+// handled.
+const dAmnProtocolCore& dAmnSession::core() const
 {
-    return this->_users;
+    return this->_core;
+}
+
+dAmnUserTable* dAmnSession::userTable() const
+{
+    return this->_userTable;
+}
+
+// Shares users with other sessions of the account; only before joining any
+// room. A table of our own is deleted once nobody else uses it.
+void dAmnSession::setUserTable(dAmnUserTable* table)
+{
+    if(!table || table == this->_userTable)
+        return;
+    if(!this->_chatrooms.isEmpty())
+    {
+        MNLIB_WARN("Can't change the user table of a session in rooms.");
+        return;
+    }
+
+    dAmnUserTable* old = this->_userTable;
+    old->detach(this);
+    if(old->parent() == this && old->sessions().isEmpty())
+        delete old;
+
+    this->_userTable = table;
+    table->attach(this);
+}
+
+QList<dAmnUser*> dAmnSession::users() const
+{
+    return this->_userTable->users();
+}
+
+dAmnUser* dAmnSession::user(quint32 id) const
+{
+    return this->_userTable->user(id);
+}
+
+dAmnUser* dAmnSession::user(const QString& name) const
+{
+    return this->_userTable->user(name);
+}
+
+dAmnUser* dAmnSession::user(const dAmnName& name) const
+{
+    return this->_userTable->user(name);
+}
+
+quint32 dAmnSession::userId(const QString& name) const
+{
+    return this->_userTable->userId(name);
+}
+
+quint32 dAmnSession::userId(const dAmnName& name) const
+{
+    return this->_userTable->userId(name);
+}
+
+QList<dAmnChatroom*> dAmnSession::chatrooms() const
+{
+    return this->_chatrooms.values();
+}
+
+bool dAmnSession::can(const dAmnUser* user, const dAmnChatroom* room, dAmnPrivClass::KnownPrivs priv) const
+{
+    return user && room && room->can(user->id(), priv);
+}
+
+// roomid is the chatroom as it appears in packets, like chat:Botdom.
+bool dAmnSession::can(const QString& username, const QString& roomid, dAmnPrivClass::KnownPrivs priv) const
+{
+    dAmnChatroom* room = this->_chatrooms.value(this->_roomKeys.find(roomid));
+    return room && room->can(this->userId(username), priv);
 }
 
 dAmnUser* dAmnSession::addUser(const QString& name,
@@ -74,58 +168,183 @@ dAmnUser* dAmnSession::addUser(const QString& name,
                                const QString& type_name,
                                const QString& gpc)
 {
-    dAmnUser* user = this->_users.value(name);
+    return this->_userTable->addUser(name, usericon, symbol, realname, type_name, gpc);
+}
 
-    if(!user)
-    {
-        user = new dAmnUser(this, name, symbol, usericon, realname, type_name, gpc);
-        this->_users.insert(name, user);
-    }
+dAmnUser* dAmnSession::addUser(const QString& name, const QString& props)
+{
+    return this->_userTable->addUser(name, props);
+}
+
+void dAmnSession::reserveUsers(int count)
+{
+    this->_userTable->reserveUsers(count);
+}
 
-    return user;
+void dAmnSession::retainUser(dAmnUser* user)
+{
+    this->_userTable->retainUser(user);
 }
 
-dAmnUser* dAmnSession::addUser(const QString& name, const QString& props)
+void dAmnSession::releaseUser(dAmnUser* user)
+{
+    this->_userTable->releaseUser(user);
+}
+
+void dAmnSession::cleanupUser(const QString& name)
+{
+    this->_userTable->cleanupUser(name);
+}
+
+int dAmnSession::departedUserCapacity() const
 {
-    dAmnUser* user = this->_users.value(name);
+    return this->_userTable->departedUserCapacity();
+}
+
+void dAmnSession::setDepartedUserCapacity(int users)
+{
+    this->_userTable->setDepartedUserCapacity(users);
+}
+
+int dAmnSession::departedUserCount() const
+{
+    return this->_userTable->departedUserCount();
+}
+
+bool dAmnSession::isMe(const QString& name)
+{
+    return dAmnName::equals(name, this->_username);
+}
 
-    if(!user)
+dAmnWatchEngine* dAmnSession::watchEngine() const
+{
+    return this->_watch;
+}
+
+void dAmnSession::setWatchEngine(dAmnWatchEngine* engine)
+{
+    this->_watch = engine;
+}
+
+dAmnChatroom::MemberTracking dAmnSession::memberTracking() const
+{
+    return this->_memberTracking;
+}
+
+// Rooms already joined keep their own level; see dAmnChatroom::setMemberTracking().
+void dAmnSession::setMemberTracking(dAmnChatroom::MemberTracking level)
+{
+    this->_memberTracking = level;
+    this->_core.setTracking(level == dAmnChatroom::fullMembers);
+}
+
+// Safe to call from any thread. The snapshot returned never changes; a newer
+// one is published once the packets being handled are done with.
+//
+// Sessions nobody reads snapshots of don't build them: the first call turns
+// publishing on. Made from another thread, that call still gets the empty
+// snapshot from construction; the current state follows once the session's
+// thread gets back to its event loop.
+dAmnSessionSnapshotPtr dAmnSession::snapshot() const
+{
+    if(this->_snapshotWanted.testAndSetOrdered(0, 1))
     {
-        user = new dAmnUser(this, name);
-        user->setProperties(props);
-        this->_users.insert(name, user);
+        dAmnSession* self = const_cast<dAmnSession*>(this);
+        if(QThread::currentThread() == this->thread())
+            self->startPublishing();
+        else
+            QMetaObject::invokeMethod(self, "startPublishing", Qt::QueuedConnection);
     }
 
-    return user;
+    return std::atomic_load(&this->_snapshot);
 }
 
-void dAmnSession::cleanupUser(const QString& name)
+// Also hands a copy of every packet to handler on the executor, in the strand
+// of the room it concerns, or in the session's own strand (the empty key) for
+// logins, whois, pings and disconnects. The session keeps handling packets
+// itself as before; this only adds work that can run beside it. A NULL
+// executor turns it off.
+void dAmnSession::setExecutor(dAmnStrandExecutor* executor, const EventHandler& handler)
 {
-    dAmnUser* user = this->_users.value(name);
-    if(!user)
-    {
-        MNLIB_WARN("Can't cleanup user %s we don't know about.", qPrintable(name));
+    this->_executor = executor;
+    this->_eventHandler = executor ? handler : EventHandler();
+}
+
+dAmnTransport* dAmnSession::transport() const
+{
+    return this->_transport;
+}
+
+// Takes ownership of the transport. Only while offline.
+void dAmnSession::setTransport(dAmnTransport* transport)
+{
+    if(!transport || transport == this->_transport)
         return;
-    }
 
-    if(user->chatrooms().isEmpty())
+    if(this->_state != offline)
     {
-        this->_users.remove(name);
-        delete user;
+        MNLIB_WARN("Attempted to change the transport of a connected session.");
+        return;
     }
+
+    delete this->_transport;
+    this->_transport = transport;
+    transport->setParent(this);
+
+    connect(transport, SIGNAL(error(QAbstractSocket::SocketError)),
+            this, SIGNAL(socketError(QAbstractSocket::SocketError)));
+    connect(transport, SIGNAL(stateChanged(dAmnTransport::State)),
+            this, SLOT(transportStateChange(dAmnTransport::State)));
+    connect(transport, SIGNAL(readyRead()), this, SLOT(readSocket()));
 }
 
-bool dAmnSession::isMe(const QString& name)
+// Changes come in bursts, a packet or several per read, so publishing waits
+// for the event loop to come back around.
+void dAmnSession::snapshotLater()
 {
-    if(name == this->_username)
-        return true;
+    if(!this->_publishing || this->_snapshotQueued)
+        return;
+
+    this->_snapshotQueued = true;
+    QMetaObject::invokeMethod(this, "publishSnapshot", Qt::QueuedConnection);
+}
+
+// The key of a room as packets name it. Known names cost one hash probe; the
+// first time a room is spelled some new way, it's parsed and remembered.
+dAmnRoomKey dAmnSession::roomKey(const QString& roomid)
+{
+    dAmnRoomKey key = this->_roomKeys.find(roomid);
+    if(key.isNull())
+        key = this->_roomKeys.key(roomid, dAmnChatroomIdentifier(this, roomid));
+
+    return key;
+}
+
+void dAmnSession::startPublishing()
+{
+    this->_publishing = true;
+    this->publishSnapshot();
+}
+
+void dAmnSession::publishSnapshot()
+{
+    this->_snapshotQueued = false;
+
+    std::shared_ptr<dAmnSessionSnapshot> next = std::make_shared<dAmnSessionSnapshot>();
+    next->userName = this->_username;
+    next->state = this->_state;
+    next->generation = this->_snapshot ? this->_snapshot->generation + 1 : 0;
+
+    next->rooms.reserve(this->_chatrooms.size());
+    for(auto it = this->_chatrooms.constBegin(); it != this->_chatrooms.constEnd(); ++it)
+        next->rooms.insert(it.key().idString(), it.value()->snapshot());   // unchanged rooms are shared
 
-    return false;
+    std::atomic_store(&this->_snapshot, dAmnSessionSnapshotPtr(next));
 }
 
 QString dAmnSession::errorString() const
 {
-    return this->_socket.errorString();
+    return this->_transport->errorString();
 }
 
 void dAmnSession::connectToHost()
@@ -134,7 +353,7 @@ void dAmnSession::connectToHost()
     {
         //connect(&this->socket, SIGNAL(connected()),
         //        this, SLOT(login()));
-        this->_socket.connectToHost("chat.deviantart.com", 3900, QIODevice::ReadWrite);
+        this->_transport->connectToHost("chat.deviantart.com", 3900);
         //this->setState(connecting);
     }
     else
@@ -145,6 +364,13 @@ void dAmnSession::connectToHost()
 
 void dAmnSession::handlePacket(dAmnPacket& packet)
 {
+    if(this->_executor && this->_eventHandler)
+    {
+        const dAmnEventData event = dAmnEventData::fromPacket(packet);
+        const EventHandler handler = this->_eventHandler;
+        this->_executor->post(event.room, [handler, event]() { handler(event); });
+    }
+
     switch(packet.command())
     {
     case dAmnPacket::dAmnServer:
@@ -174,43 +400,95 @@ void dAmnSession::handlePacket(dAmnPacket& packet)
     case dAmnPacket::disconnect:
         this->handleDisconnect(packet);
         break;
+    case dAmnPacket::send:
+        this->handleSendError(packet);
+        break;
+    case dAmnPacket::kick:
+        this->handleKickError(packet);
+        break;
+    case dAmnPacket::get:
+        this->handleGetError(packet);
+        break;
+    case dAmnPacket::set:
+        this->handleSetError(packet);
+        break;
+    case dAmnPacket::kill:
+        this->handleKillError(packet);
+        break;
 
     default:
         MNLIB_DEBUG("Unhandled packet: %s", packet.toByteArray().data());
         qt_noop();
     }
+
+    // Whoever waits on an answer hears of it once we've dealt with it.
+    if(this->_requests)
+        this->_requests->match(packet);
 }
 
-void dAmnSession::socketStateChange(QAbstractSocket::SocketState socketState)
+void dAmnSession::transportStateChange(dAmnTransport::State state)
 {
-    switch(socketState)
+    switch(state)
     {
-    case QAbstractSocket::ConnectingState:
+    case dAmnTransport::connecting:
         this->setState(connecting);
         break;
-    case QAbstractSocket::ConnectedState:
+    case dAmnTransport::connected:
         this->setState(connected);
         this->login();
         break;
-    case QAbstractSocket::UnconnectedState:
+    case dAmnTransport::unconnected:
+        this->_core.connectionClosed();
         this->setState(offline);
+        break;
+    default:
+        break;
     }
 }
 
+// The core parses each frame, answers handshakes and pings by itself and
+// keeps track of rooms, members and users; dAmnChatroom and dAmnUser follow
+// it, frame by frame, as Qt objects. What the core and we have to say goes
+// out at the end.
+void dAmnSession::readSocket()
+{
+    this->_core.feed(this->_transport->readAll());
+
+    dAmnProtocolCore::Event event;
+    while(this->_core.nextEvent(event))
+    {
+        emit packetReceived(event.raw);
+
+        const dAmnProtocolCore::Packet& parsed = event.packet;
+        dAmnPacket packet (this, parsed.command, parsed.param, parsed.body);
+        packet.setArgs(parsed.args);
+        this->handlePacket(packet);
+
+        dAmnChatroom* room = event.changes.isEmpty() ? NULL : this->_chatrooms.value(this->roomKey(event.room));
+        if(room)
+            room->recordChanges(event.changes);
+    }
+
+    this->flush();
+}
+
+void dAmnSession::flush()
+{
+    if(this->_core.hasOutput())
+        this->_transport->write(this->_core.takeOutput());
+}
+
 void dAmnSession::send(dAmnPacket& packet)
 {
-    QByteArray data = packet.toByteArray();
-    //MNLIB_DEBUG("%s", data.data());
-    this->_socket.write(data);
+    this->_core.send(packet.toByteArray());
+    this->flush();
 }
 
 void dAmnSession::login()
 {
     MNLIB_DEBUG("Greeting server as %s", qPrintable(this->_useragent));
-    dAmnPacket handshakePacket (this, "dAmnClient", DAMN_VERSION);
-    handshakePacket.args().insert("agent", this->_useragent);
-
-    this->send(handshakePacket);
+    this->_core.connectionOpened();
+    this->flush();
 
     this->setState(logging_in);
 }
@@ -219,6 +497,19 @@ void dAmnSession::join(const dAmnChatroomIdentifier& id)
 {
     this->join(id.toString(), id.type);
 }
+// Joins rooms in the order given through the session's dAmnJoinScheduler,
+// a few at a time.
+void dAmnSession::joinAll(const QList<dAmnChatroomIdentifier>& rooms)
+{
+    this->joinScheduler()->joinAll(rooms);
+}
+dAmnJoinScheduler* dAmnSession::joinScheduler()
+{
+    if(!this->_joins)
+        this->_joins = new dAmnJoinScheduler(this);
+
+    return this->_joins;
+}
 void dAmnSession::join(const QString& name, dAmnChatroom::Type type)
 {
     QString parsedname = name;
@@ -236,9 +527,8 @@ void dAmnSession::join(const QString& name, dAmnChatroom::Type type)
         break;
     }
 
-    dAmnPacket packet (this, "join", parsedname);
-
-    this->send(packet);
+    this->_core.join(parsedname);
+    this->flush();
 }
 
 void dAmnSession::part(const dAmnChatroomIdentifier& id)
@@ -262,27 +552,165 @@ void dAmnSession::part(const QString& name, dAmnChatroom::Type type)
         break;
     }
 
-    dAmnPacket packet (this, "part", parsedname);
+    this->_core.part(parsedname);
+    this->flush();
+}
+
+void dAmnSession::whois(const QString& username)
+{
+    if(this->_cache && this->_cache->lookup(dAmnRequest::whois, QString("login:%1").arg(username)))
+        return;
+
+    this->_core.requestWhois(username);
+    this->flush();
+}
+
+void dAmnSession::getProperty(const dAmnChatroomIdentifier& id, const QString& property)
+{
+    const QString room = id.toIdString();
+    if(this->_cache && this->_cache->lookup(dAmnRequest::get, QString("%1/%2").arg(room, property)))
+        return;
+
+    this->_core.getProperty(room, property);
+    this->flush();
+}
+
+dAmnQueryCache* dAmnSession::queryCache()
+{
+    if(!this->_cache)
+        this->_cache = new dAmnQueryCache(this);
+
+    return this->_cache;
+}
+
+dAmnRequestTable* dAmnSession::requests()
+{
+    if(!this->_requests)
+        this->_requests = new dAmnRequestTable(this);
+
+    return this->_requests;
+}
+
+// Each of these registers the request before sending it.
+dAmnRequest dAmnSession::joinAsync(const QString& name, dAmnChatroom::Type type)
+{
+    QString parsedname = name;
+    if(type == dAmnChatroom::chat && parsedname.startsWith('#'))
+        parsedname.remove(0, 1);
+
+    return this->joinAsync(dAmnChatroomIdentifier(this, type, parsedname));
+}
+dAmnRequest dAmnSession::joinAsync(const dAmnChatroomIdentifier& id)
+{
+    dAmnRequest request = this->requests()->add(dAmnRequest::join, id.toIdString());
+    this->join(id);
+    return request;
+}
+
+dAmnRequest dAmnSession::partAsync(const QString& name, dAmnChatroom::Type type)
+{
+    QString parsedname = name;
+    if(type == dAmnChatroom::chat && parsedname.startsWith('#'))
+        parsedname.remove(0, 1);
+
+    return this->partAsync(dAmnChatroomIdentifier(this, type, parsedname));
+}
+dAmnRequest dAmnSession::partAsync(const dAmnChatroomIdentifier& id)
+{
+    dAmnRequest request = this->requests()->add(dAmnRequest::part, id.toIdString());
+    this->part(id);
+    return request;
+}
+
+// With the cache on, whoever asks for the same thing while it's on its way
+// shares one request, and remembered answers finish the request alone.
+dAmnRequest dAmnSession::whoisAsync(const QString& username)
+{
+    const QString target = QString("login:%1").arg(username);
+    if(this->_cache)
+    {
+        dAmnRequest pending = this->_cache->pending(dAmnRequest::whois, target);
+        if(pending.isPending())
+            return pending;
+    }
+
+    dAmnRequest request = this->requests()->add(dAmnRequest::whois, target);
+    if(this->_cache)
+    {
+        if(this->_cache->lookup(dAmnRequest::whois, target, request))
+            return request;
+        this->_cache->setPending(dAmnRequest::whois, target, request);
+    }
+
+    this->_core.requestWhois(username);
+    this->flush();
+    return request;
+}
+
+dAmnRequest dAmnSession::getPropertyAsync(const dAmnChatroomIdentifier& id, const QString& property)
+{
+    const QString target = QString("%1/%2").arg(id.toIdString(), property);
+    if(this->_cache)
+    {
+        dAmnRequest pending = this->_cache->pending(dAmnRequest::get, target);
+        if(pending.isPending())
+            return pending;
+    }
 
-    this->send(packet);
+    dAmnRequest request = this->requests()->add(dAmnRequest::get, target);
+    if(this->_cache)
+    {
+        if(this->_cache->lookup(dAmnRequest::get, target, request))
+            return request;
+        this->_cache->setPending(dAmnRequest::get, target, request);
+    }
+
+    this->_core.getProperty(id.toIdString(), property);
+    this->flush();
+    return request;
+}
+
+dAmnRequest dAmnSession::setPropertyAsync(const dAmnChatroomIdentifier& id, const QString& property, const QString& value)
+{
+    const QString room = id.toIdString();
+    dAmnRequest request = this->requests()->add(dAmnRequest::set, QString("%1/%2").arg(room, property));
+    this->_core.setProperty(room, property, value);
+    this->flush();
+    return request;
+}
+
+dAmnRequest dAmnSession::kickAsync(const dAmnChatroomIdentifier& id, const QString& username, const QString& reason)
+{
+    const QString room = id.toIdString();
+    dAmnRequest request = this->requests()->add(dAmnRequest::kick, QString("%1/%2").arg(room, username));
+    this->_core.kick(room, username, reason);
+    this->flush();
+    return request;
+}
+
+dAmnRequest dAmnSession::killAsync(const QString& username, const QString& reason)
+{
+    dAmnRequest request = this->requests()->add(dAmnRequest::kill, QString("login:%1").arg(username));
+    this->kill(username, reason);
+    return request;
 }
 
 void dAmnSession::kill(const QString& username, const QString& reason)
 {
-    dAmnPacket packet (this, "kill", QString("login:%1").arg(username), reason);
-    this->send(packet);
+    this->_core.kill(username, reason);
+    this->flush();
 }
 
 void dAmnSession::pong()
 {
-    dAmnPacket packet (this, "pong");
-    this->send(packet);
+    this->_core.pong();
+    this->flush();
 }
 
 void dAmnSession::quit()
 {
-    dAmnPacket packet (this, "quit");
-    this->send(packet);
+    this->_core.quit();
+    this->flush();
 }
 
 void dAmnSession::handleHandshake(dAmnPacket& packet)
@@ -291,29 +719,17 @@ void dAmnSession::handleHandshake(dAmnPacket& packet)
     MNLIB_DEBUG("Handshake recieved, version %s", qPrintable(event.version()));
 
     if(event.matches())
-    {
-        this->sendCredentials();
-    }
+        MNLIB_DEBUG("Logging in as %s", qPrintable(this->_username));   // the core sent our credentials
     else
-    {
         MNLIB_CRIT("Protocol version mismatch. Aborting connection.");
-    }
 
     emit handshake(event);
 }
 
-void dAmnSession::sendCredentials()
-{
-    MNLIB_DEBUG("Logging in as %s", qPrintable(this->_username));
-    dAmnPacket loginPacket (this, "login", this->_username);
-    loginPacket.args().insert("pk", this->_authtoken);
-
-    this->send(loginPacket);
-}
-
 void dAmnSession::setState(State state)
 {
     this->_state = state;
+    this->snapshotLater();
     emit stateChange(state);
 }
 
@@ -336,7 +752,7 @@ void dAmnSession::handleLogin(dAmnPacket& packet)
     {
         MNLIB_DEBUG("Login denied: %s", qPrintable(event.eventString()));
         this->setState(offline);
-        this->_socket.disconnectFromHost();
+        this->_transport->disconnectFromHost();
     }
 
     emit loggedIn(event);
@@ -348,15 +764,19 @@ void dAmnSession::handleJoin(dAmnPacket& packet)
 
     if(event.eventCode() == JoinedEvent::ok)
     {
-        MNLIB_DEBUG("Joined %s", qPrintable(event.chatroom().toIdString()));
-        if(this->_chatrooms.contains(event.chatroom().toIdString()))
-        {
-            MNLIB_WARN("Joined a chatroom which we already joined. Aborting.");
+        const dAmnRoomKey key = this->_roomKeys.key(event.chatroom());
+        MNLIB_DEBUG("Joined %s", qPrintable(key.idString()));
+        if(this->_chatrooms.contains(key))
+        {   // Rejoined, likely after a reconnect. The room keeps what it knew
+            // and the properties that follow only bring in the differences.
+            MNLIB_DEBUG("Rejoined %s; keeping its state.", qPrintable(key.idString()));
         }
         else
         {
-            this->_chatrooms[event.chatroom().toIdString()]
-                    = new dAmnChatroom(this, event.chatroom());
+            dAmnChatroom* room = new dAmnChatroom(this, event.chatroom());
+            room->setMemberTracking(this->_memberTracking);
+            this->_chatrooms[key] = room;
+            this->snapshotLater();
         }
     }
     else
@@ -374,10 +794,10 @@ void dAmnSession::handlePart(dAmnPacket& packet)
 
     if(event.eventCode() == PartedEvent::ok)
     {
-        MNLIB_DEBUG("Parted from %s", qPrintable(event.chatroom().toIdString()));
-        QString id = event.chatroom().toIdString();
-        delete this->_chatrooms[id];
-        this->_chatrooms.remove(id);
+        const dAmnRoomKey key = this->_roomKeys.key(event.chatroom());
+        MNLIB_DEBUG("Parted from %s", qPrintable(key.idString()));
+        delete this->_chatrooms.take(key);
+        this->snapshotLater();
     }
     else
     {
@@ -392,9 +812,8 @@ void dAmnSession::handleKick(dAmnPacket& packet)
 {
     KickedEvent event (this, packet);
 
-    QString id = event.chatroom().toIdString();
-    delete this->_chatrooms[id];
-    this->_chatrooms.remove(id);
+    delete this->_chatrooms.take(this->_roomKeys.key(event.chatroom()));
+    this->snapshotLater();
 
     emit kicked(event);
 }
@@ -408,8 +827,7 @@ void dAmnSession::handleDisconnect(dAmnPacket& packet)
 
 void dAmnSession::handlePing()
 {
-    MNLIB_DEBUG("Ping? Pong!");
-    this->pong();
+    MNLIB_DEBUG("Ping? Pong!");     // the core already answered
 
     emit ping();
 }
@@ -423,9 +841,9 @@ void dAmnSession::handleProperty(dAmnPacket& packet)
     }
 
     PropertyEvent event (this, packet);
-    QString idstring = event.chatroom().toIdString();
+    dAmnChatroom* chatroom = this->_chatrooms.value(this->roomKey(packet.param()));
 
-    if(!this->_chatrooms.contains(idstring))
+    if(!chatroom)
     {
         MNLIB_WARN("Got property %s of chatroom %s that we haven't joined.",
                    qPrintable(event.propertyString()),
@@ -433,7 +851,7 @@ void dAmnSession::handleProperty(dAmnPacket& packet)
         return;
     }
 
-    dAmnChatroom* chatroom = this->_chatrooms[idstring];
+    const dAmnProtocolCore::Room* kept = this->_core.room(packet.param());
 
     switch(event.propertyCode())
     {
@@ -444,12 +862,13 @@ void dAmnSession::handleProperty(dAmnPacket& packet)
         chatroom->updateTitle(event.value());
         break;
     case PropertyEvent::privclasses:
-        MNLIB_DEBUG("Got privclasses for %s", qPrintable(event.chatroom().toIdString()));
-        chatroom->updatePrivclasses(event.value());
+        MNLIB_DEBUG("Got privclasses for %s", qPrintable(chatroom->key().idString()));
+        if(kept)
+            chatroom->updatePrivclasses(kept->privclasses);
         break;
     case PropertyEvent::members:
-        MNLIB_DEBUG("Got members for %s", qPrintable(event.chatroom().toIdString()));
-        chatroom->processMembers(event.value());
+        MNLIB_DEBUG("Got members for %s", qPrintable(chatroom->key().idString()));
+        chatroom->processMembers(event.value(), kept);
         break;
 
     case PropertyEvent::unknown:
@@ -458,6 +877,8 @@ void dAmnSession::handleProperty(dAmnPacket& packet)
                    qPrintable(event.propertyString()),
                    qPrintable(event.chatroom().toString()));
     }
+
+    emit gotProperty(event);
 }
 
 void dAmnSession::handleWhois(dAmnPacket& packet)
@@ -469,7 +890,12 @@ void dAmnSession::handleWhois(dAmnPacket& packet)
 
 void dAmnSession::handleRecv(dAmnPacket& packet)
 {
-	dAmnChatroom* room = this->_chatrooms.value(packet.param());
+    dAmnChatroom* room = this->_chatrooms.value(this->roomKey(packet.param()));
+    if(!room)
+    {
+        MNLIB_WARN("Got a recv for %s, which we are not in. Dropped.", qPrintable(packet.param()));
+        return;
+    }
 
     dAmnPacket& sub = packet.subPacket();
 
@@ -495,24 +921,25 @@ void dAmnSession::handleRecv(dAmnPacket& packet)
         break;
     case dAmnPacket::admin:
     {
-        QString param = packet.param();
-        if(packet.param() == "create" || packet.param() == "update")
+        // "admin <action>"; the outer packet's param is the room.
+        const QString& action = sub.param();
+        if(action == "create" || action == "update")
             handlePrivUpdate(packet, room);
-        else if(packet.param() == "rename" || packet.param() == "move")
-            handlePrivUpdate(packet, room);
-        else if(packet.param() == "remove")
+        else if(action == "rename" || action == "move")
+            handlePrivMove(packet, room);
+        else if(action == "remove")
             handlePrivRemove(packet, room);
-        else if(packet.param() == "show")
+        else if(action == "show")
             handlePrivShow(packet, room);
-        else if(packet.param() == "privclass")
+        else if(action == "privclass")
             handlePrivUsers(packet, room);
         else
-            MNLIB_WARN("Unknown admin command %s in chatroom %s. Ignored.", qPrintable(packet.param()), qPrintable(room->name()));
+            MNLIB_WARN("Unknown admin command %s in chatroom %s. Ignored.", qPrintable(action), qPrintable(room->name()));
         break;
     }
 
     case dAmnPacket::unknown:
-        MNLIB_WARN("Unknown recv type in chatroom %s. Dropped. Raw: %s", packet.param(), packet.toByteArray().constData());
+        MNLIB_WARN("Unknown recv type in chatroom %s. Dropped. Raw: %s", qPrintable(packet.param()), packet.toByteArray().constData());
     }
 }
 
@@ -522,6 +949,8 @@ void dAmnSession::handleMsg(dAmnPacket& packet, dAmnChatroom* room)
 
     room->notifyMessage(event);
     emit message(event);
+
+    this->watch(packet, event.userName(), event.message());
 }
 
 void dAmnSession::handleAction(dAmnPacket& packet, dAmnChatroom* room)
@@ -530,6 +959,22 @@ void dAmnSession::handleAction(dAmnPacket& packet, dAmnChatroom* room)
 
     room->notifyAction(event);
     emit action(event);
+
+    this->watch(packet, event.userName(), event.action());
+}
+
+void dAmnSession::watch(dAmnPacket& packet, const QString& from, const dAmnRichText& text)
+{
+    if(!this->_watch || this->_watch->isEmpty())
+        return;
+
+    QString plain = text.toPlain();
+    QList<dAmnWatchHit> hits = this->_watch->match(plain);
+    if(hits.isEmpty())
+        return;
+
+    WatchHitEvent event (this, packet, from, plain, hits);
+    emit watchHit(event);
 }
 
 void dAmnSession::handlePeerJoin(dAmnPacket& packet, dAmnChatroom* room)
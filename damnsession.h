@@ -23,35 +23,71 @@
 #include "mnlib_global.h"
 
 #include <QObject>
-#include <QTcpSocket>
+#include <QAbstractSocket>
 #include <QString>
 #include <QByteArray>
 #include <QSslError>
 #include <QHash>
+#include <QAtomicInt>
+#include <functional>
 
 #include "damnchatroom.h"
+#include "damnroomkey.h"
+#include "damnprivclass.h"
+#include "damnsnapshot.h"
+#include "damnname.h"
 #include "evtfwd.h"
 #include "damnuser.h"
-#include "damnpacketdevice.h"
+#include "damnusertable.h"
+#include "damnprotocolcore.h"
+#include "damntransport.h"
 
 class QNetworkReply;
 template <typename T> class QList;
 
 class dAmnPacket;
+class dAmnWatchEngine;
+class dAmnJoinScheduler;
+class dAmnRequest;
+class dAmnRequestTable;
+class dAmnQueryCache;
+class dAmnStrandExecutor;
+struct dAmnEventData;
 
 class MNLIBSHARED_EXPORT dAmnSession : public QObject
 {
     Q_OBJECT
 
-    QTcpSocket _socket;
-    dAmnPacketDevice _packetdevice;
+    friend class dAmnChatroom;
+    friend class dAmnQueryCache;
+
+    dAmnTransport* _transport;  // ours; a dAmnQtTransport unless replaced
+    dAmnProtocolCore _core;     // speaks the protocol; we move its bytes and events
 
     QString _useragent, _username, _realname, _typename, _gpc;
-    QByteArray _authtoken;
     QChar _symbol;
 
-    QHash<QString, dAmnChatroom*> _chatrooms;
-    QHash<QString, dAmnUser*> _users;
+    dAmnRoomKeyRegistry _roomKeys;
+    QHash<dAmnRoomKey, dAmnChatroom*> _chatrooms;
+
+    // Users are numbered densely; rooms refer to them by id only.
+    dAmnUserTable* _userTable;  // ours unless shared with setUserTable()
+
+    dAmnWatchEngine* _watch;
+    dAmnJoinScheduler* _joins;  // created by the first joinAll()
+    dAmnRequestTable* _requests;    // created by the first *Async() request
+    dAmnQueryCache* _cache;         // NULL until queryCache() turns it on
+
+    dAmnStrandExecutor* _executor;
+    std::function<void(const dAmnEventData&)> _eventHandler;
+    dAmnChatroom::MemberTracking _memberTracking;   // for rooms joined from now on
+
+    // Published with std::atomic_store so other threads can pick it up with
+    // std::atomic_load while we work on the next one. Nothing is published
+    // past the first, empty one until snapshot() has been called.
+    dAmnSessionSnapshotPtr _snapshot;
+    mutable QAtomicInt _snapshotWanted;
+    bool _publishing, _snapshotQueued;
 
 public:
     enum State
@@ -63,8 +99,11 @@ private:
     State _state;
 
 private slots:
+    void readSocket();
     void handlePacket(dAmnPacket& packet);
-    void socketStateChange(QAbstractSocket::SocketState socketState);
+    void transportStateChange(dAmnTransport::State state);
+    void startPublishing();
+    void publishSnapshot();
 
 public:
     dAmnSession(const QString& username, const QByteArray &token, QObject* parent);
@@ -72,7 +111,18 @@ public:
 
     const QString& userName() const;
     State state() const;
-    QHash<QString, dAmnUser*>& users();
+    const dAmnProtocolCore& core() const;
+    dAmnUserTable* userTable() const;
+    void setUserTable(dAmnUserTable* table);
+    QList<dAmnUser*> users() const;
+    dAmnUser* user(quint32 id) const;
+    dAmnUser* user(const QString& name) const;
+    dAmnUser* user(const dAmnName& name) const;
+    quint32 userId(const QString& name) const;
+    quint32 userId(const dAmnName& name) const;
+    QList<dAmnChatroom*> chatrooms() const;
+    bool can(const dAmnUser* user, const dAmnChatroom* room, dAmnPrivClass::KnownPrivs priv) const;
+    bool can(const QString& username, const QString& roomid, dAmnPrivClass::KnownPrivs priv) const;
     dAmnUser* addUser(const QString& name,
                       int usericon,
                       const QChar& symbol,
@@ -80,10 +130,31 @@ public:
                       const QString& type_name,
                       const QString& gpc);
     dAmnUser* addUser(const QString& name, const QString& props);
+    void reserveUsers(int count);
+    void retainUser(dAmnUser* user);
+    void releaseUser(dAmnUser* user);
     void cleanupUser(const QString& name);
 
+    int departedUserCapacity() const;
+    void setDepartedUserCapacity(int users);
+    int departedUserCount() const;
+
     bool isMe(const QString& name);
 
+    dAmnWatchEngine* watchEngine() const;
+    void setWatchEngine(dAmnWatchEngine* engine);
+
+    dAmnChatroom::MemberTracking memberTracking() const;
+    void setMemberTracking(dAmnChatroom::MemberTracking level);
+
+    dAmnSessionSnapshotPtr snapshot() const;
+
+    typedef std::function<void(const dAmnEventData&)> EventHandler;
+    void setExecutor(dAmnStrandExecutor* executor, const EventHandler& handler);
+
+    dAmnTransport* transport() const;
+    void setTransport(dAmnTransport* transport);
+
     void connectToHost();
     void send(dAmnPacket& packet);
 
@@ -91,9 +162,29 @@ public:
 
     void join(const QString& name, dAmnChatroom::Type type = dAmnChatroom::chat);
     void join(const dAmnChatroomIdentifier& id);
+    void joinAll(const QList<dAmnChatroomIdentifier>& rooms);
+    dAmnJoinScheduler* joinScheduler();
     void part(const QString& name, dAmnChatroom::Type type = dAmnChatroom::chat);
     void part(const dAmnChatroomIdentifier& id);
 
+    void whois(const QString& username);
+    void getProperty(const dAmnChatroomIdentifier& id, const QString& property);
+
+    // Whois and property requests go through this once it's asked for.
+    dAmnQueryCache* queryCache();
+
+    // Requests whose answer can be waited on; see dAmnRequest.
+    dAmnRequestTable* requests();
+    dAmnRequest joinAsync(const QString& name, dAmnChatroom::Type type = dAmnChatroom::chat);
+    dAmnRequest joinAsync(const dAmnChatroomIdentifier& id);
+    dAmnRequest partAsync(const QString& name, dAmnChatroom::Type type = dAmnChatroom::chat);
+    dAmnRequest partAsync(const dAmnChatroomIdentifier& id);
+    dAmnRequest whoisAsync(const QString& username);
+    dAmnRequest getPropertyAsync(const dAmnChatroomIdentifier& id, const QString& property);
+    dAmnRequest setPropertyAsync(const dAmnChatroomIdentifier& id, const QString& property, const QString& value);
+    dAmnRequest kickAsync(const dAmnChatroomIdentifier& id, const QString& username, const QString& reason = QString());
+    dAmnRequest killAsync(const QString& username, const QString& reason = QString());
+
     void kill(const QString& username, const QString& reason = QString());
 
     void pong();
@@ -117,6 +208,7 @@ signals:
 
     void message(const MsgEvent& event);
     void action(const ActionEvent& event);
+    void watchHit(const WatchHitEvent& event);
     void kicked(const KickedEvent& event);
     void disconnected(const DisconnectEvent& event);
 
@@ -142,10 +234,15 @@ signals:
 
     void stateChange(dAmnSession::State state);
 
+    // Every packet as it came off the wire, before it's handled.
+    void packetReceived(const QByteArray& raw);
+
 private:
-    void sendCredentials();
+    void flush();
 
     void setState(State state);
+    void snapshotLater();
+    dAmnRoomKey roomKey(const QString& roomid);
 
     void handleHandshake(dAmnPacket& packet);
     void handleLogin(dAmnPacket& packet);
@@ -164,6 +261,7 @@ private:
 
     void handleMsg(dAmnPacket& packet, dAmnChatroom* room);
     void handleAction(dAmnPacket& packet, dAmnChatroom* room);
+    void watch(dAmnPacket& packet, const QString& from, const dAmnRichText& text);
 
     void handlePeerJoin(dAmnPacket& packet, dAmnChatroom* room);
     void handlePeerPart(dAmnPacket& packet, dAmnChatroom* room);
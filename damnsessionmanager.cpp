@@ -0,0 +1,394 @@
+﻿/*
+    This file is part of
+    amnlib - A C++ library for deviantART Message Network
+    Copyright © 2013 Carl Tessier <http://drfrankenstein90.deviantart.com/>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "damnsessionmanager.h"
+#include "damnsession.h"
+
+#include <QThread>
+#include <QEvent>
+#include <QCoreApplication>
+#include <QSemaphore>
+#include <QMutexLocker>
+#include <QAtomicInt>
+#include <algorithm>
+
+namespace
+{
+    const QEvent::Type commandEvent = QEvent::Type(QEvent::registerEventType());
+
+    class CommandEvent : public QEvent
+    {
+    public:
+        std::function<void()> work;
+
+        explicit CommandEvent(const std::function<void()>& work)
+            : QEvent(commandEvent), work(work)
+        {
+        }
+    };
+
+    // Lives on a shard's thread and runs what is posted to it there.
+    class Worker : public QObject
+    {
+    protected:
+        bool event(QEvent* event)
+        {
+            if(event->type() != commandEvent)
+                return QObject::event(event);
+
+            static_cast<CommandEvent*>(event)->work();
+            return true;
+        }
+    };
+}
+
+struct dAmnSessionManager::Shard
+{
+    QThread thread;
+    Worker worker;
+};
+
+struct dAmnSessionManager::Entry
+{
+    QString name;
+    dAmnSession* session;   // NULL until created on its shard, and once removed
+    int shard;
+    QAtomicInt packets;     // since the last sample
+    double rate;            // packets per sample, smoothed
+
+    Entry() : session(NULL), shard(0), rate(0) {}
+};
+
+// threads <= 0 uses one per core.
+dAmnSessionManager::dAmnSessionManager(int threads, QObject* parent)
+    : QObject(parent), _autoRebalance(false)
+{
+    if(threads <= 0)
+        threads = qMax(QThread::idealThreadCount(), 1);
+
+    for(int i = 0; i < threads; ++i)
+    {
+        Shard* shard = new Shard;
+        shard->thread.setObjectName(QString("dAmn shard %1").arg(i));
+        shard->worker.moveToThread(&shard->thread);
+        shard->thread.start();
+        this->_shards.append(shard);
+    }
+
+    this->_sampler.setInterval(1000);
+    connect(&this->_sampler, SIGNAL(timeout()), this, SLOT(sample()));
+    this->_sampler.start();
+}
+
+dAmnSessionManager::~dAmnSessionManager()
+{
+    this->_sampler.stop();
+
+    QList<std::shared_ptr<Entry> > entries;
+    {
+        QMutexLocker locker (&this->_lock);
+        entries = this->_sessions.values();
+        this->_sessions.clear();
+    }
+
+    // Sessions are deleted on their own threads. One may have been migrating,
+    // in which case its deletion follows it to another shard, so drain the
+    // shards until every session is gone.
+    foreach(const std::shared_ptr<Entry>& entry, entries)
+        this->dispatch(entry, [this, entry](dAmnSession* session)
+        {
+            {
+                QMutexLocker locker (&this->_lock);
+                entry->session = NULL;
+            }
+            delete session;
+        });
+
+    for(bool pending = !entries.isEmpty(); pending; )
+    {
+        foreach(Shard* shard, this->_shards)
+            this->run(shard, [](){}, true);
+
+        QMutexLocker locker (&this->_lock);
+        pending = false;
+        foreach(const std::shared_ptr<Entry>& entry, entries)
+            pending = pending || entry->session;
+    }
+
+    foreach(Shard* shard, this->_shards)
+    {
+        shard->thread.quit();
+        shard->thread.wait();
+        delete shard;
+    }
+}
+
+int dAmnSessionManager::shardCount() const
+{
+    return this->_shards.size();
+}
+
+QList<double> dAmnSessionManager::loads() const
+{
+    QMutexLocker locker (&this->_lock);
+    return this->shardLoads().toList();
+}
+
+int dAmnSessionManager::shardOf(const QString& username) const
+{
+    QMutexLocker locker (&this->_lock);
+    std::shared_ptr<Entry> entry = this->_sessions.value(username.toLower());
+    return entry ? entry->shard : -1;
+}
+
+QStringList dAmnSessionManager::sessions() const
+{
+    QMutexLocker locker (&this->_lock);
+
+    QStringList names;
+    foreach(const std::shared_ptr<Entry>& entry, this->_sessions)
+        names.append(entry->name);
+
+    return names;
+}
+
+// The session is created on the least loaded shard and connects right away
+// unless start is false.
+void dAmnSessionManager::addSession(const QString& username, const QByteArray& token, bool start)
+{
+    std::shared_ptr<Entry> entry = std::make_shared<Entry>();
+    entry->name = username;
+
+    {
+        QMutexLocker locker (&this->_lock);
+        const QString key = username.toLower();
+        if(this->_sessions.contains(key))
+        {
+            MNLIB_WARN("Session %s is already managed.", qPrintable(username));
+            return;
+        }
+
+        const QVector<double> loads = this->shardLoads();
+        entry->shard = std::min_element(loads.constBegin(), loads.constEnd()) - loads.constBegin();
+        this->_sessions.insert(key, entry);
+    }
+
+    this->run(this->_shards.at(entry->shard), [this, entry, token, start]()
+    {
+        dAmnSession* session = new dAmnSession(entry->name, token, NULL);
+
+        // Relays run on this thread; the raw Entry is safe as they go away
+        // with the session, which goes before its entry.
+        Entry* e = entry.get();
+        connect(session, &dAmnSession::packetReceived, [this, e](const QByteArray& raw)
+        {
+            e->packets.ref();
+            emit received(e->name, raw);
+        });
+        connect(session, &dAmnSession::stateChange, [this, e](dAmnSession::State state)
+        {
+            emit stateChanged(e->name, state);
+        });
+
+        {
+            QMutexLocker locker (&this->_lock);
+            entry->session = session;
+        }
+
+        if(start)
+            session->connectToHost();
+    });
+}
+
+void dAmnSessionManager::removeSession(const QString& username)
+{
+    std::shared_ptr<Entry> entry;
+    {
+        QMutexLocker locker (&this->_lock);
+        entry = this->_sessions.take(username.toLower());
+    }
+
+    if(!entry)
+        return;
+
+    this->dispatch(entry, [this, entry](dAmnSession* session)
+    {
+        {
+            QMutexLocker locker (&this->_lock);
+            entry->session = NULL;
+        }
+        delete session;
+    });
+}
+
+// Runs command with the session on its thread, some time later. Returns
+// false if there is no such session.
+bool dAmnSessionManager::post(const QString& username, const Command& command)
+{
+    std::shared_ptr<Entry> entry;
+    {
+        QMutexLocker locker (&this->_lock);
+        entry = this->_sessions.value(username.toLower());
+    }
+
+    if(!entry)
+        return false;
+
+    this->dispatch(entry, command);
+    return true;
+}
+
+// The session keeps its connection; its socket and everything else it owns
+// move along with it.
+void dAmnSessionManager::migrate(const QString& username, int shard)
+{
+    if(shard < 0 || shard >= this->_shards.size())
+        return;
+
+    QThread* target = &this->_shards.at(shard)->thread;
+    this->post(username, [this, username, shard, target](dAmnSession* session)
+    {
+        if(session->thread() == target)
+            return;
+
+        std::shared_ptr<Entry> entry;
+        {
+            QMutexLocker locker (&this->_lock);
+            entry = this->_sessions.value(username.toLower());
+            if(!entry || entry->session != session)
+                return;
+
+            // moveToThread() has to be called from the session's thread,
+            // which is where we are.
+            session->moveToThread(target);
+            entry->shard = shard;
+        }
+
+        MNLIB_DEBUG("Moved session %s to shard %d.", qPrintable(username), shard);
+        emit migrated(username, shard);
+    });
+}
+
+// Moves one session from the busiest shard to the idlest, if that narrows
+// the gap between them.
+void dAmnSessionManager::rebalance()
+{
+    QString name;
+    int cool;
+    {
+        QMutexLocker locker (&this->_lock);
+        const QVector<double> loads = this->shardLoads();
+        if(loads.size() < 2)
+            return;
+
+        const int hot = std::max_element(loads.constBegin(), loads.constEnd()) - loads.constBegin();
+        cool = std::min_element(loads.constBegin(), loads.constEnd()) - loads.constBegin();
+        const double gap = loads.at(hot) - loads.at(cool);
+
+        double best = 0;
+        foreach(const std::shared_ptr<Entry>& entry, this->_sessions)
+        {
+            const double load = entry->rate + 1;
+            if(entry->shard == hot && load < gap && load > best)
+            {
+                best = load;
+                name = entry->name;
+            }
+        }
+    }
+
+    if(!name.isEmpty())
+        this->migrate(name, cool);
+}
+
+bool dAmnSessionManager::autoRebalance() const
+{
+    return this->_autoRebalance;
+}
+// Rebalances after every load sample, once a second.
+void dAmnSessionManager::setAutoRebalance(bool enabled)
+{
+    this->_autoRebalance = enabled;
+}
+
+void dAmnSessionManager::sample()
+{
+    {
+        QMutexLocker locker (&this->_lock);
+        foreach(const std::shared_ptr<Entry>& entry, this->_sessions)
+            entry->rate = (entry->rate + entry->packets.fetchAndStoreRelaxed(0)) / 2;
+    }
+
+    if(this->_autoRebalance)
+        this->rebalance();
+}
+
+// Callers hold _lock.
+QVector<double> dAmnSessionManager::shardLoads() const
+{
+    QVector<double> loads (this->_shards.size(), 0);
+    foreach(const std::shared_ptr<Entry>& entry, this->_sessions)
+        loads[entry->shard] += entry->rate + 1;
+
+    return loads;
+}
+
+void dAmnSessionManager::run(Shard* shard, const std::function<void()>& work, bool wait)
+{
+    if(!wait)
+    {
+        QCoreApplication::postEvent(&shard->worker, new CommandEvent(work));
+        return;
+    }
+
+    QSemaphore done;
+    QCoreApplication::postEvent(&shard->worker, new CommandEvent([&work, &done]()
+    {
+        work();
+        done.release();
+    }));
+    done.acquire();
+}
+
+// Sends command to the session's shard. If the session moved on before it
+// got there, it follows.
+void dAmnSessionManager::dispatch(const std::shared_ptr<Entry>& entry, const Command& command)
+{
+    int shard;
+    {
+        QMutexLocker locker (&this->_lock);
+        shard = entry->shard;
+    }
+
+    this->run(this->_shards.at(shard), [this, entry, command]()
+    {
+        dAmnSession* session;
+        {
+            QMutexLocker locker (&this->_lock);
+            session = entry->session;
+        }
+
+        if(!session)
+            return;     // removed
+        if(session->thread() != QThread::currentThread())
+            this->dispatch(entry, command);
+        else
+            command(session);
+    });
+}
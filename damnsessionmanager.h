@@ -0,0 +1,98 @@
+﻿/*
+    This file is part of
+    amnlib - A C++ library for deviantART Message Network
+    Copyright © 2013 Carl Tessier <http://drfrankenstein90.deviantart.com/>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DAMNSESSIONMANAGER_H
+#define DAMNSESSIONMANAGER_H
+
+#include "mnlib_global.h"
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+#include <QVector>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QTimer>
+#include <functional>
+#include <memory>
+
+class QThread;
+class dAmnSession;
+
+// Runs many sessions over a fixed set of threads, each with its own event
+// loop. A session lives on one of them, its shard, and everything touching it
+// has to happen there; the manager's methods may be called from any thread and
+// hand work over to the right one.
+//
+// New sessions go to the least loaded shard, load being how many packets its
+// sessions received lately plus one per session. migrate() and rebalance()
+// move sessions between shards while they stay connected.
+class MNLIBSHARED_EXPORT dAmnSessionManager : public QObject
+{
+    Q_OBJECT
+
+    struct Shard;
+    struct Entry;
+
+    mutable QMutex _lock;
+    QVector<Shard*> _shards;
+    QHash<QString, std::shared_ptr<Entry> > _sessions;  // by lowercased user name
+
+    QTimer _sampler;
+    bool _autoRebalance;
+
+public:
+    typedef std::function<void(dAmnSession*)> Command;
+
+    explicit dAmnSessionManager(int threads = 0, QObject* parent = 0);
+    ~dAmnSessionManager();
+
+    int shardCount() const;
+    QList<double> loads() const;
+    int shardOf(const QString& username) const;
+    QStringList sessions() const;
+
+    void addSession(const QString& username, const QByteArray& token, bool start = true);
+    void removeSession(const QString& username);
+    bool post(const QString& username, const Command& command);
+
+    void migrate(const QString& username, int shard);
+    void rebalance();
+    bool autoRebalance() const;
+    void setAutoRebalance(bool enabled);
+
+signals:
+    // Emitted from the session's thread; connections made from elsewhere are
+    // queued, so only values go through.
+    void received(const QString& username, const QByteArray& raw);
+    void stateChanged(const QString& username, int state);
+    void migrated(const QString& username, int shard);
+
+private slots:
+    void sample();
+
+private:
+    QVector<double> shardLoads() const;
+    void run(Shard* shard, const std::function<void()>& work, bool wait = false);
+    void dispatch(const std::shared_ptr<Entry>& entry, const Command& command);
+};
+
+#endif // DAMNSESSIONMANAGER_H
@@ -0,0 +1,116 @@
+﻿/*
+    This file is part of
+    amnlib - A C++ library for deviantART Message Network
+    Copyright © 2013 Carl Tessier <http://drfrankenstein90.deviantart.com/>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "damnsnapshot.h"
+#include "damnchatroom.h"
+#include "damnprivclass.h"
+#include "damnsession.h"
+#include "damnuser.h"
+
+bool dAmnRoomSnapshot::PrivClass::can(dAmnPrivClass::KnownPrivs priv) const
+{
+    return priv != dAmnPrivClass::unknown && priv != dAmnPrivClass::order && (this->privs & (1 << priv));
+}
+
+int dAmnRoomSnapshot::PrivClass::limit(dAmnPrivClass::KnownPrivs priv) const
+{
+    if(priv >= dAmnPrivClass::images && priv <= dAmnPrivClass::objects)
+        return this->limits[priv - dAmnPrivClass::images];
+
+    return this->can(priv);
+}
+
+bool dAmnRoomSnapshot::hasMember(const QString& name) const
+{
+    return this->members.contains(dAmnName(name));
+}
+
+const dAmnRoomSnapshot::PrivClass* dAmnRoomSnapshot::privclassOf(const QString& name) const
+{
+    QHash<dAmnName, int>::const_iterator it = this->members.constFind(dAmnName(name));
+    return it == this->members.constEnd() ? NULL : &this->privclasses.at(*it);
+}
+
+const dAmnRoomSnapshot::PrivClass* dAmnRoomSnapshot::privclass(const QString& name) const
+{
+    for(int i = 0; i < this->privclasses.size(); ++i)
+        if(this->privclasses.at(i).name == name)
+            return &this->privclasses.at(i);
+
+    return NULL;
+}
+
+bool dAmnRoomSnapshot::can(const QString& name, dAmnPrivClass::KnownPrivs priv) const
+{
+    const PrivClass* pc = this->privclassOf(name);
+    return pc && pc->can(priv);
+}
+
+// Runs on the session thread; the copies of implicitly shared Qt values it
+// takes are safe to read from any thread afterwards. Given the room's
+// previous snapshot, members are shared with it rather than built again.
+dAmnRoomSnapshotPtr dAmnRoomSnapshot::capture(const dAmnChatroom* room, const dAmnRoomSnapshot* previous)
+{
+    std::shared_ptr<dAmnRoomSnapshot> snapshot = std::make_shared<dAmnRoomSnapshot>();
+
+    snapshot->id = room->key().idString();
+    snapshot->name = room->name();
+    snapshot->type = room->type();
+    snapshot->title = room->title();
+    snapshot->topic = room->topic();
+    snapshot->titleDate = room->titleDate();
+    snapshot->topicDate = room->topicDate();
+    snapshot->tracking = room->memberTracking();
+    snapshot->memberCount = room->memberCount();
+
+    QHash<const dAmnPrivClass*, int> indices;
+    snapshot->privclasses.reserve(room->_privclasses.size());
+    foreach(const dAmnPrivClass* pc, room->_privclasses)
+    {
+        PrivClass copy;
+        copy.name = pc->name();
+        copy.order = pc->orderValue();
+        copy.privs = pc->privs();
+        for(int priv = dAmnPrivClass::images; priv <= dAmnPrivClass::objects; ++priv)
+            copy.limits[priv - dAmnPrivClass::images] = pc->limit(dAmnPrivClass::KnownPrivs(priv));
+        copy.userCount = pc->userCount();
+
+        indices.insert(pc, snapshot->privclasses.size());
+        snapshot->privclasses.append(copy);
+    }
+
+    if(previous)
+    {
+        snapshot->members = previous->members;
+        return snapshot;
+    }
+
+    dAmnSession* session = room->session();
+    snapshot->members.reserve(room->_members.size());
+    foreach(const dAmnMembership& member, room->_members)
+        snapshot->members.insert(dAmnName(session->user(member.user)->name()),
+                                 indices.value(room->_pcslots.at(member.slot)));
+
+    return snapshot;
+}
+
+dAmnRoomSnapshotPtr dAmnSessionSnapshot::room(const QString& id) const
+{
+    return this->rooms.value(id);
+}
@@ -0,0 +1,88 @@
+﻿/*
+    This file is part of
+    amnlib - A C++ library for deviantART Message Network
+    Copyright © 2013 Carl Tessier <http://drfrankenstein90.deviantart.com/>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DAMNSNAPSHOT_H
+#define DAMNSNAPSHOT_H
+
+#include "mnlib_global.h"
+#include "damnchatroom.h"
+#include "damnprivclass.h"
+#include "damnrichtext.h"
+#include "damnname.h"
+
+#include <QString>
+#include <QDateTime>
+#include <QHash>
+#include <QVector>
+#include <memory>
+
+struct dAmnRoomSnapshot;
+struct dAmnSessionSnapshot;
+
+typedef std::shared_ptr<const dAmnRoomSnapshot> dAmnRoomSnapshotPtr;
+typedef std::shared_ptr<const dAmnSessionSnapshot> dAmnSessionSnapshotPtr;
+
+// A frozen copy of a chatroom's state. Snapshots are never modified once
+// published, so any thread holding one may read it without locking; the
+// session thread builds a new one whenever the room changes.
+struct MNLIBSHARED_EXPORT dAmnRoomSnapshot
+{
+    struct PrivClass
+    {
+        QString name;
+        uint order;
+        quint16 privs;
+        qint16 limits[dAmnPrivClass::objects - dAmnPrivClass::images + 1];
+        int userCount;
+
+        bool can(dAmnPrivClass::KnownPrivs priv) const;
+        int limit(dAmnPrivClass::KnownPrivs priv) const;
+    };
+
+    QString id, name;
+    dAmnChatroom::Type type;
+    dAmnRichText title, topic;
+    QDateTime titleDate, topicDate;
+    dAmnChatroom::MemberTracking tracking;
+    int memberCount;
+
+    QVector<PrivClass> privclasses;
+    QHash<dAmnName, int> members;   // index into privclasses
+
+    bool hasMember(const QString& name) const;
+    const PrivClass* privclassOf(const QString& name) const;
+    const PrivClass* privclass(const QString& name) const;
+    bool can(const QString& name, dAmnPrivClass::KnownPrivs priv) const;
+
+    static dAmnRoomSnapshotPtr capture(const dAmnChatroom* room, const dAmnRoomSnapshot* previous = NULL);
+};
+
+// Every room of a session at one point in time. generation grows by one with
+// each snapshot the session publishes.
+struct MNLIBSHARED_EXPORT dAmnSessionSnapshot
+{
+    QString userName;
+    int state;          // dAmnSession::State
+    quint64 generation;
+    QHash<QString, dAmnRoomSnapshotPtr> rooms;   // by id string, "chat:Botdom"
+
+    dAmnRoomSnapshotPtr room(const QString& id) const;
+};
+
+#endif // DAMNSNAPSHOT_H
@@ -0,0 +1,146 @@
+﻿/*
+    This file is part of
+    amnlib - A C++ library for deviantART Message Network
+    Copyright © 2013 Carl Tessier <http://drfrankenstein90.deviantart.com/>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "damnstrandexecutor.h"
+#include "damnpacket.h"
+
+#include <QThreadPool>
+#include <QRunnable>
+#include <QMutexLocker>
+#include <QDateTime>
+
+dAmnEventData dAmnEventData::fromPacket(dAmnPacket& packet)
+{
+    dAmnEventData event;
+    event.received = QDateTime::currentMSecsSinceEpoch();
+
+    dAmnPacket* source = &packet;
+    if(packet.command() == dAmnPacket::recv)
+    {
+        event.room = packet.param();
+        source = &packet.subPacket();
+    }
+    else if(packet.param().startsWith("chat:") || packet.param().startsWith("pchat:"))
+        event.room = packet.param();
+
+    event.command = source->command();
+    event.param = source->param();
+    event.data = source->data();
+    event.args = source->args();
+    return event;
+}
+
+class dAmnStrandExecutor::Runner : public QRunnable
+{
+    dAmnStrandExecutor* _executor;
+    QString _key;
+
+public:
+    Runner(dAmnStrandExecutor* executor, const QString& key)
+        : _executor(executor), _key(key)
+    {
+    }
+
+    void run()
+    {
+        this->_executor->drain(this->_key);
+    }
+};
+
+// Without a pool, one of our own is used, as many threads as cores.
+dAmnStrandExecutor::dAmnStrandExecutor(QThreadPool* pool)
+    : _pool(pool), _ownPool(!pool), _batch(64)
+{
+    if(this->_ownPool)
+        this->_pool = new QThreadPool;
+}
+
+dAmnStrandExecutor::~dAmnStrandExecutor()
+{
+    this->waitForDone();
+    if(this->_ownPool)
+        delete this->_pool;
+}
+
+QThreadPool* dAmnStrandExecutor::pool() const
+{
+    return this->_pool;
+}
+
+int dAmnStrandExecutor::batchSize() const
+{
+    return this->_batch;
+}
+void dAmnStrandExecutor::setBatchSize(int tasks)
+{
+    QMutexLocker locker (&this->_lock);
+    this->_batch = qMax(tasks, 1);
+}
+
+void dAmnStrandExecutor::post(const QString& key, const Task& task)
+{
+    QMutexLocker locker (&this->_lock);
+
+    Strand*& strand = this->_strands[key];
+    if(!strand)
+        strand = new Strand;
+
+    strand->tasks.enqueue(task);
+    if(!strand->running)
+    {
+        strand->running = true;
+        this->_pool->start(new Runner(this, key));
+    }
+}
+
+// Blocks until every strand ran out of tasks.
+void dAmnStrandExecutor::waitForDone()
+{
+    QMutexLocker locker (&this->_lock);
+    while(!this->_strands.isEmpty())
+        this->_idle.wait(&this->_lock);
+}
+
+// Runs up to a batch of the strand's tasks, then either hands it back to the
+// pool or, when it's empty, forgets it.
+void dAmnStrandExecutor::drain(const QString& key)
+{
+    QMutexLocker locker (&this->_lock);
+    Strand* strand = this->_strands.value(key);
+
+    for(int n = this->_batch; n > 0 && !strand->tasks.isEmpty(); --n)
+    {
+        Task task = strand->tasks.dequeue();
+
+        locker.unlock();
+        task();
+        locker.relock();
+    }
+
+    if(!strand->tasks.isEmpty())
+    {
+        this->_pool->start(new Runner(this, key));
+        return;
+    }
+
+    this->_strands.remove(key);
+    delete strand;
+    if(this->_strands.isEmpty())
+        this->_idle.wakeAll();
+}
@@ -0,0 +1,90 @@
+﻿/*
+    This file is part of
+    amnlib - A C++ library for deviantART Message Network
+    Copyright © 2013 Carl Tessier <http://drfrankenstein90.deviantart.com/>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DAMNSTRANDEXECUTOR_H
+#define DAMNSTRANDEXECUTOR_H
+
+#include "mnlib_global.h"
+#include "damnpacket.h"
+
+#include <QString>
+#include <QHash>
+#include <QQueue>
+#include <QMutex>
+#include <QWaitCondition>
+#include <functional>
+
+class QThreadPool;
+
+// A packet's contents, copied out so it can be handled on another thread.
+// For recv packets these are the inner packet's, and room is the outer
+// packet's parameter.
+struct MNLIBSHARED_EXPORT dAmnEventData
+{
+    QString room;               // empty for session-wide events
+    dAmnPacket::KnownCmd command;
+    QString param, data;
+    QHash<QString, QString> args;
+    qint64 received;            // msecs since the epoch
+
+    static dAmnEventData fromPacket(dAmnPacket& packet);
+};
+
+// Runs tasks on a thread pool in strands: tasks posted under the same key run
+// one at a time and in the order they were posted, while different keys run
+// in parallel. A strand with a long queue gives its thread back after a batch
+// of tasks so that others get their turn.
+class MNLIBSHARED_EXPORT dAmnStrandExecutor
+{
+    class Runner;
+
+    struct Strand
+    {
+        QQueue<std::function<void()> > tasks;
+        bool running;
+
+        Strand() : running(false) {}
+    };
+
+    QThreadPool* _pool;
+    bool _ownPool;
+
+    QMutex _lock;
+    QWaitCondition _idle;
+    QHash<QString, Strand*> _strands;  // only those with work
+    int _batch;
+
+public:
+    typedef std::function<void()> Task;
+
+    explicit dAmnStrandExecutor(QThreadPool* pool = 0);
+    ~dAmnStrandExecutor();
+
+    QThreadPool* pool() const;
+    int batchSize() const;
+    void setBatchSize(int tasks);
+
+    void post(const QString& key, const Task& task);
+    void waitForDone();
+
+private:
+    void drain(const QString& key);
+};
+
+#endif // DAMNSTRANDEXECUTOR_H
@@ -0,0 +1,252 @@
+﻿/*
+    This file is part of
+    amnlib - A C++ library for deviantART Message Network
+    Copyright © 2013 Carl Tessier <http://drfrankenstein90.deviantart.com/>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "damnstripedsession.h"
+#include "damnsession.h"
+#include "damnuser.h"
+#include "damnusertable.h"
+#include "damnname.h"
+#include "events.h"
+
+dAmnStripedSession::dAmnStripedSession(const QString& username, const QByteArray& token, int stripes, QObject* parent)
+    : QObject(parent), _users(new dAmnUserTable(this)), _mode(byHash), _state(dAmnSession::offline)
+{
+    for(int i = 0; i < qMax(stripes, 1); ++i)
+    {
+        dAmnSession* session = new dAmnSession(username, token, this);
+        session->setObjectName(QString("%1/%2").arg(username).arg(i));
+        session->setUserTable(this->_users);
+
+        connect(session, SIGNAL(loggedIn(LoginEvent)), this, SIGNAL(loggedIn(LoginEvent)));
+        connect(session, SIGNAL(joined(JoinedEvent)), this, SLOT(handleJoined(JoinedEvent)));
+        connect(session, SIGNAL(parted(PartedEvent)), this, SLOT(handleParted(PartedEvent)));
+        connect(session, SIGNAL(gotProperty(PropertyEvent)), this, SIGNAL(gotProperty(PropertyEvent)));
+        connect(session, SIGNAL(gotWhois(WhoisEvent)), this, SIGNAL(gotWhois(WhoisEvent)));
+        connect(session, SIGNAL(message(MsgEvent)), this, SIGNAL(message(MsgEvent)));
+        connect(session, SIGNAL(action(ActionEvent)), this, SIGNAL(action(ActionEvent)));
+        connect(session, SIGNAL(watchHit(WatchHitEvent)), this, SIGNAL(watchHit(WatchHitEvent)));
+        connect(session, SIGNAL(kicked(KickedEvent)), this, SLOT(handleKicked(KickedEvent)));
+        connect(session, SIGNAL(disconnected(DisconnectEvent)), this, SIGNAL(disconnected(DisconnectEvent)));
+        connect(session, SIGNAL(join(JoinEvent)), this, SIGNAL(join(JoinEvent)));
+        connect(session, SIGNAL(part(PartEvent)), this, SIGNAL(part(PartEvent)));
+        connect(session, SIGNAL(kick(KickEvent)), this, SIGNAL(kick(KickEvent)));
+        connect(session, SIGNAL(privChg(PrivchgEvent)), this, SIGNAL(privChg(PrivchgEvent)));
+        connect(session, SIGNAL(privUpdate(PrivUpdateEvent)), this, SIGNAL(privUpdate(PrivUpdateEvent)));
+        connect(session, SIGNAL(privMove(PrivMoveEvent)), this, SIGNAL(privMove(PrivMoveEvent)));
+        connect(session, SIGNAL(privRemove(PrivRemoveEvent)), this, SIGNAL(privRemove(PrivRemoveEvent)));
+        connect(session, SIGNAL(privShow(PrivShowEvent)), this, SIGNAL(privShow(PrivShowEvent)));
+        connect(session, SIGNAL(privUsers(PrivUsersEvent)), this, SIGNAL(privUsers(PrivUsersEvent)));
+        connect(session, SIGNAL(sendError(SendError)), this, SIGNAL(sendError(SendError)));
+        connect(session, SIGNAL(kickError(KickError)), this, SIGNAL(kickError(KickError)));
+        connect(session, SIGNAL(getError(GetError)), this, SIGNAL(getError(GetError)));
+        connect(session, SIGNAL(setError(SetError)), this, SIGNAL(setError(SetError)));
+        connect(session, SIGNAL(killError(KillError)), this, SIGNAL(killError(KillError)));
+        connect(session, SIGNAL(stateChange(dAmnSession::State)), this, SLOT(handleStateChange()));
+
+        this->_stripes.append(session);
+    }
+}
+
+// The stripes' rooms let go of their members, which needs the table whole.
+dAmnStripedSession::~dAmnStripedSession()
+{
+    qDeleteAll(this->_stripes);
+    this->_stripes.clear();
+}
+
+int dAmnStripedSession::stripeCount() const
+{
+    return this->_stripes.size();
+}
+
+dAmnSession* dAmnStripedSession::stripe(int index) const
+{
+    return this->_stripes.value(index);
+}
+
+// The stripe the room is on, or goes to if it isn't on any yet.
+dAmnSession* dAmnStripedSession::stripeFor(const dAmnChatroomIdentifier& room)
+{
+    const dAmnName id (room.toIdString());
+    QHash<dAmnName, int>::const_iterator it = this->_placement.constFind(id);
+    if(it != this->_placement.constEnd())
+        return this->_stripes.at(*it);
+
+    int index = 0;
+    if(this->_mode == byHash)
+        index = id.hash() % this->_stripes.size();
+    else
+    {
+        QVector<int> rooms (this->_stripes.size(), 0);
+        foreach(int stripe, this->_placement)
+            rooms[stripe]++;
+
+        for(int i = 1; i < rooms.size(); ++i)
+            if(rooms.at(i) < rooms.at(index))
+                index = i;
+    }
+
+    this->_placement.insert(id, index);
+    return this->_stripes.at(index);
+}
+
+dAmnStripedSession::Placement dAmnStripedSession::placement() const
+{
+    return this->_mode;
+}
+// Only rooms joined from now on are placed the new way.
+void dAmnStripedSession::setPlacement(Placement mode)
+{
+    this->_mode = mode;
+}
+
+const QString& dAmnStripedSession::userName() const
+{
+    return this->_stripes.first()->userName();
+}
+
+dAmnSession::State dAmnStripedSession::state() const
+{
+    return this->_state;
+}
+
+QList<dAmnChatroom*> dAmnStripedSession::chatrooms() const
+{
+    QList<dAmnChatroom*> rooms;
+    foreach(dAmnSession* session, this->_stripes)
+        rooms += session->chatrooms();
+
+    return rooms;
+}
+
+dAmnChatroom* dAmnStripedSession::chatroom(const dAmnChatroomIdentifier& room) const
+{
+    const QString id = room.toIdString();
+    int stripe = this->_placement.value(dAmnName(id), -1);
+    if(stripe < 0)
+        return NULL;
+
+    foreach(dAmnChatroom* chatroom, this->_stripes.at(stripe)->chatrooms())
+        if(dAmnName::equals(chatroom->id().toIdString(), id))
+            return chatroom;
+
+    return NULL;
+}
+
+dAmnUserTable* dAmnStripedSession::userTable() const
+{
+    return this->_users;
+}
+
+// Everyone in any of our rooms, on whichever stripe.
+QList<dAmnUser*> dAmnStripedSession::users() const
+{
+    return this->_users->users();
+}
+
+dAmnUser* dAmnStripedSession::user(const QString& name) const
+{
+    return this->_users->user(name);
+}
+
+void dAmnStripedSession::connectToHost()
+{
+    foreach(dAmnSession* session, this->_stripes)
+        if(session->state() == dAmnSession::offline)
+            session->connectToHost();
+}
+
+void dAmnStripedSession::join(const dAmnChatroomIdentifier& room)
+{
+    this->stripeFor(room)->join(room);
+}
+void dAmnStripedSession::join(const QString& name, dAmnChatroom::Type type)
+{
+    this->join(dAmnChatroomIdentifier(this->_stripes.first(), type,
+                                      type == dAmnChatroom::chat && name.startsWith('#') ? name.mid(1) : name));
+}
+
+// Each stripe gets its share of the rooms, in the order given, through its
+// own dAmnJoinScheduler.
+void dAmnStripedSession::joinAll(const QList<dAmnChatroomIdentifier>& rooms)
+{
+    QVector<QList<dAmnChatroomIdentifier> > shares (this->_stripes.size());
+    foreach(const dAmnChatroomIdentifier& room, rooms)
+        shares[this->_stripes.indexOf(this->stripeFor(room))].append(room);
+
+    for(int i = 0; i < shares.size(); ++i)
+        if(!shares.at(i).isEmpty())
+            this->_stripes.at(i)->joinAll(shares.at(i));
+}
+
+void dAmnStripedSession::part(const dAmnChatroomIdentifier& room)
+{
+    this->stripeFor(room)->part(room);
+}
+void dAmnStripedSession::part(const QString& name, dAmnChatroom::Type type)
+{
+    this->part(dAmnChatroomIdentifier(this->_stripes.first(), type,
+                                      type == dAmnChatroom::chat && name.startsWith('#') ? name.mid(1) : name));
+}
+
+void dAmnStripedSession::kill(const QString& username, const QString& reason)
+{
+    this->_stripes.first()->kill(username, reason);
+}
+
+void dAmnStripedSession::quit()
+{
+    foreach(dAmnSession* session, this->_stripes)
+        session->quit();
+}
+
+void dAmnStripedSession::handleJoined(const JoinedEvent& event)
+{   // A refused room isn't held to the stripe that tried.
+    if(event.eventCode() != JoinedEvent::ok)
+        this->_placement.remove(dAmnName(event.chatroom().toIdString()));
+
+    emit joined(event);
+}
+
+void dAmnStripedSession::handleParted(const PartedEvent& event)
+{
+    if(event.eventCode() == PartedEvent::ok)
+        this->_placement.remove(dAmnName(event.chatroom().toIdString()));
+
+    emit parted(event);
+}
+
+void dAmnStripedSession::handleKicked(const KickedEvent& event)
+{
+    this->_placement.remove(dAmnName(event.chatroom().toIdString()));
+    emit kicked(event);
+}
+
+void dAmnStripedSession::handleStateChange()
+{
+    dAmnSession::State state = dAmnSession::online;
+    foreach(dAmnSession* session, this->_stripes)
+        state = qMin(state, session->state());
+
+    if(state != this->_state)
+    {
+        this->_state = state;
+        emit stateChange(state);
+    }
+}
@@ -0,0 +1,129 @@
+﻿/*
+    This file is part of
+    amnlib - A C++ library for deviantART Message Network
+    Copyright © 2013 Carl Tessier <http://drfrankenstein90.deviantart.com/>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DAMNSTRIPEDSESSION_H
+#define DAMNSTRIPEDSESSION_H
+
+#include "mnlib_global.h"
+#include "damnsession.h"
+#include "damnchatroom.h"
+#include "damnname.h"
+#include "evtfwd.h"
+
+#include <QObject>
+#include <QString>
+#include <QByteArray>
+#include <QList>
+#include <QHash>
+#include <QVector>
+
+class dAmnUser;
+class dAmnUserTable;
+
+// One account logged in over several connections, with its rooms spread
+// across them. The server handles each connection's traffic in turn, so busy
+// rooms on separate connections don't hold each other up.
+//
+// Each connection is a dAmnSession of its own, a stripe. A room stays on the
+// stripe it was first joined on, picked by hashing its name or by how many
+// rooms each stripe has. The stripes share one dAmnUserTable, so a user in
+// rooms on several of them is a single dAmnUser. The stripes' signals are all
+// relayed from here; events still tell which stripe they came from through
+// their session().
+class MNLIBSHARED_EXPORT dAmnStripedSession : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Placement
+    {
+        byHash, byLoad
+    };
+
+private:
+    QVector<dAmnSession*> _stripes;
+    dAmnUserTable* _users;              // shared by the stripes
+    QHash<dAmnName, int> _placement;    // room id string, in any case -> stripe
+    Placement _mode;
+    dAmnSession::State _state;
+
+public:
+    dAmnStripedSession(const QString& username, const QByteArray& token, int stripes, QObject* parent = 0);
+    ~dAmnStripedSession();
+
+    int stripeCount() const;
+    dAmnSession* stripe(int index) const;
+    dAmnSession* stripeFor(const dAmnChatroomIdentifier& room);
+    Placement placement() const;
+    void setPlacement(Placement mode);
+
+    const QString& userName() const;
+    dAmnSession::State state() const;
+    QList<dAmnChatroom*> chatrooms() const;
+    dAmnChatroom* chatroom(const dAmnChatroomIdentifier& room) const;
+    dAmnUserTable* userTable() const;
+    QList<dAmnUser*> users() const;
+    dAmnUser* user(const QString& name) const;
+
+    void connectToHost();
+    void join(const dAmnChatroomIdentifier& room);
+    void join(const QString& name, dAmnChatroom::Type type = dAmnChatroom::chat);
+    void joinAll(const QList<dAmnChatroomIdentifier>& rooms);
+    void part(const dAmnChatroomIdentifier& room);
+    void part(const QString& name, dAmnChatroom::Type type = dAmnChatroom::chat);
+    void kill(const QString& username, const QString& reason = QString());
+    void quit();
+
+signals:
+    void loggedIn(const LoginEvent& event);
+    void joined(const JoinedEvent& event);
+    void parted(const PartedEvent& event);
+    void gotProperty(const PropertyEvent& event);
+    void gotWhois(const WhoisEvent& event);
+    void message(const MsgEvent& event);
+    void action(const ActionEvent& event);
+    void watchHit(const WatchHitEvent& event);
+    void kicked(const KickedEvent& event);
+    void disconnected(const DisconnectEvent& event);
+    void join(const JoinEvent& event);
+    void part(const PartEvent& event);
+    void kick(const KickEvent& event);
+    void privChg(const PrivchgEvent& event);
+    void privUpdate(const PrivUpdateEvent& event);
+    void privMove(const PrivMoveEvent& event);
+    void privRemove(const PrivRemoveEvent& event);
+    void privShow(const PrivShowEvent& event);
+    void privUsers(const PrivUsersEvent& event);
+    void sendError(const SendError& error);
+    void kickError(const KickError& error);
+    void getError(const GetError& error);
+    void setError(const SetError& error);
+    void killError(const KillError& error);
+
+    // The lowest state of any stripe: online only once all of them are.
+    void stateChange(dAmnSession::State state);
+
+private slots:
+    void handleJoined(const JoinedEvent& event);
+    void handleParted(const PartedEvent& event);
+    void handleKicked(const KickedEvent& event);
+    void handleStateChange();
+};
+
+#endif // DAMNSTRIPEDSESSION_H
@@ -0,0 +1,100 @@
+﻿/*
+    This file is part of
+    amnlib - A C++ library for deviantART Message Network
+    Copyright © 2013 Carl Tessier <http://drfrankenstein90.deviantart.com/>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "damntransport.h"
+
+dAmnTransport::dAmnTransport(QObject* parent)
+    : QObject(parent), _state(unconnected)
+{
+}
+
+dAmnTransport::~dAmnTransport()
+{
+}
+
+dAmnTransport::State dAmnTransport::state() const
+{
+    return this->_state;
+}
+
+void dAmnTransport::setState(State state)
+{
+    if(state == this->_state)
+        return;
+
+    this->_state = state;
+    emit stateChanged(state);
+}
+
+dAmnQtTransport::dAmnQtTransport(QObject* parent)
+    : dAmnTransport(parent), _socket(this)
+{
+    connect(&this->_socket, SIGNAL(error(QAbstractSocket::SocketError)),
+            this, SIGNAL(error(QAbstractSocket::SocketError)));
+    connect(&this->_socket, SIGNAL(stateChanged(QAbstractSocket::SocketState)),
+            this, SLOT(socketStateChange(QAbstractSocket::SocketState)));
+    connect(&this->_socket, SIGNAL(readyRead()), this, SIGNAL(readyRead()));
+}
+
+void dAmnQtTransport::connectToHost(const QString& host, quint16 port)
+{
+    this->_socket.connectToHost(host, port, QIODevice::ReadWrite);
+}
+
+void dAmnQtTransport::disconnectFromHost()
+{
+    this->_socket.disconnectFromHost();
+}
+
+qint64 dAmnQtTransport::write(const QByteArray& data)
+{
+    return this->_socket.write(data);
+}
+
+QByteArray dAmnQtTransport::readAll()
+{
+    return this->_socket.readAll();
+}
+
+QString dAmnQtTransport::errorString() const
+{
+    return this->_socket.errorString();
+}
+
+void dAmnQtTransport::socketStateChange(QAbstractSocket::SocketState socketState)
+{
+    switch(socketState)
+    {
+    case QAbstractSocket::HostLookupState:
+    case QAbstractSocket::ConnectingState:
+        this->setState(connecting);
+        break;
+    case QAbstractSocket::ConnectedState:
+        this->setState(connected);
+        break;
+    case QAbstractSocket::ClosingState:
+        this->setState(closing);
+        break;
+    case QAbstractSocket::UnconnectedState:
+        this->setState(unconnected);
+        break;
+    default:
+        break;
+    }
+}
@@ -0,0 +1,91 @@
+﻿/*
+    This file is part of
+    amnlib - A C++ library for deviantART Message Network
+    Copyright © 2013 Carl Tessier <http://drfrankenstein90.deviantart.com/>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DAMNTRANSPORT_H
+#define DAMNTRANSPORT_H
+
+#include "mnlib_global.h"
+
+#include <QObject>
+#include <QString>
+#include <QByteArray>
+#include <QAbstractSocket>
+#include <QTcpSocket>
+
+// Carries a session's bytes to and from the server. dAmnSession talks to one
+// of these instead of a socket, so that sessions can be moved onto something
+// lighter than a QTcpSocket each when there are thousands of them.
+class MNLIBSHARED_EXPORT dAmnTransport : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum State
+    {
+        unconnected, connecting, connected, closing
+    };
+
+    explicit dAmnTransport(QObject* parent = 0);
+    virtual ~dAmnTransport();
+
+    State state() const;
+
+    virtual void connectToHost(const QString& host, quint16 port) = 0;
+    virtual void disconnectFromHost() = 0;  // once everything written is sent
+
+    virtual qint64 write(const QByteArray& data) = 0;
+    virtual QByteArray readAll() = 0;
+
+    virtual QString errorString() const = 0;
+
+signals:
+    void stateChanged(dAmnTransport::State state);
+    void readyRead();
+    void error(QAbstractSocket::SocketError error);
+
+protected:
+    void setState(State state);
+
+private:
+    State _state;
+};
+
+// The default: a QTcpSocket.
+class MNLIBSHARED_EXPORT dAmnQtTransport : public dAmnTransport
+{
+    Q_OBJECT
+
+    QTcpSocket _socket;
+
+public:
+    explicit dAmnQtTransport(QObject* parent = 0);
+
+    void connectToHost(const QString& host, quint16 port);
+    void disconnectFromHost();
+
+    qint64 write(const QByteArray& data);
+    QByteArray readAll();
+
+    QString errorString() const;
+
+private slots:
+    void socketStateChange(QAbstractSocket::SocketState socketState);
+};
+
+#endif // DAMNTRANSPORT_H
@@ -2,24 +2,65 @@
 
 #include <QString>
 #include <QChar>
-#include <QSet>
+#include <QList>
 #include <QTextStream>
 #include <QPair>
 
-class dAmnChatroom;
+#include "damnchatroom.h"
+#include "damnusertable.h"
+#include "damnpacketparser.h"
+#include "damnrequest.h"
 
-dAmnUser::dAmnUser(dAmnSession* parent, const QString& name, const QChar& symbol, int usericon, const QString& realname, const QString& type, const QString& gpc)
-    : Deviant(parent, name, symbol, usericon, realname, type), _gpc(gpc)
+const quint32 dAmnUser::invalidId;
+
+dAmnUser::dAmnUser(dAmnUserTable* parent, const QString& name, const QChar& symbol, int usericon, const QString& realname, const QString& type, const QString& gpc)
+    : Deviant(parent, name, symbol, usericon, realname, type), _id(invalidId), _gpc(gpc),
+      _rooms(0), _departed(0)
+{
+}
+
+quint32 dAmnUser::id() const
+{
+    return this->_id;
+}
+
+// With a shared table, the first of its sessions.
+dAmnSession* dAmnUser::session() const
+{
+    return this->table()->session();
+}
+
+dAmnUserTable* dAmnUser::table() const
+{
+    return qobject_cast<dAmnUserTable*>(this->parent());
+}
+
+QList<dAmnChatroom*> dAmnUser::chatrooms() const
 {
+    QList<dAmnChatroom*> rooms;
+    if(this->_rooms == 0)
+        return rooms;
+
+    foreach(dAmnSession* session, this->table()->sessions())
+        foreach(dAmnChatroom* room, session->chatrooms())
+            if(room->hasMember(this->_id))
+                rooms.append(room);
+
+    return rooms;
 }
 
-QSet<dAmnChatroom*>& dAmnUser::chatrooms()
+int dAmnUser::roomCount() const
 {
-    return this->_joinedChatrooms;
+    return this->_rooms;
 }
 
+// Users coming back usually bring the same properties; those aren't parsed again.
 void dAmnUser::setProperties(QString props)
 {
+    if(!this->_props.isNull() && props == this->_props)
+        return;
+    this->_props = props;
+
     QTextStream reader (&props);
 
     while(!reader.atEnd())
@@ -37,7 +78,7 @@ void dAmnUser::setProperties(QString props)
         else if(pair.first == "symbol") this->setSymbol(pair.second.at(0));
         else if(pair.first == "realname") this->setRealname(pair.second);
         else if(pair.first == "typename") this->setTypeName(pair.second);
-        else if(pair.first == "gpc") this->_gpc = pair.second;
+        else if(pair.first == "gpc") this->_gpc = dAmnAtom(pair.second);
         else
         {
             MNLIB_WARN("Unknown user property %s = %s for %s",
@@ -45,3 +86,13 @@ void dAmnUser::setProperties(QString props)
         }
     }
 }
+
+void dAmnUser::whois()
+{
+    this->session()->whois(this->name());
+}
+
+dAmnRequest dAmnUser::whoisAsync()
+{
+    return this->session()->whoisAsync(this->name());
+}
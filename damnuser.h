@@ -25,25 +25,40 @@
 #include "deviant.h"
 #include "timespan.h"
 
-#include <QSet>
+#include <QList>
 #include <QString>
 #include <QChar>
 
 class dAmnChatroom;
+class dAmnRequest;
+class dAmnUserTable;
 
 class MNLIBSHARED_EXPORT dAmnUser : public Deviant
 {
-    QSet<dAmnChatroom*> _joinedChatrooms;
-    QString _gpc;
+    friend class dAmnUserTable;
+
+    quint32 _id;
+    dAmnAtom _gpc;
+    QString _props;     // as last given to setProperties()
+
+    int _rooms;         // memberships held on us
+    quint64 _departed;  // when we left the last room, on the table's departure clock
 
 public:
-    dAmnUser(dAmnSession* parent, const QString& name, const QChar& symbol = QChar::Null,
+    static const quint32 invalidId = 0xFFFFFFFF;
+
+    dAmnUser(dAmnUserTable* parent, const QString& name, const QChar& symbol = QChar::Null,
              int usericon = 0, const QString& realname = QString(), const QString& type = QString(), const QString& gpc = QString());
 
-    QSet<dAmnChatroom*>& chatrooms();
+    quint32 id() const;
+    dAmnSession* session() const;
+    dAmnUserTable* table() const;
+    QList<dAmnChatroom*> chatrooms() const;
+    int roomCount() const;
 
     void setProperties(QString props);
     void whois();
+    dAmnRequest whoisAsync();
 };
 
 #endif // DAMNUSER_H
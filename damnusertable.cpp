@@ -0,0 +1,244 @@
+﻿/*
+    This file is part of
+    amnlib - A C++ library for deviantART Message Network
+    Copyright © 2013 Carl Tessier <http://drfrankenstein90.deviantart.com/>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "damnusertable.h"
+#include "damnuser.h"
+#include "damnchatroom.h"
+
+dAmnUserTable::dAmnUserTable(QObject* parent)
+    : QObject(parent), _departureClock(0), _departedCapacity(512)
+{
+}
+
+dAmnSession* dAmnUserTable::session() const
+{
+    return this->_sessions.isEmpty() ? NULL : this->_sessions.first();
+}
+
+const QList<dAmnSession*>& dAmnUserTable::sessions() const
+{
+    return this->_sessions;
+}
+
+void dAmnUserTable::attach(dAmnSession* session)
+{
+    if(!this->_sessions.contains(session))
+        this->_sessions.append(session);
+}
+
+void dAmnUserTable::detach(dAmnSession* session)
+{
+    this->_sessions.removeOne(session);
+}
+
+QList<dAmnUser*> dAmnUserTable::users() const
+{
+    QList<dAmnUser*> users;
+    users.reserve(this->_userIds.size());
+
+    foreach(dAmnUser* user, this->_users)
+        if(user) users.append(user);
+
+    return users;
+}
+
+dAmnUser* dAmnUserTable::user(quint32 id) const
+{
+    return id < (quint32) this->_users.size() ? this->_users.at(id) : NULL;
+}
+
+dAmnUser* dAmnUserTable::user(const QString& name) const
+{
+    return this->user(this->userId(dAmnName(name)));
+}
+
+dAmnUser* dAmnUserTable::user(const dAmnName& name) const
+{
+    return this->user(this->userId(name));
+}
+
+quint32 dAmnUserTable::userId(const QString& name) const
+{
+    return this->userId(dAmnName(name));
+}
+
+quint32 dAmnUserTable::userId(const dAmnName& name) const
+{
+    return this->_userIds.value(name, dAmnUser::invalidId);
+}
+
+dAmnUser* dAmnUserTable::addUser(const QString& name,
+                                 int usericon,
+                                 const QChar& symbol,
+                                 const QString& realname,
+                                 const QString& type_name,
+                                 const QString& gpc)
+{
+    dAmnUser* user = this->user(name);
+
+    if(!user && (user = this->reviveUser(name)))
+    {
+        user->setSymbol(symbol);
+        user->setUsericon(usericon);
+        user->setRealname(realname);
+        user->setTypeName(type_name);
+        user->_gpc = dAmnAtom(gpc);
+    }
+    else if(!user)
+    {
+        user = new dAmnUser(this, name, symbol, usericon, realname, type_name, gpc);
+        this->registerUser(user);
+    }
+
+    return user;
+}
+
+dAmnUser* dAmnUserTable::addUser(const QString& name, const QString& props)
+{
+    dAmnUser* user = this->user(name);
+
+    if(!user && (user = this->reviveUser(name)))
+        user->setProperties(props);
+    else if(!user)
+    {
+        user = new dAmnUser(this, name);
+        user->setProperties(props);
+        this->registerUser(user);
+    }
+
+    return user;
+}
+
+void dAmnUserTable::registerUser(dAmnUser* user)
+{
+    quint32 id;
+
+    if(!this->_freeUserIds.isEmpty())
+    {
+        id = this->_freeUserIds.last();
+        this->_freeUserIds.removeLast();
+        this->_users[id] = user;
+    }
+    else
+    {
+        id = this->_users.size();
+        if(id > dAmnMembership::maxUserId)
+            MNLIB_FAIL("Ran out of user ids (%u users).", id);
+
+        this->_users.append(user);
+    }
+
+    user->_id = id;
+    this->_userIds.insert(dAmnName(user->name()), id);
+}
+
+void dAmnUserTable::reserveUsers(int count)
+{
+    this->_users.reserve(this->_userIds.size() + count);
+    this->_userIds.reserve(this->_userIds.size() + count);
+}
+
+// Rooms hold a user for as long as they're a member, whichever session
+// they're in. One no room holds is set aside with the departed, and only
+// deleted once enough others have left after them.
+void dAmnUserTable::retainUser(dAmnUser* user)
+{
+    user->_rooms++;
+}
+
+void dAmnUserTable::releaseUser(dAmnUser* user)
+{
+    if(!user)
+        return;
+
+    if(user->_rooms <= 0)
+    {
+        MNLIB_WARN("User %s released more often than retained.", qPrintable(user->name()));
+        return;
+    }
+
+    if(--user->_rooms == 0)
+        this->departUser(user);
+}
+
+// Departs a user no room holds anymore, like one added without ever joining one.
+void dAmnUserTable::cleanupUser(const QString& name)
+{
+    dAmnUser* user = this->user(name);
+    if(!user)
+    {
+        MNLIB_WARN("Can't cleanup user %s we don't know about.", qPrintable(name));
+        return;
+    }
+
+    if(user->_rooms == 0)
+        this->departUser(user);
+}
+
+int dAmnUserTable::departedUserCapacity() const
+{
+    return this->_departedCapacity;
+}
+
+void dAmnUserTable::setDepartedUserCapacity(int users)
+{
+    this->_departedCapacity = qMax(users, 0);
+    this->trimDeparted();
+}
+
+int dAmnUserTable::departedUserCount() const
+{
+    return this->_departed.size();
+}
+
+void dAmnUserTable::departUser(dAmnUser* user)
+{
+    const dAmnName name (user->name());
+    this->_userIds.remove(name);
+    this->_users[user->id()] = NULL;
+    this->_freeUserIds.append(user->id());
+    user->_id = dAmnUser::invalidId;
+
+    user->_departed = this->_departureClock++;
+    this->_departed.insert(name, user);
+    this->_departures.insert(user->_departed, name);
+    this->trimDeparted();
+}
+
+// Welcomes a departed user back under a new id, as they were.
+dAmnUser* dAmnUserTable::reviveUser(const QString& name)
+{
+    dAmnUser* user = this->_departed.take(dAmnName(name));
+    if(!user)
+        return NULL;
+
+    this->_departures.remove(user->_departed);
+    this->registerUser(user);
+    return user;
+}
+
+void dAmnUserTable::trimDeparted()
+{
+    while(this->_departed.size() > this->_departedCapacity)
+    {
+        auto oldest = this->_departures.begin();
+        delete this->_departed.take(oldest.value());
+        this->_departures.erase(oldest);
+    }
+}
@@ -0,0 +1,99 @@
+﻿/*
+    This file is part of
+    amnlib - A C++ library for deviantART Message Network
+    Copyright © 2013 Carl Tessier <http://drfrankenstein90.deviantart.com/>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DAMNUSERTABLE_H
+#define DAMNUSERTABLE_H
+
+#include "mnlib_global.h"
+#include "damnname.h"
+
+#include <QObject>
+#include <QString>
+#include <QChar>
+#include <QList>
+#include <QVector>
+#include <QHash>
+#include <QMap>
+
+class dAmnSession;
+class dAmnUser;
+
+// The users known to one or more sessions of the same account, numbered
+// densely so that rooms can refer to them by id. Each session has its own
+// unless given a shared one, as dAmnStripedSession does for its stripes: a
+// user in rooms on several connections is then a single dAmnUser.
+//
+// The sessions sharing a table must live on its thread.
+class MNLIBSHARED_EXPORT dAmnUserTable : public QObject
+{
+    Q_OBJECT
+
+    QList<dAmnSession*> _sessions;
+
+    QVector<dAmnUser*> _users;
+    QVector<quint32> _freeUserIds;
+    QHash<dAmnName, quint32> _userIds;
+
+    // Users in no room anymore, kept a while in case they come back. They
+    // have no id and aren't among users(); the oldest go first.
+    QHash<dAmnName, dAmnUser*> _departed;
+    QMap<quint64, dAmnName> _departures;    // by when they left
+    quint64 _departureClock;
+    int _departedCapacity;
+
+public:
+    explicit dAmnUserTable(QObject* parent = 0);
+
+    // The first session to use the table; users whois through it.
+    dAmnSession* session() const;
+    const QList<dAmnSession*>& sessions() const;
+    void attach(dAmnSession* session);
+    void detach(dAmnSession* session);
+
+    QList<dAmnUser*> users() const;
+    dAmnUser* user(quint32 id) const;
+    dAmnUser* user(const QString& name) const;
+    dAmnUser* user(const dAmnName& name) const;
+    quint32 userId(const QString& name) const;
+    quint32 userId(const dAmnName& name) const;
+
+    dAmnUser* addUser(const QString& name,
+                      int usericon,
+                      const QChar& symbol,
+                      const QString& realname,
+                      const QString& type_name,
+                      const QString& gpc);
+    dAmnUser* addUser(const QString& name, const QString& props);
+    void reserveUsers(int count);
+    void retainUser(dAmnUser* user);
+    void releaseUser(dAmnUser* user);
+    void cleanupUser(const QString& name);
+
+    int departedUserCapacity() const;
+    void setDepartedUserCapacity(int users);
+    int departedUserCount() const;
+
+private:
+    void registerUser(dAmnUser* user);
+    void departUser(dAmnUser* user);
+    dAmnUser* reviveUser(const QString& name);
+    void trimDeparted();
+};
+
+#endif // DAMNUSERTABLE_H
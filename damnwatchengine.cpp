@@ -0,0 +1,955 @@
+﻿/*
+    This file is part of
+    amnlib - A C++ library for deviantART Message Network
+    Copyright © 2013 Carl Tessier <http://drfrankenstein90.deviantart.com/>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "damnwatchengine.h"
+
+#include <QString>
+#include <QChar>
+#include <QList>
+#include <QVector>
+#include <QHash>
+#include <QPair>
+#include <QByteArray>
+#include <algorithm>
+
+namespace
+{
+    inline ushort fold(QChar c)
+    {
+        const ushort u = c.unicode();
+        if(u < 0x80)
+            return (u >= 'A' && u <= 'Z') ? u + ('a' - 'A') : u;
+
+        return c.toCaseFolded().unicode();
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+struct dAmnWatchEngine::Literals
+{
+    struct Node
+    {
+        QHash<ushort, int> next;
+        int fail, output, depth;    // output: closest node down the fail chain that ends words
+        QVector<int> words;
+
+        Node() : fail(0), output(-1), depth(0) {}
+    };
+
+    QVector<Node> nodes;
+    QList<int> ids;
+
+    Literals();
+
+    void clear();
+    void insert(const QString& word, int id);
+    void link();
+    int step(int node, ushort c) const;
+};
+
+dAmnWatchEngine::Literals::Literals()
+{
+    this->clear();
+}
+
+void dAmnWatchEngine::Literals::clear()
+{
+    this->nodes.clear();
+    this->nodes.append(Node());
+    this->ids.clear();
+}
+
+void dAmnWatchEngine::Literals::insert(const QString& word, int id)
+{
+    int node = 0;
+
+    for(int i = 0; i < word.size(); ++i)
+    {
+        const ushort c = fold(word.at(i));
+        int next = this->nodes.at(node).next.value(c, -1);
+        if(next < 0)
+        {
+            next = this->nodes.size();
+            this->nodes.append(Node());
+            this->nodes[next].depth = i + 1;
+            this->nodes[node].next.insert(c, next);
+        }
+
+        node = next;
+    }
+
+    this->nodes[node].words.append(id);
+    this->ids.append(id);
+}
+
+void dAmnWatchEngine::Literals::link()
+{   // Breadth-first, so that a node's fail link is known before its children need it.
+    QVector<int> queue;
+    queue.reserve(this->nodes.size());
+    queue.append(0);
+
+    for(int head = 0; head < queue.size(); ++head)
+    {
+        const int node = queue.at(head);
+        const QHash<ushort, int> children = this->nodes.at(node).next;
+
+        for(auto it = children.constBegin(); it != children.constEnd(); ++it)
+        {
+            int fail = 0;
+            if(node != 0)
+            {
+                fail = this->nodes.at(node).fail;
+                while(fail && !this->nodes.at(fail).next.contains(it.key()))
+                    fail = this->nodes.at(fail).fail;
+                fail = this->nodes.at(fail).next.value(it.key(), 0);
+            }
+
+            Node& child = this->nodes[it.value()];
+            child.fail = fail;
+            child.output = child.words.isEmpty() ? this->nodes.at(fail).output : it.value();
+
+            queue.append(it.value());
+        }
+    }
+}
+
+int dAmnWatchEngine::Literals::step(int node, ushort c) const
+{
+    for(;;)
+    {
+        const int next = this->nodes.at(node).next.value(c, -1);
+        if(next >= 0)
+            return next;
+        if(node == 0)
+            return 0;
+
+        node = this->nodes.at(node).fail;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+struct dAmnWatchEngine::Regexes
+{
+    enum { maxDfaStates = 2048 };
+
+    typedef QPair<int, int> Hole;   // state, and which of its two outs is dangling
+
+    struct CharClass
+    {
+        QVector<QPair<ushort, ushort> > ranges;
+        bool negated;
+
+        CharClass() : negated(false) {}
+
+        void add(ushort lo, ushort hi);
+        void addEscape(QChar e);
+        bool matches(ushort c) const;
+    };
+
+    struct NState
+    {
+        enum Type { Char, Any, Class, Split, Empty, Match } type;
+        ushort c;
+        int cls, out, out1, pattern;
+    };
+
+    struct Fragment
+    {
+        int start;
+        QVector<Hole> holes;
+    };
+
+    struct Pattern
+    {
+        int start, match, states;
+    };
+
+    // A DFA state keeps its NFA states in the order the threads that reached
+    // them started, earliest first, so where each thread started can be
+    // carried along while scanning instead of being searched for afterwards.
+    struct DState
+    {
+        QVector<int> nfa;           // consuming and matching states
+        QVector<int> accepts;       // indices into nfa of the matching states
+        QVector<int> ascii;         // cached transitions, -1 when not computed yet
+        QHash<ushort, int> other;
+    };
+
+    struct Transition
+    {
+        int next;
+        QVector<int> from;          // per state of next, the index of the state in
+                                    // the old one it came from; -1 when it starts anew
+    };
+
+    QHash<int, Pattern> patterns;
+    QHash<int, QString> sources;
+    QVector<NState> nstates;
+    QVector<CharClass> classes;
+    int garbage;
+
+    QVector<int> starts;
+    QVector<DState> dstates;
+    QHash<QByteArray, int> dindex;
+    QVector<Transition> transitions;
+
+    QVector<int> marks;
+    int stamp;
+
+    Regexes();
+
+    bool add(int id, const QString& source);
+    void remove(int id);
+    void clear();
+
+    int step(int state, ushort c);     // an index into transitions
+
+private:
+    int newState(NState::Type type);
+    void patch(const QVector<Hole>& holes, int target);
+
+    bool parseAlt(const QString& re, int& pos, Fragment& frag);
+    bool parseConcat(const QString& re, int& pos, Fragment& frag);
+    bool parseRepeat(const QString& re, int& pos, Fragment& frag);
+    bool parseAtom(const QString& re, int& pos, Fragment& frag);
+    bool parseClass(const QString& re, int& pos, CharClass& cls);
+    int classState(const CharClass& cls);
+
+    bool consumes(const NState& state, ushort c) const;
+    void closure(int state, QVector<int>& set);
+
+    void flush();
+    int intern(const QVector<int>& set);
+};
+
+void dAmnWatchEngine::Regexes::CharClass::add(ushort lo, ushort hi)
+{
+    if(lo > hi)
+        qSwap(lo, hi);
+
+    this->ranges.append(qMakePair(lo, hi));
+
+    // Text gets folded before matching, so fold the class along with it.
+    const ushort ulo = qMax<ushort>(lo, 'A'), uhi = qMin<ushort>(hi, 'Z');
+    if(ulo <= uhi)
+        this->ranges.append(qMakePair<ushort, ushort>(ulo + ('a' - 'A'), uhi + ('a' - 'A')));
+    else if(lo == hi && lo >= 0x80)
+        this->ranges.append(qMakePair(fold(QChar(lo)), fold(QChar(lo))));
+}
+
+void dAmnWatchEngine::Regexes::CharClass::addEscape(QChar e)
+{
+    switch(e.toLower().toLatin1())
+    {
+    case 'd':
+        this->add('0', '9');
+        break;
+    case 'w':
+        this->add('a', 'z');
+        this->add('0', '9');
+        this->add('_', '_');
+        break;
+    case 's':
+        this->add('\t', '\n');
+        this->add('\r', '\r');
+        this->add(' ', ' ');
+        break;
+    default:
+        this->add(e.unicode(), e.unicode());
+    }
+}
+
+bool dAmnWatchEngine::Regexes::CharClass::matches(ushort c) const
+{
+    bool found = false;
+    for(int i = 0; i < this->ranges.size() && !found; ++i)
+        found = c >= this->ranges.at(i).first && c <= this->ranges.at(i).second;
+
+    return found != this->negated;
+}
+
+dAmnWatchEngine::Regexes::Regexes()
+    : garbage(0), stamp(0)
+{
+    this->flush();
+}
+
+bool dAmnWatchEngine::Regexes::add(int id, const QString& source)
+{
+    const int firststate = this->nstates.size(), firstclass = this->classes.size();
+
+    int pos = 0;
+    Fragment frag;
+    bool ok = this->parseAlt(source, pos, frag) && pos == source.size();
+
+    Pattern pattern;
+    if(ok)
+    {
+        pattern.start = frag.start;
+        pattern.match = this->newState(NState::Match);
+        pattern.states = this->nstates.size() - firststate;
+        this->nstates[pattern.match].pattern = id;
+        this->patch(frag.holes, pattern.match);
+
+        // Refuse patterns that match the empty string; they would hit everywhere.
+        QVector<int> set;
+        this->marks.resize(this->nstates.size());
+        ++this->stamp;
+        this->closure(pattern.start, set);
+        ok = !set.contains(pattern.match);
+    }
+
+    if(!ok)
+    {
+        this->nstates.resize(firststate);
+        this->classes.resize(firstclass);
+        return false;
+    }
+
+    this->patterns.insert(id, pattern);
+    this->sources.insert(id, source);
+    this->flush();
+
+    return true;
+}
+
+void dAmnWatchEngine::Regexes::remove(int id)
+{
+    if(!this->patterns.contains(id))
+        return;
+
+    this->garbage += this->patterns.take(id).states;
+    this->sources.remove(id);
+
+    if(this->garbage > this->nstates.size() / 2)
+    {   // Mostly dead states by now; recompile what's left.
+        QHash<int, QString> sources = this->sources;
+        QList<int> ids = sources.keys();
+        std::sort(ids.begin(), ids.end());
+
+        this->clear();
+        foreach(int live, ids)
+            this->add(live, sources.value(live));
+    }
+    else
+    {
+        this->flush();
+    }
+}
+
+void dAmnWatchEngine::Regexes::clear()
+{
+    this->patterns.clear();
+    this->sources.clear();
+    this->nstates.clear();
+    this->classes.clear();
+    this->garbage = 0;
+    this->flush();
+}
+
+int dAmnWatchEngine::Regexes::newState(NState::Type type)
+{
+    NState state;
+    state.type = type;
+    state.c = 0;
+    state.cls = state.out = state.out1 = state.pattern = -1;
+
+    this->nstates.append(state);
+    return this->nstates.size() - 1;
+}
+
+void dAmnWatchEngine::Regexes::patch(const QVector<Hole>& holes, int target)
+{
+    foreach(const Hole& hole, holes)
+    {
+        if(hole.second)
+            this->nstates[hole.first].out1 = target;
+        else
+            this->nstates[hole.first].out = target;
+    }
+}
+
+bool dAmnWatchEngine::Regexes::parseAlt(const QString& re, int& pos, Fragment& frag)
+{
+    if(!this->parseConcat(re, pos, frag))
+        return false;
+
+    while(pos < re.size() && re.at(pos) == '|')
+    {
+        ++pos;
+
+        Fragment right;
+        if(!this->parseConcat(re, pos, right))
+            return false;
+
+        const int split = this->newState(NState::Split);
+        this->nstates[split].out = frag.start;
+        this->nstates[split].out1 = right.start;
+
+        frag.start = split;
+        frag.holes += right.holes;
+    }
+
+    return true;
+}
+
+bool dAmnWatchEngine::Regexes::parseConcat(const QString& re, int& pos, Fragment& frag)
+{
+    bool empty = true;
+
+    while(pos < re.size() && re.at(pos) != '|' && re.at(pos) != ')')
+    {
+        Fragment next;
+        if(!this->parseRepeat(re, pos, next))
+            return false;
+
+        if(empty)
+        {
+            frag = next;
+            empty = false;
+        }
+        else
+        {
+            this->patch(frag.holes, next.start);
+            frag.holes = next.holes;
+        }
+    }
+
+    if(empty)
+    {
+        frag.start = this->newState(NState::Empty);
+        frag.holes.clear();
+        frag.holes.append(Hole(frag.start, 0));
+    }
+
+    return true;
+}
+
+bool dAmnWatchEngine::Regexes::parseRepeat(const QString& re, int& pos, Fragment& frag)
+{
+    if(!this->parseAtom(re, pos, frag))
+        return false;
+
+    while(pos < re.size())
+    {
+        const char q = re.at(pos).toLatin1();
+        if(q != '*' && q != '+' && q != '?')
+            break;
+        ++pos;
+
+        const int split = this->newState(NState::Split);
+        this->nstates[split].out = frag.start;
+
+        switch(q)
+        {
+        case '*':
+            this->patch(frag.holes, split);
+            frag.start = split;
+            frag.holes.clear();
+            break;
+        case '+':
+            this->patch(frag.holes, split);
+            frag.holes.clear();
+            break;
+        case '?':
+            frag.start = split;
+            break;
+        }
+
+        frag.holes.append(Hole(split, 1));
+    }
+
+    return true;
+}
+
+bool dAmnWatchEngine::Regexes::parseAtom(const QString& re, int& pos, Fragment& frag)
+{
+    if(pos >= re.size())
+        return false;
+
+    const QChar c = re.at(pos++);
+    int state;
+
+    switch(c.toLatin1())
+    {
+    case '(':
+        if(!this->parseAlt(re, pos, frag) || pos >= re.size() || re.at(pos) != ')')
+            return false;
+        ++pos;
+        return true;
+
+    case '[':
+    {
+        CharClass cls;
+        if(!this->parseClass(re, pos, cls))
+            return false;
+        state = this->classState(cls);
+        break;
+    }
+
+    case '.':
+        state = this->newState(NState::Any);
+        break;
+
+    case '\\':
+    {
+        if(pos >= re.size())
+            return false;
+
+        const QChar e = re.at(pos++);
+        if(QString("dDwWsS").contains(e))
+        {
+            CharClass cls;
+            cls.addEscape(e);
+            cls.negated = e.isUpper();
+            state = this->classState(cls);
+        }
+        else
+        {
+            state = this->newState(NState::Char);
+            this->nstates[state].c = fold(e);
+        }
+        break;
+    }
+
+    case ')': case '*': case '+': case '?':
+    case '^': case '$':     // no anchors
+        return false;
+
+    default:
+        state = this->newState(NState::Char);
+        this->nstates[state].c = fold(c);
+    }
+
+    frag.start = state;
+    frag.holes.clear();
+    frag.holes.append(Hole(state, 0));
+
+    return true;
+}
+
+bool dAmnWatchEngine::Regexes::parseClass(const QString& re, int& pos, CharClass& cls)
+{
+    if(pos < re.size() && re.at(pos) == '^')
+    {
+        cls.negated = true;
+        ++pos;
+    }
+
+    bool first = true;  // a leading ']' is a literal
+    while(pos < re.size() && (first || re.at(pos) != ']'))
+    {
+        first = false;
+
+        QChar lo = re.at(pos++);
+        if(lo == '\\' && pos < re.size())
+        {
+            const QChar e = re.at(pos++);
+            if(QString("dws").contains(e))
+            {
+                cls.addEscape(e);
+                continue;
+            }
+            lo = e;
+        }
+
+        QChar hi = lo;
+        if(pos + 1 < re.size() && re.at(pos) == '-' && re.at(pos + 1) != ']')
+        {
+            hi = re.at(pos + 1);
+            pos += 2;
+        }
+
+        cls.add(lo.unicode(), hi.unicode());
+    }
+
+    if(pos >= re.size())
+        return false;
+
+    ++pos;  // ']'
+    return true;
+}
+
+int dAmnWatchEngine::Regexes::classState(const CharClass& cls)
+{
+    const int state = this->newState(NState::Class);
+    this->nstates[state].cls = this->classes.size();
+    this->classes.append(cls);
+
+    return state;
+}
+
+bool dAmnWatchEngine::Regexes::consumes(const NState& state, ushort c) const
+{
+    switch(state.type)
+    {
+    case NState::Char:  return state.c == c;
+    case NState::Any:   return true;
+    case NState::Class: return this->classes.at(state.cls).matches(c);
+    default:            return false;
+    }
+}
+
+void dAmnWatchEngine::Regexes::closure(int state, QVector<int>& set)
+{   // Follows epsilon moves; only consuming and matching states end up in the set.
+    QVector<int> stack;
+    stack.append(state);
+
+    while(!stack.isEmpty())
+    {
+        const int s = stack.last();
+        stack.removeLast();
+
+        if(s < 0 || this->marks.at(s) == this->stamp)
+            continue;
+        this->marks[s] = this->stamp;
+
+        const NState& st = this->nstates.at(s);
+        switch(st.type)
+        {
+        case NState::Split:
+            stack.append(st.out1);
+            stack.append(st.out);
+            break;
+        case NState::Empty:
+            stack.append(st.out);
+            break;
+        default:
+            set.append(s);
+        }
+    }
+}
+
+void dAmnWatchEngine::Regexes::flush()
+{
+    this->dstates.clear();
+    this->dindex.clear();
+    this->transitions.clear();
+    this->marks.fill(0, this->nstates.size());
+    this->stamp = 0;
+
+    this->starts.clear();
+    ++this->stamp;
+    foreach(const Pattern& pattern, this->patterns)
+        this->closure(pattern.start, this->starts);
+
+    QVector<int> start = this->starts;
+    this->intern(start);    // always state 0
+}
+
+int dAmnWatchEngine::Regexes::intern(const QVector<int>& set)
+{
+    const QByteArray key (reinterpret_cast<const char*>(set.constData()), set.size() * sizeof(int));
+    int index = this->dindex.value(key, -1);
+    if(index >= 0)
+        return index;
+
+    DState state;
+    state.nfa = set;
+    state.ascii.fill(-1, 0x80);
+    for(int k = 0; k < set.size(); ++k)
+        if(this->nstates.at(set.at(k)).type == NState::Match)
+            state.accepts.append(k);
+
+    index = this->dstates.size();
+    this->dstates.append(state);
+    this->dindex.insert(key, index);
+
+    return index;
+}
+
+int dAmnWatchEngine::Regexes::step(int state, ushort c)
+{
+    int next = c < 0x80 ? this->dstates.at(state).ascii.at(c)
+                        : this->dstates.at(state).other.value(c, -1);
+    if(next >= 0)
+        return next;
+
+    // Not cached yet: run the NFA one step. Every position may start a match,
+    // so the pattern starts are thrown in again each time, last since they
+    // start latest. Threads are followed earliest first, and a state the
+    // closure already reached is skipped, so each state keeps the earliest
+    // thread that gets to it.
+    Transition move;
+    QVector<int> set;
+    ++this->stamp;
+
+    const QVector<int> current = this->dstates.at(state).nfa;
+    for(int k = 0; k < current.size(); ++k)
+    {
+        const NState& st = this->nstates.at(current.at(k));
+        if(!this->consumes(st, c))
+            continue;
+
+        this->closure(st.out, set);
+        while(move.from.size() < set.size())
+            move.from.append(k);
+    }
+    foreach(int s, this->starts)
+        this->closure(s, set);
+    while(move.from.size() < set.size())
+        move.from.append(-1);
+
+    const bool full = this->dstates.size() >= maxDfaStates;
+    if(full)
+        this->flush();
+
+    move.next = this->intern(set);
+    next = this->transitions.size();
+    this->transitions.append(move);
+
+    if(!full)
+    {
+        if(c < 0x80)
+            this->dstates[state].ascii[c] = next;
+        else
+            this->dstates[state].other.insert(c, next);
+    }
+
+    return next;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+dAmnWatchEngine::dAmnWatchEngine()
+    : _nextid(1),
+      _base(new Literals), _recent(new Literals), _deadwords(0),
+      _regexes(new Regexes)
+{
+}
+
+dAmnWatchEngine::~dAmnWatchEngine()
+{
+    delete this->_base;
+    delete this->_recent;
+    delete this->_regexes;
+}
+
+int dAmnWatchEngine::addWord(const QString& word, bool wholeword)
+{
+    if(word.isEmpty())
+    {
+        MNLIB_WARN("Refusing to watch an empty word.");
+        return -1;
+    }
+
+    const int id = this->_nextid++;
+
+    Entry entry;
+    entry.pattern = word;
+    entry.regex = false;
+    entry.wholeword = wholeword;
+    this->_entries.insert(id, entry);
+
+    // Only the small automaton gets rebuilt, until it's worth folding into the big one.
+    QList<int> recent = this->_recent->ids;
+    recent.append(id);
+
+    if(recent.size() > qMax(32, this->_base->ids.size() / 8))
+        this->foldLiterals();
+    else
+        this->rebuildLiterals(this->_recent, recent);
+
+    return id;
+}
+
+int dAmnWatchEngine::addPattern(const QString& pattern)
+{
+    const int id = this->_nextid;
+
+    if(!this->_regexes->add(id, pattern))
+    {
+        MNLIB_WARN("Unsupported watch pattern: %s", qPrintable(pattern));
+        return -1;
+    }
+
+    Entry entry;
+    entry.pattern = pattern;
+    entry.regex = true;
+    entry.wholeword = false;
+    this->_entries.insert(id, entry);
+
+    ++this->_nextid;
+    return id;
+}
+
+void dAmnWatchEngine::remove(int id)
+{
+    auto it = this->_entries.find(id);
+    if(it == this->_entries.end())
+        return;
+
+    const bool regex = it->regex;
+    this->_entries.erase(it);
+
+    if(regex)
+    {
+        this->_regexes->remove(id);
+    }
+    else if(this->_recent->ids.contains(id))
+    {
+        QList<int> recent = this->_recent->ids;
+        recent.removeOne(id);
+        this->rebuildLiterals(this->_recent, recent);
+    }
+    else if(++this->_deadwords > this->_base->ids.size() / 4)
+    {   // Hits on removed words are filtered out until then.
+        this->foldLiterals();
+    }
+}
+
+void dAmnWatchEngine::clear()
+{
+    this->_entries.clear();
+    this->_base->clear();
+    this->_recent->clear();
+    this->_deadwords = 0;
+    this->_regexes->clear();
+}
+
+bool dAmnWatchEngine::isEmpty() const
+{
+    return this->_entries.isEmpty();
+}
+
+int dAmnWatchEngine::count() const
+{
+    return this->_entries.size();
+}
+
+QString dAmnWatchEngine::pattern(int id) const
+{
+    return this->_entries.value(id).pattern;
+}
+
+bool dAmnWatchEngine::isRegex(int id) const
+{
+    return this->_entries.value(id).regex;
+}
+
+QList<dAmnWatchHit> dAmnWatchEngine::match(const QString& text)
+{
+    QList<dAmnWatchHit> hits;
+    if(this->_entries.isEmpty())
+        return hits;
+
+    auto collect = [&](const Literals* literals, int node, int end)
+    {
+        for(int o = literals->nodes.at(node).output; o >= 0;
+            o = literals->nodes.at(literals->nodes.at(o).fail).output)
+        {
+            const int length = literals->nodes.at(o).depth;
+
+            foreach(int id, literals->nodes.at(o).words)
+            {
+                auto entry = this->_entries.constFind(id);
+                if(entry == this->_entries.constEnd())
+                    continue;   // removed
+
+                if(entry->wholeword && !this->isWholeWord(text, end - length, length))
+                    continue;
+
+                dAmnWatchHit hit = { id, end - length, length };
+                hits.append(hit);
+            }
+        }
+    };
+
+    const bool regexes = !this->_regexes->patterns.isEmpty();
+    QHash<int, int> lastregexhit;   // pattern id -> index in hits
+    int base = 0, recent = 0, dfa = 0;
+
+    // Where the thread in each state of the current DFA state started.
+    QVector<int> starts, nextstarts;
+    if(regexes)
+        starts.fill(0, this->_regexes->dstates.at(0).nfa.size());
+
+    for(int i = 0; i < text.size(); ++i)
+    {
+        const ushort c = fold(text.at(i));
+
+        base = this->_base->step(base, c);
+        collect(this->_base, base, i + 1);
+
+        recent = this->_recent->step(recent, c);
+        collect(this->_recent, recent, i + 1);
+
+        if(!regexes)
+            continue;
+
+        const Regexes::Transition& move = this->_regexes->transitions.at(this->_regexes->step(dfa, c));
+        dfa = move.next;
+
+        nextstarts.resize(move.from.size());
+        for(int k = 0; k < move.from.size(); ++k)
+            nextstarts[k] = move.from.at(k) >= 0 ? starts.at(move.from.at(k)) : i + 1;
+        starts.swap(nextstarts);
+
+        const Regexes::DState& current = this->_regexes->dstates.at(dfa);
+        foreach(int k, current.accepts)
+        {
+            const int id = this->_regexes->nstates.at(current.nfa.at(k)).pattern;
+            const int start = starts.at(k);
+
+            // The DFA fires at every position a match could end; grow the last hit instead of piling up new ones.
+            auto last = lastregexhit.constFind(id);
+            if(last != lastregexhit.constEnd() && hits.at(*last).start == start)
+            {
+                hits[*last].length = i + 1 - start;
+                continue;
+            }
+
+            dAmnWatchHit hit = { id, start, i + 1 - start };
+            lastregexhit.insert(id, hits.size());
+            hits.append(hit);
+        }
+    }
+
+    return hits;
+}
+
+void dAmnWatchEngine::rebuildLiterals(Literals* literals, const QList<int>& ids)
+{
+    literals->clear();
+
+    foreach(int id, ids)
+        literals->insert(this->_entries.value(id).pattern, id);
+
+    literals->link();
+}
+
+void dAmnWatchEngine::foldLiterals()
+{
+    QList<int> words;
+    for(auto it = this->_entries.constBegin(); it != this->_entries.constEnd(); ++it)
+        if(!it->regex)
+            words.append(it.key());
+
+    this->rebuildLiterals(this->_base, words);
+    this->_recent->clear();
+    this->_deadwords = 0;
+}
+
+bool dAmnWatchEngine::isWholeWord(const QString& text, int start, int length) const
+{
+    return (start == 0 || !text.at(start - 1).isLetterOrNumber())
+        && (start + length >= text.size() || !text.at(start + length).isLetterOrNumber());
+}
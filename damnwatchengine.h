@@ -0,0 +1,93 @@
+﻿/*
+    This file is part of
+    amnlib - A C++ library for deviantART Message Network
+    Copyright © 2013 Carl Tessier <http://drfrankenstein90.deviantart.com/>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DAMNWATCHENGINE_H
+#define DAMNWATCHENGINE_H
+
+#include "mnlib_global.h"
+
+#include <QString>
+#include <QList>
+#include <QHash>
+
+struct MNLIBSHARED_EXPORT dAmnWatchHit
+{
+    int pattern;    // id handed out by addWord() or addPattern()
+    int start;      // position of the match in the plain text
+    int length;
+};
+
+// Matches a whole watch list against a message in a single pass.
+//
+// Words are compiled into Aho-Corasick automata, and simple regexes into one
+// NFA that is turned into a DFA lazily, as text runs through it. Matching is
+// case-insensitive.
+//
+// Words can be added and removed at any time. New words go into a small
+// automaton which gets folded into the main one once it has grown enough;
+// removed ones are filtered out until the next fold.
+//
+// Supported regex syntax: literals, '.', [classes] with ranges and '^'
+// negation, \d \w \s, grouping, '|', and the '*', '+' and '?' quantifiers.
+// Patterns that can match the empty string are refused.
+class MNLIBSHARED_EXPORT dAmnWatchEngine
+{
+    struct Literals;
+    struct Regexes;
+
+    struct Entry
+    {
+        QString pattern;
+        bool regex, wholeword;
+    };
+
+    QHash<int, Entry> _entries;
+    int _nextid;
+
+    Literals* _base;
+    Literals* _recent;
+    int _deadwords;
+
+    Regexes* _regexes;
+
+public:
+    dAmnWatchEngine();
+    ~dAmnWatchEngine();
+
+    int addWord(const QString& word, bool wholeword = false);
+    int addPattern(const QString& pattern);
+    void remove(int id);
+    void clear();
+
+    bool isEmpty() const;
+    int count() const;
+    QString pattern(int id) const;
+    bool isRegex(int id) const;
+
+    QList<dAmnWatchHit> match(const QString& text);
+
+private:
+    void rebuildLiterals(Literals* literals, const QList<int>& ids);
+    void foldLiterals();
+    bool isWholeWord(const QString& text, int start, int length) const;
+
+    Q_DISABLE_COPY(dAmnWatchEngine)
+};
+
+#endif // DAMNWATCHENGINE_H
@@ -27,12 +27,12 @@
 Deviant::Deviant(QObject* parent, const QString& name, const QChar& symbol, int usericon, const QString& realname, const QString& type)
     : QObject(parent), _name(name), _realname(realname), _type(type), _symbol(symbol), _usericon(usericon)
 {
-    this->setObjectName(this->_name);
+    this->setObjectName(this->_name.toString());
 }
 
 const QString& Deviant::name() const
 {
-    return this->_name;
+    return this->_name.toString();
 }
 
 const QString& Deviant::realName() const
@@ -42,7 +42,7 @@ const QString& Deviant::realName() const
 
 const QString& Deviant::typeName() const
 {
-    return this->_type;
+    return this->_type.toString();
 }
 
 const QChar& Deviant::symbol() const
@@ -52,7 +52,7 @@ const QChar& Deviant::symbol() const
 
 void Deviant::setName(const QString& name)
 {
-    this->_name = name;
+    this->_name = dAmnAtom(name);
 }
 
 void Deviant::setRealname(const QString& realname)
@@ -62,7 +62,7 @@ void Deviant::setRealname(const QString& realname)
 
 void Deviant::setTypeName(const QString& type)
 {
-    this->_type = type;
+    this->_type = dAmnAtom(type);
 }
 
 void Deviant::setSymbol(const QChar& symbol)
@@ -77,7 +77,7 @@ void Deviant::setUsericon(int usericon)
 
 QUrl Deviant::iconUrl() const
 {
-    return iconUrl(this->_name, this->_usericon);
+    return iconUrl(this->_name.toString(), this->_usericon);
 }
 
 QUrl Deviant::iconUrl(QString name, int usericon)
@@ -111,5 +111,5 @@ QUrl Deviant::iconUrl(QString name, int usericon)
 
 QUrl Deviant::profileUrl() const
 {
-    return QUrl(QString("http://%1.deviantart.com/").arg(this->_name.toLower()));
+    return QUrl(QString("http://%1.deviantart.com/").arg(this->_name.toString().toLower()));
 }
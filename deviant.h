@@ -21,6 +21,7 @@
 #define DEVIANT_H
 
 #include "mnlib_global.h"
+#include "damnatom.h"
 
 #include <QObject>
 #include <QString>
@@ -32,7 +33,9 @@ class MNLIBSHARED_EXPORT Deviant : public QObject
 {
     Q_OBJECT
 
-    QString _name, _realname, _type;
+    dAmnAtom _name;     // held, so parsed names share its string
+    QString _realname;
+    dAmnAtom _type;
     QChar _symbol;
     int _usericon;
 
@@ -409,6 +409,31 @@ const dAmnRichText& ActionEvent::action() const
     return this->_action;
 }
 ///////////////////////////////////////////////////////////////////////////////
+WatchHitEvent::WatchHitEvent(dAmnSession* parent, dAmnPacket& packet, const QString& username,
+                             const QString& text, const QList<dAmnWatchHit>& hits)
+    : ChatroomEvent(parent, packet),
+      _username(username), _text(text),
+      _action(packet.subPacket().command() == dAmnPacket::action),
+      _hits(hits)
+{
+}
+const QString& WatchHitEvent::userName() const
+{
+    return this->_username;
+}
+const QString& WatchHitEvent::text() const
+{
+    return this->_text;
+}
+bool WatchHitEvent::isAction() const
+{
+    return this->_action;
+}
+const QList<dAmnWatchHit>& WatchHitEvent::hits() const
+{
+    return this->_hits;
+}
+///////////////////////////////////////////////////////////////////////////////
 JoinEvent::JoinEvent(dAmnSession* parent, dAmnPacket& packet)
     : ChatroomEvent(parent, packet)
 {
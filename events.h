@@ -24,6 +24,7 @@
 #include "damnchatroom.h"
 #include "timespan.h"
 #include "damnrichtext.h"
+#include "damnwatchengine.h"
 
 #include <QObject>
 #include <QChar>
@@ -196,6 +197,21 @@ public:
     const dAmnRichText& action() const;
 };
 
+// Not a packet of its own: raised when a message or action hits the session's watch list.
+class MNLIBSHARED_EXPORT WatchHitEvent : public ChatroomEvent
+{
+    QString _username, _text;
+    bool _action;
+    QList<dAmnWatchHit> _hits;
+public:
+    WatchHitEvent(dAmnSession* parent, dAmnPacket& packet, const QString& username,
+                  const QString& text, const QList<dAmnWatchHit>& hits);
+    const QString& userName() const;
+    const QString& text() const;
+    bool isAction() const;
+    const QList<dAmnWatchHit>& hits() const;
+};
+
 class MNLIBSHARED_EXPORT JoinEvent : public ChatroomEvent
 {
     QString _username, _props;
@@ -29,6 +29,7 @@ class PropertyEvent;
 class WhoisEvent;
 class MsgEvent;
 class ActionEvent;
+class WatchHitEvent;
 class JoinEvent;
 class PartEvent;
 class KickEvent;
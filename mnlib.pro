@@ -18,9 +18,25 @@ SOURCES += damnsession.cpp \
     damnuser.cpp \
     damnobject.cpp \
     damnpacketparser.cpp \
-    damnpacketdevice.cpp \
     scrapingauthenticationprovider.cpp \
-    damnrichtext.cpp
+    damnrichtext.cpp \
+    damnname.cpp \
+    damnwatchengine.cpp \
+    damnroomhistory.cpp \
+    damnlogstore.cpp \
+    damnlogindex.cpp \
+    damnsnapshot.cpp \
+    damnjoinscheduler.cpp \
+    damnsessionmanager.cpp \
+    damnstrandexecutor.cpp \
+    damnstripedsession.cpp \
+    damnprotocolcore.cpp \
+    damntransport.cpp \
+    damnrequest.cpp \
+    damnquerycache.cpp \
+    damnatom.cpp \
+    damnroomkey.cpp \
+    damnusertable.cpp
 HEADERS += damnsession.h \
     mnlib_global.h \
     damnpacket.h \
@@ -33,9 +49,34 @@ HEADERS += damnsession.h \
     evtfwd.h \
     damnobject.h \
     damnpacketparser.h \
-    damnpacketdevice.h \
     scrapingauthenticationprovider.h \
-    damnrichtext.h
+    damnrichtext.h \
+    damnname.h \
+    damnwatchengine.h \
+    damnroomhistory.h \
+    damnlogstore.h \
+    damnlogindex.h \
+    damnsnapshot.h \
+    damnjoinscheduler.h \
+    damnsessionmanager.h \
+    damnstrandexecutor.h \
+    damnstripedsession.h \
+    damnprotocolcore.h \
+    damntransport.h \
+    damnrequest.h \
+    damnquerycache.h \
+    damnatom.h \
+    damnroomkey.h \
+    damnusertable.h
+linux {
+    SOURCES += damnepolltransport.cpp
+    HEADERS += damnepolltransport.h
+}
+# qmake CONFIG+=liburing to have dAmnEpollLoop read and write through io_uring
+liburing {
+    DEFINES += MNLIB_HAVE_LIBURING
+    LIBS += -luring
+}
 debug:DEFINES += MNLIB_DEBUG_BUILD
 else:DEFINES += MNLIB_RELEASE_BUILD
 